@@ -0,0 +1,154 @@
+#include "aov.h"
+#include <cstring>
+
+void AOVBuffers::allocate(int w, int h, unsigned int mask) {
+	width = w;
+	height = h;
+	this->mask = mask;
+	for (int t = 0; t < AOV_COUNT; t++) {
+		for (int c = 0; c < 3; c++) {
+			if (enabled(AOVType(t)) && c < numChannels(AOVType(t)))
+				planes[t][c].assign(w * h, 0.0f);
+			else
+				vector<float>().swap(planes[t][c]);
+		}
+	}
+}
+
+void AOVBuffers::write(int i, int j, float depth, const glm::vec3 &normal, float id, const ofColor &albedo) {
+	int index = j * width + i;
+	if (enabled(AOV_DEPTH))
+		planes[AOV_DEPTH][0][index] = depth;
+	if (enabled(AOV_NORMAL)) {
+		planes[AOV_NORMAL][0][index] = normal.x;
+		planes[AOV_NORMAL][1][index] = normal.y;
+		planes[AOV_NORMAL][2][index] = normal.z;
+	}
+	if (enabled(AOV_OBJECT_ID))
+		planes[AOV_OBJECT_ID][0][index] = id;
+	if (enabled(AOV_ALBEDO)) {
+		planes[AOV_ALBEDO][0][index] = albedo.r / 255.0f;
+		planes[AOV_ALBEDO][1][index] = albedo.g / 255.0f;
+		planes[AOV_ALBEDO][2][index] = albedo.b / 255.0f;
+	}
+}
+
+void AOVBuffers::writeMiss(int i, int j) {
+	write(i, j, std::numeric_limits<float>::infinity(), glm::vec3(0, 0, 0), 0, ofColor(0, 0, 0));
+}
+
+bool AOVBuffers::saveEXR(const string &path, const ofImage &beauty) const {
+	static const char *layers[AOV_COUNT] = { "depth", "normal", "id", "albedo" };
+	static const char *suffixes[AOV_COUNT][3] = { { "Z" }, { "X", "Y", "Z" }, { "" }, { "R", "G", "B" } };
+
+	//Beauty channels, converted to float and kept in their own planes
+	vector<float> rgb[3];
+	const ofPixels &pixels = beauty.getPixels();
+	int channels = pixels.getNumChannels();
+	for (int c = 0; c < 3; c++) {
+		rgb[c].resize(width * height);
+		for (int k = 0; k < width * height; k++)
+			rgb[c][k] = pixels.getData()[k * channels + c] / 255.0f;
+	}
+
+	//AOV rows are in render order, flip them to match the mirrored beauty image
+	vector<vector<float>> flipped;
+	vector<string> names = { "R", "G", "B" };
+	for (int t = 0; t < AOV_COUNT; t++) {
+		if (!enabled(AOVType(t))) continue;
+		for (int c = 0; c < numChannels(AOVType(t)); c++) {
+			string name = layers[t];
+			if (suffixes[t][c][0]) name += string(".") + suffixes[t][c];
+			names.push_back(name);
+			flipped.push_back(vector<float>(width * height));
+			for (int j = 0; j < height; j++)
+				std::copy(planes[t][c].begin() + j * width, planes[t][c].begin() + (j + 1) * width,
+					flipped.back().begin() + (height - 1 - j) * width);
+		}
+	}
+	vector<const float *> data = { rgb[0].data(), rgb[1].data(), rgb[2].data() };
+	for (int k = 0; k < flipped.size(); k++)
+		data.push_back(flipped[k].data());
+	return writeEXR(path, width, height, names, data);
+}
+
+//  Little endian writers for the EXR header
+//
+static void putInt(string &out, int32_t v) {
+	for (int b = 0; b < 4; b++) out.push_back(char((v >> (8 * b)) & 0xff));
+}
+static void putFloat(string &out, float f) {
+	int32_t v;
+	memcpy(&v, &f, 4);
+	putInt(out, v);
+}
+static void putAttribute(string &out, const string &name, const string &type, const string &value) {
+	out += name;
+	out.push_back(0);
+	out += type;
+	out.push_back(0);
+	putInt(out, value.size());
+	out += value;
+}
+
+bool writeEXR(const string &path, int width, int height, const vector<string> &names, const vector<const float *> &planes) {
+	//EXR wants the channel list sorted by name
+	vector<int> order(names.size());
+	for (int k = 0; k < order.size(); k++) order[k] = k;
+	std::sort(order.begin(), order.end(), [&](int a, int b) { return names[a] < names[b]; });
+
+	string channels, box, value;
+	for (int k : order) {
+		channels += names[k];
+		channels.push_back(0);
+		putInt(channels, 2);            // pixel type FLOAT
+		channels += string(4, '\0');    // pLinear + reserved
+		putInt(channels, 1);            // x sampling
+		putInt(channels, 1);            // y sampling
+	}
+	channels.push_back(0);
+	putInt(box, 0);
+	putInt(box, 0);
+	putInt(box, width - 1);
+	putInt(box, height - 1);
+
+	string header;
+	putInt(header, 20000630);           // magic number
+	putInt(header, 2);                  // version 2, single part scanline
+	putAttribute(header, "channels", "chlist", channels);
+	putAttribute(header, "compression", "compression", string(1, '\0'));
+	putAttribute(header, "dataWindow", "box2i", box);
+	putAttribute(header, "displayWindow", "box2i", box);
+	putAttribute(header, "lineOrder", "lineOrder", string(1, '\0'));
+	value.clear(); putFloat(value, 1);
+	putAttribute(header, "pixelAspectRatio", "float", value);
+	value.clear(); putFloat(value, 0); putFloat(value, 0);
+	putAttribute(header, "screenWindowCenter", "v2f", value);
+	value.clear(); putFloat(value, 1);
+	putAttribute(header, "screenWindowWidth", "float", value);
+	header.push_back(0);
+
+	ofstream file(ofToDataPath(path), ios::binary);
+	if (!file) return false;
+	file.write(header.data(), header.size());
+
+	//Offset table, one uncompressed scanline per block
+	int lineBytes = 8 + width * 4 * names.size();
+	uint64_t offset = header.size() + 8 * (uint64_t)height;
+	for (int y = 0; y < height; y++, offset += lineBytes) {
+		unsigned char bytes[8];
+		for (int b = 0; b < 8; b++) bytes[b] = (offset >> (8 * b)) & 0xff;
+		file.write((const char *)bytes, 8);
+	}
+	string line;
+	for (int y = 0; y < height; y++) {
+		line.clear();
+		putInt(line, y);
+		putInt(line, lineBytes - 8);
+		for (int k : order)
+			for (int x = 0; x < width; x++)
+				putFloat(line, planes[k][y * width + x]);
+		file.write(line.data(), line.size());
+	}
+	return file.good();
+}
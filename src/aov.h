@@ -0,0 +1,53 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Arbitrary output variables (AOVs): extra per pixel data captured from the
+//  primary hits during the beauty render. Each channel is a separate (planar)
+//  float buffer laid out in render order, row j = image row j before mirroring.
+//
+enum AOVType {
+	AOV_DEPTH,         // distance from the camera to the hit, infinity on miss
+	AOV_NORMAL,        // world space shading normal (x, y, z)
+	AOV_OBJECT_ID,     // scene index + 1, 0 on miss
+	AOV_ALBEDO,        // diffuse color in [0, 1] (r, g, b)
+	AOV_COUNT
+};
+
+class AOVBuffers {
+public:
+	//  Allocate the planes for the AOVs whose bit (1 << AOVType) is set in mask
+	//
+	void allocate(int w, int h, unsigned int mask);
+	bool enabled(AOVType type) const { return (mask & (1u << type)) != 0; }
+	bool empty() const { return mask == 0; }
+	int numChannels(AOVType type) const { return (type == AOV_NORMAL || type == AOV_ALBEDO) ? 3 : 1; }
+	int bytesPerPixel() const {
+		int bytes = 0;
+		for (int t = 0; t < AOV_COUNT; t++)
+			if (enabled(AOVType(t))) bytes += numChannels(AOVType(t)) * sizeof(float);
+		return bytes;
+	}
+	float *plane(AOVType type, int channel = 0) { return planes[type][channel].data(); }
+	const float *plane(AOVType type, int channel = 0) const { return planes[type][channel].data(); }
+
+	void write(int i, int j, float depth, const glm::vec3 &normal, float id, const ofColor &albedo);
+	void writeMiss(int i, int j);
+
+	//  Save the beauty image (already right side up) and all enabled AOVs into
+	//  one uncompressed multi-channel OpenEXR file
+	//
+	bool saveEXR(const string &path, const ofImage &beauty) const;
+
+	int width = 0;
+	int height = 0;
+	unsigned int mask = 0;
+
+private:
+	vector<float> planes[AOV_COUNT][3];
+};
+
+//  Write float planes as a single part, scanline, uncompressed OpenEXR file.
+//  Rows of each plane are top to bottom.
+//
+bool writeEXR(const string &path, int width, int height, const vector<string> &names, const vector<const float *> &planes);
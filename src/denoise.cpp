@@ -0,0 +1,138 @@
+#include "denoise.h"
+#include "simd.h"
+#include <thread>
+#include <cstring>
+
+static const float kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+
+float Denoiser::denoise(float *r, float *g, float *b, const AOVBuffers &guides, const DenoiseSettings &settings) {
+	uint64_t start = ofGetElapsedTimeMicros();
+	this->settings = settings;
+	width = guides.width;
+	height = guides.height;
+	for (int c = 0; c < 3; c++) {
+		normal[c] = guides.plane(AOV_NORMAL, c);
+		albedo[c] = guides.plane(AOV_ALBEDO, c);
+		scratch[c].resize(width * height);
+	}
+	//Misses have infinite depth, clamp so differences stay finite
+	depth.resize(width * height);
+	const float *z = guides.plane(AOV_DEPTH);
+	for (int k = 0; k < width * height; k++)
+		depth[k] = min(z[k], 1e4f);
+
+	int threads = settings.threads > 0 ? settings.threads : max(1, (int)std::thread::hardware_concurrency());
+	float *image[3] = { r, g, b };
+	float colorScale = 1.0f / (settings.sigmaColor * settings.sigmaColor);
+	for (int i = 0; i < settings.iterations; i++) {
+		//Ping-pong between the image and scratch buffers
+		for (int c = 0; c < 3; c++) {
+			in[c] = (i % 2 == 0) ? image[c] : scratch[c].data();
+			out[c] = (i % 2 == 0) ? scratch[c].data() : image[c];
+		}
+		int step = 1 << i;
+		vector<std::thread> workers;
+		int rows = (height + threads - 1) / threads;
+		for (int t = 0; t < threads; t++) {
+			int y0 = t * rows, y1 = min(height, y0 + rows);
+			if (y0 < y1)
+				workers.push_back(std::thread(&Denoiser::filterRows, this, y0, y1, step, colorScale));
+		}
+		for (int t = 0; t < workers.size(); t++)
+			workers[t].join();
+		colorScale *= 4.0f;
+	}
+	//Odd pass count leaves the result in scratch
+	if (settings.iterations % 2 == 1)
+		for (int c = 0; c < 3; c++)
+			std::copy(scratch[c].begin(), scratch[c].end(), image[c]);
+
+	return (ofGetElapsedTimeMicros() - start) / 1000.0f;
+}
+
+//  Scalar filter for one pixel, clamping taps at the image border
+//
+void Denoiser::filterPixel(int x, int y, int step, float colorScale) {
+	int p = y * width + x;
+	float normalScale = 1.0f / settings.sigmaNormal;
+	float depthScale = 1.0f / (settings.sigmaDepth * max(depth[p], 1e-3f));
+	float albedoScale = 1.0f / (settings.sigmaAlbedo * settings.sigmaAlbedo);
+	float sum[3] = { 0, 0, 0 }, weights = 0;
+	for (int ky = -2; ky <= 2; ky++) {
+		int qy = min(max(y + ky * step, 0), height - 1);
+		for (int kx = -2; kx <= 2; kx++) {
+			int qx = min(max(x + kx * step, 0), width - 1);
+			int q = qy * width + qx;
+			float dr = in[0][q] - in[0][p], dg = in[1][q] - in[1][p], db = in[2][q] - in[2][p];
+			float ar = albedo[0][q] - albedo[0][p], ag = albedo[1][q] - albedo[1][p], ab = albedo[2][q] - albedo[2][p];
+			float ndot = normal[0][q] * normal[0][p] + normal[1][q] * normal[1][p] + normal[2][q] * normal[2][p];
+			float e = (dr * dr + dg * dg + db * db) * colorScale
+				+ max(0.0f, 1.0f - ndot) * normalScale
+				+ fabs(depth[q] - depth[p]) * depthScale
+				+ (ar * ar + ag * ag + ab * ab) * albedoScale;
+			float w = kernel[kx + 2] * kernel[ky + 2] * fastExp(-e);
+			sum[0] += in[0][q] * w;
+			sum[1] += in[1][q] * w;
+			sum[2] += in[2][q] * w;
+			weights += w;
+		}
+	}
+	for (int c = 0; c < 3; c++)
+		out[c][p] = sum[c] / weights;
+}
+
+void Denoiser::filterRows(int y0, int y1, int step, float colorScale) {
+	int border = 2 * step;
+	for (int y = y0; y < y1; y++) {
+		int x = 0;
+		bool interiorRow = (y >= border && y < height - border);
+#if defined(__SSE2__)
+		if (interiorRow) {
+			for (; x < border; x++)
+				filterPixel(x, y, step, colorScale);
+			//Four pixels at a time, every tap of the four lies in one contiguous load
+			__m128 normalScale = _mm_set1_ps(1.0f / settings.sigmaNormal);
+			__m128 albedoScale = _mm_set1_ps(1.0f / (settings.sigmaAlbedo * settings.sigmaAlbedo));
+			__m128 cScale = _mm_set1_ps(colorScale);
+			__m128 one = _mm_set1_ps(1.0f);
+			__m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+			for (; x + 4 <= width - border; x += 4) {
+				int p = y * width + x;
+				__m128 c0 = _mm_loadu_ps(in[0] + p), c1 = _mm_loadu_ps(in[1] + p), c2 = _mm_loadu_ps(in[2] + p);
+				__m128 n0 = _mm_loadu_ps(normal[0] + p), n1 = _mm_loadu_ps(normal[1] + p), n2 = _mm_loadu_ps(normal[2] + p);
+				__m128 a0 = _mm_loadu_ps(albedo[0] + p), a1 = _mm_loadu_ps(albedo[1] + p), a2 = _mm_loadu_ps(albedo[2] + p);
+				__m128 z = _mm_loadu_ps(depth.data() + p);
+				__m128 depthScale = _mm_div_ps(one, _mm_mul_ps(_mm_set1_ps(settings.sigmaDepth), _mm_max_ps(z, _mm_set1_ps(1e-3f))));
+				__m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps(), s2 = _mm_setzero_ps(), ws = _mm_setzero_ps();
+				for (int ky = -2; ky <= 2; ky++) {
+					for (int kx = -2; kx <= 2; kx++) {
+						int q = p + ky * step * width + kx * step;
+						__m128 q0 = _mm_loadu_ps(in[0] + q), q1 = _mm_loadu_ps(in[1] + q), q2 = _mm_loadu_ps(in[2] + q);
+						__m128 d0 = _mm_sub_ps(q0, c0), d1 = _mm_sub_ps(q1, c1), d2 = _mm_sub_ps(q2, c2);
+						__m128 e = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d0, d0), _mm_mul_ps(d1, d1)), _mm_mul_ps(d2, d2)), cScale);
+						__m128 ndot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(normal[0] + q), n0),
+							_mm_mul_ps(_mm_loadu_ps(normal[1] + q), n1)), _mm_mul_ps(_mm_loadu_ps(normal[2] + q), n2));
+						e = _mm_add_ps(e, _mm_mul_ps(_mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(one, ndot)), normalScale));
+						__m128 dz = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(depth.data() + q), z), absMask);
+						e = _mm_add_ps(e, _mm_mul_ps(dz, depthScale));
+						__m128 b0 = _mm_sub_ps(_mm_loadu_ps(albedo[0] + q), a0);
+						__m128 b1 = _mm_sub_ps(_mm_loadu_ps(albedo[1] + q), a1);
+						__m128 b2 = _mm_sub_ps(_mm_loadu_ps(albedo[2] + q), a2);
+						e = _mm_add_ps(e, _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, b0), _mm_mul_ps(b1, b1)), _mm_mul_ps(b2, b2)), albedoScale));
+						__m128 w = _mm_mul_ps(_mm_set1_ps(kernel[kx + 2] * kernel[ky + 2]), fastExp4(_mm_sub_ps(_mm_setzero_ps(), e)));
+						s0 = _mm_add_ps(s0, _mm_mul_ps(q0, w));
+						s1 = _mm_add_ps(s1, _mm_mul_ps(q1, w));
+						s2 = _mm_add_ps(s2, _mm_mul_ps(q2, w));
+						ws = _mm_add_ps(ws, w);
+					}
+				}
+				_mm_storeu_ps(out[0] + p, _mm_div_ps(s0, ws));
+				_mm_storeu_ps(out[1] + p, _mm_div_ps(s1, ws));
+				_mm_storeu_ps(out[2] + p, _mm_div_ps(s2, ws));
+			}
+		}
+#endif
+		for (; x < width; x++)
+			filterPixel(x, y, step, colorScale);
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "ofMain.h"
+#include "aov.h"
+
+//  Edge-avoiding a-trous wavelet denoiser (Dammertz et al. 2010). Each pass is a
+//  5x5 B3 spline filter whose taps are spread 2^i pixels apart, with weights
+//  that fall off across color, normal, depth and albedo edges taken from the
+//  primary hit AOVs. Works on planar float RGB, SSE vectorized, rows split
+//  across threads.
+//
+struct DenoiseSettings {
+	int iterations = 5;
+	float sigmaColor = 0.6;     // color difference scale, halved every pass
+	float sigmaNormal = 0.1;    // 1 - dot(n, nq) scale
+	float sigmaDepth = 0.05;    // relative depth difference scale
+	float sigmaAlbedo = 0.1;    // albedo difference scale
+	int threads = 0;            // 0 = hardware concurrency
+};
+
+class Denoiser {
+public:
+	//  Filter the planar rgb channels (values in [0, 1]) in place. Guides must
+	//  have depth, normal and albedo enabled. Returns the time taken in ms.
+	//
+	float denoise(float *r, float *g, float *b, const AOVBuffers &guides, const DenoiseSettings &settings);
+
+private:
+	void filterRows(int y0, int y1, int step, float colorScale);
+	void filterPixel(int x, int y, int step, float colorScale);
+
+	int width = 0, height = 0;
+	const float *in[3];
+	float *out[3];
+	const float *normal[3];
+	const float *albedo[3];
+	vector<float> depth;
+	vector<float> scratch[3];
+	DenoiseSettings settings;
+};
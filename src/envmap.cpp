@@ -0,0 +1,124 @@
+#include "envmap.h"
+
+void AliasTable::build(const vector<float> &weights) {
+	int n = weights.size();
+	threshold.assign(n, 1);
+	alias.resize(n);
+	probabilities.resize(n);
+	double sum = 0;
+	for (int i = 0; i < n; i++)
+		sum += weights[i];
+	//Nothing to prefer, sample uniformly
+	if (sum <= 0) {
+		for (int i = 0; i < n; i++) {
+			probabilities[i] = 1.0f / n;
+			alias[i] = i;
+		}
+		return;
+	}
+	//Vose's method: pair each bin below the average with one above it
+	vector<double> scaled(n);
+	vector<int> small, large;
+	for (int i = 0; i < n; i++) {
+		probabilities[i] = weights[i] / sum;
+		scaled[i] = weights[i] / sum * n;
+		alias[i] = i;
+		(scaled[i] < 1 ? small : large).push_back(i);
+	}
+	while (!small.empty() && !large.empty()) {
+		int s = small.back(), l = large.back();
+		small.pop_back();
+		threshold[s] = scaled[s];
+		alias[s] = l;
+		scaled[l] -= 1 - scaled[s];
+		if (scaled[l] < 1) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+	//Rounding leftovers keep their own bin
+	for (int i = 0; i < small.size(); i++) threshold[small[i]] = 1;
+	for (int i = 0; i < large.size(); i++) threshold[large[i]] = 1;
+}
+
+int AliasTable::sample(float u, float &remapped) const {
+	int n = threshold.size();
+	float scaled = u * n;
+	int i = min(int(scaled), n - 1);
+	float fraction = scaled - i;
+	//u rounded to 1 lands on the top edge of the last bin, keep it there
+	if (fraction < threshold[i] || threshold[i] >= 1) {
+		remapped = min(fraction / threshold[i], 0.99999994f);
+		return i;
+	}
+	remapped = (fraction - threshold[i]) / (1 - threshold[i]);
+	return alias[i];
+}
+
+bool EnvironmentMap::load(const string &path) {
+	ofFloatPixels pixels;
+	if (!ofLoadImage(pixels, path))
+		return false;
+	pixels.setImageType(OF_IMAGE_COLOR);
+	uint64_t start = ofGetElapsedTimeMicros();
+	this->path = path;
+	width = pixels.getWidth();
+	height = pixels.getHeight();
+	texels.resize(width * height);
+	const float *data = pixels.getData();
+	for (int k = 0; k < width * height; k++)
+		texels[k] = glm::vec3(data[k * 3], data[k * 3 + 1], data[k * 3 + 2]);
+	//Luminance times the solid angle of the row
+	vector<float> rowWeights(height), weights(width);
+	columns.resize(height);
+	for (int y = 0; y < height; y++) {
+		float sinTheta = sin(PI * (y + 0.5f) / height);
+		float sum = 0;
+		for (int x = 0; x < width; x++) {
+			const glm::vec3 &c = texels[y * width + x];
+			weights[x] = (0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z) * sinTheta;
+			sum += weights[x];
+		}
+		columns[y].build(weights);
+		rowWeights[y] = sum;
+	}
+	rows.build(rowWeights);
+	buildMs = (ofGetElapsedTimeMicros() - start) / 1000.0;
+	return true;
+}
+
+glm::vec2 EnvironmentMap::toImage(const glm::vec3 &dir) const {
+	float u = 0.5f + atan2(dir.x, -dir.z) / (2 * PI);
+	float v = acos(ofClamp(dir.y, -1, 1)) / PI;
+	return glm::vec2(u, v);
+}
+
+glm::vec3 EnvironmentMap::toDirection(float u, float v) const {
+	float phi = (u - 0.5f) * 2 * PI, theta = v * PI;
+	return glm::vec3(sin(theta) * sin(phi), cos(theta), -sin(theta) * cos(phi));
+}
+
+glm::vec3 EnvironmentMap::lookup(const glm::vec3 &dir) const {
+	glm::vec2 uv = toImage(dir);
+	int x = ofClamp(int(uv.x * width), 0, width - 1), y = ofClamp(int(uv.y * height), 0, height - 1);
+	return texels[y * width + x];
+}
+
+glm::vec3 EnvironmentMap::sample(const glm::vec2 &uv, float &pdf) const {
+	float fy, fx;
+	int y = rows.sample(uv.y, fy);
+	int x = columns[y].sample(uv.x, fx);
+	float v = (y + fy) / height;
+	//Density over the image is the texel's probability times the texel count,
+	//per solid angle it is divided by the area the texel covers, 2 pi^2 sin(theta)
+	float sinTheta = sin(PI * v);
+	pdf = sinTheta > 0 ? rows.probability(y) * columns[y].probability(x) * width * height / (2 * PI * PI * sinTheta) : 0;
+	return toDirection((x + fx) / width, v);
+}
+
+float EnvironmentMap::pdf(const glm::vec3 &dir) const {
+	glm::vec2 uv = toImage(dir);
+	int x = ofClamp(int(uv.x * width), 0, width - 1), y = ofClamp(int(uv.y * height), 0, height - 1);
+	float sinTheta = sin(PI * uv.y);
+	return sinTheta > 0 ? rows.probability(y) * columns[y].probability(x) * width * height / (2 * PI * PI * sinTheta) : 0;
+}
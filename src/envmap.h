@@ -0,0 +1,56 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Walker's alias method: after an O(n) build, draws index i with probability
+//  weights[i] / sum in O(1) from one uniform number
+//
+class AliasTable {
+public:
+	void build(const vector<float> &weights);
+
+	//  u in [0, 1) picks a bin and its fraction decides between the bin and its
+	//  alias; remapped gets what is left of u, again uniform in [0, 1)
+	//
+	int sample(float u, float &remapped) const;
+	float probability(int i) const { return probabilities[i]; }
+	int size() const { return probabilities.size(); }
+
+private:
+	vector<float> threshold;               // keep bin i below this fraction
+	vector<int> alias;
+	vector<float> probabilities;
+};
+
+//  HDR latitude / longitude image around the scene, used as the background and
+//  as a light. +y is up at the top row, -z is the center column.
+//
+//  Directions are importance sampled in proportion to texel luminance times
+//  sin(theta), the solid angle of the texel row: one alias table picks the
+//  row (marginal) and one per row picks the column (conditional).
+//
+class EnvironmentMap {
+public:
+	bool load(const string &path);
+
+	//  Radiance arriving from unit direction dir (the texel it points into)
+	//
+	glm::vec3 lookup(const glm::vec3 &dir) const;
+
+	//  Direction for a 2D sample, and its probability density per solid angle
+	//
+	glm::vec3 sample(const glm::vec2 &uv, float &pdf) const;
+	float pdf(const glm::vec3 &dir) const;
+
+	int width = 0, height = 0;
+	string path;
+	float buildMs = 0;
+
+private:
+	glm::vec2 toImage(const glm::vec3 &dir) const;
+	glm::vec3 toDirection(float u, float v) const;
+
+	vector<glm::vec3> texels;
+	AliasTable rows;
+	vector<AliasTable> columns;
+};
@@ -0,0 +1,389 @@
+#include "framebuffer.h"
+#include <cstdio>
+#include <cstring>
+
+string frameFormatName(FrameFormat format) {
+	static const char *names[] = { "fp32", "fp16", "sRGB8", "RGB9E5" };
+	return format >= 0 && format < FRAME_FORMAT_COUNT ? names[format] : "unknown";
+}
+
+//  IEEE half precision, rounded to nearest even
+//
+static uint16_t toHalf(float f) {
+	uint32_t x;
+	memcpy(&x, &f, 4);
+	uint32_t sign = (x >> 16) & 0x8000, mantissa = x & 0x7fffff;
+	int exponent = int((x >> 23) & 0xff) - 127 + 15;
+	//Overflow, infinity and NaN
+	if (exponent >= 31)
+		return sign | 0x7c00 | ((x & 0x7fffffff) > 0x7f800000 ? 0x200 : 0);
+	//Denormal or zero
+	if (exponent <= 0) {
+		if (exponent < -10)
+			return sign;
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		uint32_t half = mantissa >> shift, rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1)))
+			half++;
+		return sign | half;
+	}
+	//A carry out of the mantissa correctly bumps the exponent
+	uint32_t half = sign | (exponent << 10) | (mantissa >> 13), rest = mantissa & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+		half++;
+	return half;
+}
+
+static float fromHalf(uint16_t h) {
+	uint32_t sign = uint32_t(h & 0x8000) << 16, mantissa = h & 0x3ff;
+	int exponent = (h >> 10) & 0x1f;
+	if (exponent == 0) {
+		float f = mantissa * (1.0f / 16777216);
+		return sign ? -f : f;
+	}
+	uint32_t x = sign | (exponent == 31 ? 0x7f800000 : uint32_t(exponent + 112) << 23) | (mantissa << 13);
+	float f;
+	memcpy(&f, &x, 4);
+	return f;
+}
+
+static unsigned char toSRGB(float v) {
+	v = v > 0 ? min(v, 1.0f) : 0;
+	float s = v <= 0.0031308f ? 12.92f * v : 1.055f * pow(v, 1 / 2.4f) - 0.055f;
+	return s * 255 + 0.5f;
+}
+
+static float fromSRGB(unsigned char c) {
+	static const vector<float> table = [] {
+		vector<float> t(256);
+		for (int k = 0; k < 256; k++) {
+			float s = k / 255.0f;
+			t[k] = s <= 0.04045f ? s / 12.92f : pow((s + 0.055f) / 1.055f, 2.4f);
+		}
+		return t;
+	}();
+	return table[c];
+}
+
+//  Shared exponent RGB (EXT_texture_shared_exponent): the largest component
+//  picks the exponent, the others lose the bits below its precision
+//
+static uint32_t toRGB9E5(const glm::vec3 &v) {
+	const float maxValue = 65408;     // 511 / 512 * 2^16
+	float c[3];
+	for (int k = 0; k < 3; k++)
+		c[k] = v[k] > 0 ? min(v[k], maxValue) : 0;
+	float m = max(c[0], max(c[1], c[2]));
+	if (m <= 0)
+		return 0;
+	int e;
+	frexp(m, &e);
+	int exponent = max(-16, e - 1) + 16;
+	float scale = ldexp(1.0f, exponent - 24);
+	if (int(m / scale + 0.5f) == 512) {
+		exponent++;
+		scale *= 2;
+	}
+	uint32_t bits = uint32_t(exponent) << 27;
+	for (int k = 0; k < 3; k++)
+		bits |= min(uint32_t(c[k] / scale + 0.5f), 511u) << (9 * k);
+	return bits;
+}
+
+static glm::vec3 fromRGB9E5(uint32_t bits) {
+	float scale = ldexp(1.0f, int(bits >> 27) - 24);
+	return glm::vec3(bits & 511, (bits >> 9) & 511, (bits >> 18) & 511) * scale;
+}
+
+static void encode(FrameFormat format, int components, unsigned char *p, const glm::vec3 &value) {
+	switch (format) {
+	case FRAME_FLOAT32: {
+		float v[3] = { value.x, value.y, value.z };
+		memcpy(p, v, components * sizeof(float));
+		break;
+	}
+	case FRAME_HALF:
+		for (int k = 0; k < components; k++) {
+			uint16_t h = toHalf(value[k]);
+			memcpy(p + 2 * k, &h, 2);
+		}
+		break;
+	case FRAME_SRGB8:
+		for (int k = 0; k < components; k++)
+			p[k] = toSRGB(value[k]);
+		break;
+	default: {
+		uint32_t bits = toRGB9E5(value);
+		memcpy(p, &bits, 4);
+	}
+	}
+}
+
+static glm::vec3 decode(FrameFormat format, int components, const unsigned char *p) {
+	glm::vec3 value(0);
+	switch (format) {
+	case FRAME_FLOAT32: {
+		float v[3] = { 0, 0, 0 };
+		memcpy(v, p, components * sizeof(float));
+		value = glm::vec3(v[0], v[1], v[2]);
+		break;
+	}
+	case FRAME_HALF:
+		for (int k = 0; k < components; k++) {
+			uint16_t h;
+			memcpy(&h, p + 2 * k, 2);
+			value[k] = fromHalf(h);
+		}
+		break;
+	case FRAME_SRGB8:
+		for (int k = 0; k < components; k++)
+			value[k] = fromSRGB(p[k]);
+		break;
+	default: {
+		uint32_t bits;
+		memcpy(&bits, p, 4);
+		value = fromRGB9E5(bits);
+	}
+	}
+	return value;
+}
+
+FrameBuffer::SpillFile::~SpillFile() {
+	file.close();
+	std::remove(path.c_str());
+}
+
+void FrameBuffer::allocate(int width, int height, size_t budget, int x0, int x1, int y0, int y1) {
+	std::lock_guard<std::mutex> lock(*mutex);
+	this->width = width;
+	this->height = height;
+	this->budget = budget;
+	cropX0 = max(0, x0);
+	cropX1 = min(width, x1);
+	cropY0 = max(0, y0);
+	cropY1 = min(height, y1);
+	tilesX = (width + tileSize - 1) / tileSize;
+	tilesY = (height + tileSize - 1) / tileSize;
+	channels.clear();
+	finishedPixels.reset(new std::atomic<int>[tilesX * tilesY]);
+	for (int t = 0; t < tilesX * tilesY; t++)
+		finishedPixels[t] = 0;
+	spillable.clear();
+	spill.reset();
+	residentBytes = peakBytes = spilledBytes = 0;
+	spilledTiles = readBack = 0;
+}
+
+int FrameBuffer::addChannel(const string &name, int components, FrameFormat format, const glm::vec3 &clear) {
+	if (format == FRAME_RGB9E5 && components != 3)
+		format = FRAME_HALF;
+	Channel channel;
+	channel.name = name;
+	channel.components = components;
+	channel.format = format;
+	channel.clear = clear;
+	channel.pixelBytes = format == FRAME_FLOAT32 ? 4 * components : format == FRAME_HALF ? 2 * components : format == FRAME_SRGB8 ? components : 4;
+	channel.fileOffset = 0;
+	for (int c = 0; c < channels.size(); c++)
+		channel.fileOffset += int64_t(tilesX) * tilesY * tileBytes(channels[c]);
+	channel.tiles.reset(new Tile[tilesX * tilesY]);
+	channels.push_back(std::move(channel));
+	return channels.size() - 1;
+}
+
+//  Pixels of a tile inside the crop, the ones that will be finished
+//
+int FrameBuffer::tileArea(int tile) const {
+	int tx = tile % tilesX, ty = tile / tilesX;
+	int w = min(cropX1, (tx + 1) * tileSize) - max(cropX0, tx * tileSize);
+	int h = min(cropY1, (ty + 1) * tileSize) - max(cropY0, ty * tileSize);
+	return max(0, w) * max(0, h);
+}
+
+void FrameBuffer::set(int channel, int i, int j, const glm::vec3 &value) {
+	Channel &c = channels[channel];
+	int tx = i / tileSize, ty = j / tileSize;
+	unsigned char *data = c.tiles[ty * tilesX + tx].data.load(std::memory_order_acquire);
+	if (!data) {
+		std::lock_guard<std::mutex> lock(*mutex);
+		data = makeResident(c, ty * tilesX + tx);
+		enforceBudget();
+	}
+	encode(c.format, c.components, data + ((j - ty * tileSize) * tileSize + i - tx * tileSize) * c.pixelBytes, value);
+}
+
+//  New tiles start at the clear value, spilled ones are read back unless they
+//  are about to be overwritten. The tile is not spillable until it is
+//  finished again, so the pointer stays valid.
+//
+unsigned char *FrameBuffer::makeResident(Channel &channel, int tile, bool load) {
+	Tile &t = channel.tiles[tile];
+	if (t.block)
+		return t.block.get();
+	size_t bytes = tileBytes(channel);
+	t.block.reset(new unsigned char[bytes]);
+	if (t.onDisk && load) {
+		spill->file.seekg(channel.fileOffset + int64_t(tile) * bytes);
+		spill->file.read((char *)t.block.get(), bytes);
+		readBack++;
+	}
+	else if (load)
+		for (int p = 0; p < tileSize * tileSize; p++)
+			encode(channel.format, channel.components, t.block.get() + p * channel.pixelBytes, channel.clear);
+	t.data.store(t.block.get(), std::memory_order_release);
+	residentBytes += bytes;
+	peakBytes = max(peakBytes, residentBytes);
+	return t.block.get();
+}
+
+const unsigned char *FrameBuffer::tilePixels(const Channel &channel, int tile, vector<unsigned char> &scratch) const {
+	const Tile &t = channel.tiles[tile];
+	if (t.block)
+		return t.block.get();
+	size_t bytes = tileBytes(channel);
+	scratch.resize(bytes);
+	if (t.onDisk) {
+		spill->file.seekg(channel.fileOffset + int64_t(tile) * bytes);
+		spill->file.read((char *)scratch.data(), bytes);
+		readBack++;
+	}
+	else
+		for (int p = 0; p < tileSize * tileSize; p++)
+			encode(channel.format, channel.components, scratch.data() + p * channel.pixelBytes, channel.clear);
+	return scratch.data();
+}
+
+void FrameBuffer::enforceBudget() {
+	while (budget > 0 && residentBytes > budget && !spillable.empty()) {
+		int tile = spillable.front();
+		spillable.pop_front();
+		if (!spill) {
+			ofDirectory::createDirectory("spill", true, true);
+			static std::atomic<int> files{ 0 };
+			spill.reset(new SpillFile);
+			spill->path = ofToDataPath("spill/frame_" + ofToString(ofGetSystemTimeMicros()) + "_" + ofToString(files++) + ".tiles");
+			spill->file.open(spill->path, ios::in | ios::out | ios::binary | ios::trunc);
+			if (!spill->file.is_open()) {
+				cout << "Frame buffer: can't open " << spill->path << ", keeping all tiles in memory" << endl;
+				budget = 0;
+				spillable.push_front(tile);
+				return;
+			}
+		}
+		bool spilled = false;
+		for (int c = 0; c < channels.size(); c++) {
+			Tile &t = channels[c].tiles[tile];
+			if (!t.block)
+				continue;
+			size_t bytes = tileBytes(channels[c]);
+			//Unchanged since it was read back, the file still has it
+			if (!t.onDisk) {
+				spill->file.seekp(channels[c].fileOffset + int64_t(tile) * bytes);
+				spill->file.write((const char *)t.block.get(), bytes);
+				spilledBytes += bytes;
+				t.onDisk = true;
+			}
+			t.data.store(nullptr, std::memory_order_relaxed);
+			t.block.reset();
+			residentBytes -= bytes;
+			spilled = true;
+		}
+		if (spilled)
+			spilledTiles++;
+	}
+}
+
+void FrameBuffer::finish(int x0, int x1, int y0, int y1) {
+	for (int ty = y0 / tileSize; ty <= (y1 - 1) / tileSize && y1 > y0; ty++) {
+		for (int tx = x0 / tileSize; tx <= (x1 - 1) / tileSize && x1 > x0; tx++) {
+			int tile = ty * tilesX + tx;
+			int area = (min(x1, (tx + 1) * tileSize) - max(x0, tx * tileSize)) * (min(y1, (ty + 1) * tileSize) - max(y0, ty * tileSize));
+			//Only the region that completes the tile queues it
+			if (finishedPixels[tile].fetch_add(area) + area == tileArea(tile)) {
+				std::lock_guard<std::mutex> lock(*mutex);
+				spillable.push_back(tile);
+				enforceBudget();
+			}
+		}
+	}
+}
+
+void FrameBuffer::read(int channel, int x0, int x1, int y0, int y1, vector<glm::vec3> &values) const {
+	const Channel &c = channels[channel];
+	int w = max(0, x1 - x0);
+	values.resize(w * max(0, y1 - y0));
+	std::lock_guard<std::mutex> lock(*mutex);
+	vector<unsigned char> scratch;
+	for (int ty = y0 / tileSize; ty <= (y1 - 1) / tileSize && y1 > y0; ty++) {
+		for (int tx = x0 / tileSize; tx <= (x1 - 1) / tileSize && x1 > x0; tx++) {
+			const unsigned char *pixels = tilePixels(c, ty * tilesX + tx, scratch);
+			for (int j = max(y0, ty * tileSize); j < min(y1, (ty + 1) * tileSize); j++)
+				for (int i = max(x0, tx * tileSize); i < min(x1, (tx + 1) * tileSize); i++)
+					values[(j - y0) * w + i - x0] = decode(c.format, c.components,
+						pixels + ((j - ty * tileSize) * tileSize + i - tx * tileSize) * c.pixelBytes);
+		}
+	}
+}
+
+void FrameBuffer::readPlanes(int channel, vector<float> planes[3]) const {
+	const Channel &c = channels[channel];
+	for (int k = 0; k < 3; k++)
+		planes[k].resize(k < c.components ? width * height : 0);
+	std::lock_guard<std::mutex> lock(*mutex);
+	vector<unsigned char> scratch;
+	for (int tile = 0; tile < tilesX * tilesY; tile++) {
+		int tx = tile % tilesX, ty = tile / tilesX;
+		const unsigned char *pixels = tilePixels(c, tile, scratch);
+		for (int j = ty * tileSize; j < min(height, (ty + 1) * tileSize); j++) {
+			for (int i = tx * tileSize; i < min(width, (tx + 1) * tileSize); i++) {
+				glm::vec3 value = decode(c.format, c.components, pixels + ((j - ty * tileSize) * tileSize + i - tx * tileSize) * c.pixelBytes);
+				for (int k = 0; k < c.components; k++)
+					planes[k][j * width + i] = value[k];
+			}
+		}
+	}
+}
+
+void FrameBuffer::writePlanes(int channel, const vector<float> planes[3]) {
+	Channel &c = channels[channel];
+	std::lock_guard<std::mutex> lock(*mutex);
+	for (int tile = 0; tile < tilesX * tilesY; tile++) {
+		int tx = tile % tilesX, ty = tile / tilesX;
+		unsigned char *pixels = makeResident(c, tile, false);
+		c.tiles[tile].onDisk = false;
+		for (int j = ty * tileSize; j < min(height, (ty + 1) * tileSize); j++) {
+			for (int i = tx * tileSize; i < min(width, (tx + 1) * tileSize); i++) {
+				glm::vec3 value(0);
+				for (int k = 0; k < c.components; k++)
+					value[k] = planes[k][j * width + i];
+				encode(c.format, c.components, pixels + ((j - ty * tileSize) * tileSize + i - tx * tileSize) * c.pixelBytes, value);
+			}
+		}
+		//Spilled one at a time, so the whole channel is never resident
+		finishedPixels[tile] = tileArea(tile);
+		spillable.push_back(tile);
+		enforceBudget();
+	}
+}
+
+float FrameBuffer::bytesPerPixel() const {
+	float bytes = 0;
+	for (int c = 0; c < channels.size(); c++)
+		bytes += channels[c].pixelBytes;
+	return bytes;
+}
+
+string FrameBuffer::report() const {
+	std::lock_guard<std::mutex> lock(*mutex);
+	string formats;
+	size_t fullFloat = 0;
+	for (int c = 0; c < channels.size(); c++) {
+		formats += (c ? ", " : "") + channels[c].name + " " + frameFormatName(channels[c].format);
+		fullFloat += size_t(width) * height * channels[c].components * sizeof(float);
+	}
+	return "Frame buffer " + ofToString(width) + "x" + ofToString(height) + " (" + formats + "): " + ofToString(bytesPerPixel(), 1) +
+		" B/px, peak " + ofToString(peakBytes / 1048576.0, 2) + " MB resident (" + ofToString(fullFloat / 1048576.0, 2) +
+		" MB as full fp32), " + ofToString(spilledTiles) + " tiles spilled (" + ofToString(spilledBytes / 1048576.0, 2) + " MB written), " +
+		ofToString(readBack) + " read back, budget " + (budget ? ofToString(budget / 1048576.0, 1) + " MB" : string("none"));
+}
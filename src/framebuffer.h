@@ -0,0 +1,122 @@
+#pragma once
+
+#include "ofMain.h"
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <mutex>
+
+//  Storage precision of a frame buffer channel
+//
+enum FrameFormat {
+	FRAME_FLOAT32,       // 4 bytes per component, exact
+	FRAME_HALF,          // 2 bytes per component, 11 significant bits
+	FRAME_SRGB8,         // 1 byte per component on the sRGB curve, clamped to [0, 1]
+	FRAME_RGB9E5,        // 4 bytes per pixel, three 9 bit mantissas sharing a 5 bit exponent; RGB only
+	FRAME_FORMAT_COUNT
+};
+
+string frameFormatName(FrameFormat format);
+
+//  Per pixel channels of one render in render order (row 0 is the bottom of the
+//  image), each stored in tileSize x tileSize tiles at its own precision.
+//
+//  A tile is allocated when one of its pixels is first written and reads as
+//  the channel's clear value until then, so pixels outside a crop region cost
+//  nothing. Once all of a tile's pixels are finished it may be spilled to a
+//  file when the resident tiles exceed the memory budget, oldest finished
+//  first. Spilled tiles are decoded straight from the file when read. Tiles
+//  still being written stay resident, so the budget can be exceeded by about
+//  a row of tiles per render thread.
+//
+//  Render threads write pixels of unfinished tiles without locking, only
+//  allocating a tile takes the mutex. Spilling and reads take it too, so
+//  finished tiles can be read (like the tiles streamed to server clients)
+//  while others are still being rendered.
+//
+class FrameBuffer {
+public:
+	static const int tileSize = 32;
+
+	FrameBuffer() : mutex(new std::mutex) {}
+
+	//  Drop all channels and tiles. budget is in bytes of resident tiles, 0 for
+	//  no limit. Only pixels [x0, x1) x [y0, y1) (the crop) get finished, so a
+	//  tile counts as finished once its pixels inside it are.
+	//
+	void allocate(int width, int height, size_t budget, int x0, int x1, int y0, int y1);
+
+	//  Add a channel of 1 or 3 components before rendering starts, returns its
+	//  index. Single components can't share an exponent and are stored as half.
+	//
+	int addChannel(const string &name, int components, FrameFormat format, const glm::vec3 &clear);
+
+	//  Render threads. Single component channels keep value.x.
+	//
+	void set(int channel, int i, int j, const glm::vec3 &value);
+
+	//  Pixels [x0, x1) x [y0, y1) are written for this render, tiles whose
+	//  pixels are all finished become spillable
+	//
+	void finish(int x0, int x1, int y0, int y1);
+
+	//  Decoded pixels [x0, x1) x [y0, y1), rows bottom up. Reading whole tile
+	//  rows at a time reads each spilled tile once.
+	//
+	void read(int channel, int x0, int x1, int y0, int y1, vector<glm::vec3> &values) const;
+
+	//  The whole channel as float planes and back, for filters that need all of
+	//  it at once. Writing finishes every tile.
+	//
+	void readPlanes(int channel, vector<float> planes[3]) const;
+	void writePlanes(int channel, const vector<float> planes[3]);
+
+	int numChannels() const { return channels.size(); }
+	float bytesPerPixel() const;
+
+	//  Memory use of this render, peak and spilled tiles
+	//
+	string report() const;
+
+private:
+	struct Tile {
+		std::atomic<unsigned char *> data{ nullptr };   // block while resident, read by writers without the lock
+		unique_ptr<unsigned char[]> block;
+		bool onDisk = false;                             // the spill file holds the current pixels
+	};
+	struct Channel {
+		string name;
+		int components;
+		FrameFormat format;
+		glm::vec3 clear;
+		int pixelBytes;
+		int64_t fileOffset;                              // of the channel's first tile in the spill file
+		unique_ptr<Tile[]> tiles;
+	};
+	struct SpillFile {
+		string path;
+		std::fstream file;
+		~SpillFile();
+	};
+
+	int tileArea(int tile) const;
+	size_t tileBytes(const Channel &channel) const { return size_t(tileSize) * tileSize * channel.pixelBytes; }
+	//  Called with the mutex held
+	unsigned char *makeResident(Channel &channel, int tile, bool load = true);
+	const unsigned char *tilePixels(const Channel &channel, int tile, vector<unsigned char> &scratch) const;
+	void enforceBudget();
+
+	int width = 0, height = 0;
+	int tilesX = 0, tilesY = 0;
+	int cropX0 = 0, cropX1 = 0, cropY0 = 0, cropY1 = 0;
+	size_t budget = 0;
+	vector<Channel> channels;
+	unique_ptr<std::atomic<int>[]> finishedPixels;      // per tile position
+	unique_ptr<std::mutex> mutex;                        // by pointer so the buffer stays movable
+	std::deque<int> spillable;                           // finished tile positions, oldest first
+	unique_ptr<SpillFile> spill;                         // opened by the first spill
+	size_t residentBytes = 0, peakBytes = 0;
+	size_t spilledBytes = 0;
+	int spilledTiles = 0;
+	mutable int readBack = 0;                            // tiles decoded from the spill file, under the mutex
+};
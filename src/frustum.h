@@ -0,0 +1,37 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+//  Pyramid frustum with its apex at the camera, bounded by the four planes
+//  through the apex and the edges of a screen tile. Plane normals point inward.
+//
+class Frustum {
+public:
+	Frustum() {}
+	//  Corners in order around the tile (e.g. bottom left, bottom right, top right, top left)
+	//
+	Frustum(const glm::vec3 &apex, const glm::vec3 corners[4]) {
+		glm::vec3 center = (corners[0] + corners[1] + corners[2] + corners[3]) * 0.25f;
+		for (int k = 0; k < 4; k++) {
+			glm::vec3 n = glm::cross(corners[k] - apex, corners[(k + 1) % 4] - apex);
+			if (glm::dot(n, center - apex) < 0) n = -n;
+			normals[k] = n;
+			offsets[k] = -glm::dot(n, apex);
+		}
+	}
+
+	//  False only if the box is completely outside one of the planes
+	//
+	bool intersectsBox(const glm::vec3 &min, const glm::vec3 &max) const {
+		for (int k = 0; k < 4; k++) {
+			const glm::vec3 &n = normals[k];
+			glm::vec3 farthest = glm::vec3(n.x >= 0 ? max.x : min.x, n.y >= 0 ? max.y : min.y, n.z >= 0 ? max.z : min.z);
+			if (glm::dot(n, farthest) + offsets[k] < 0)
+				return false;
+		}
+		return true;
+	}
+
+	glm::vec3 normals[4];
+	float offsets[4];
+};
@@ -0,0 +1,569 @@
+#include "geostore.h"
+#include "simd.h"
+#include <unordered_map>
+
+#if defined(__linux__)
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
+static const float epsilon = std::numeric_limits<float>::epsilon();
+static const float infinity = std::numeric_limits<float>::infinity();
+
+//  On disk: header, chunk table, then each chunk's spheres as float x, y, z, r
+//
+struct GeometryFileHeader {
+	char magic[4];
+	uint32_t version;
+	int32_t dims[3];
+	float boundsMin[3], boundsMax[3];
+	uint32_t chunks;
+	uint64_t spheres;
+};
+struct GeometryFileChunk {
+	int32_t cell;
+	uint32_t count;
+	uint64_t offset;
+	float min[3], max[3];
+};
+
+void SphereDumpSource::rewind() {
+	file.close();
+	file.clear();
+	file.open(path, ios::binary);
+}
+
+bool SphereDumpSource::next(glm::vec4 &sphere) {
+	float record[4];
+	if (!file.read((char *)record, sizeof(record)))
+		return false;
+	sphere = glm::vec4(record[0], record[1], record[2], record[3]);
+	return true;
+}
+
+bool RandomSphereSource::next(glm::vec4 &sphere) {
+	if (produced >= count)
+		return false;
+	produced++;
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	float x = unit(rng), y = unit(rng), z = unit(rng), r = unit(rng);
+	sphere = glm::vec4(min.x + (max.x - min.x) * x, min.y + (max.y - min.y) * y, min.z + (max.z - min.z) * z,
+		minRadius + (maxRadius - minRadius) * r);
+	return true;
+}
+
+//  Grid cells along each axis, gridSize on the longest and proportionally fewer on the others
+//
+static void gridDims(const glm::vec3 &extent, int gridSize, int dims[3]) {
+	float longest = max(extent.x, max(extent.y, extent.z));
+	for (int a = 0; a < 3; a++)
+		dims[a] = longest > 0 ? min(gridSize, max(1, int(ceil(gridSize * extent[a] / longest)))) : 1;
+}
+
+//  Cells overlapped by the box of a sphere
+//
+template <class F>
+static void forEachCell(const glm::vec4 &sphere, const glm::vec3 &boundsMin, const glm::vec3 &cellSize, const int dims[3], F visit) {
+	int lo[3], hi[3];
+	for (int a = 0; a < 3; a++) {
+		lo[a] = ofClamp(int(floor((sphere[a] - sphere.w - boundsMin[a]) / cellSize[a])), 0, dims[a] - 1);
+		hi[a] = ofClamp(int(floor((sphere[a] + sphere.w - boundsMin[a]) / cellSize[a])), 0, dims[a] - 1);
+	}
+	for (int z = lo[2]; z <= hi[2]; z++)
+		for (int y = lo[1]; y <= hi[1]; y++)
+			for (int x = lo[0]; x <= hi[0]; x++)
+				visit((z * dims[1] + y) * dims[0] + x, glm::vec3(x, y, z));
+}
+
+bool GeometryStore::build(const string &path, SphereSource &source, int gridSize, string &error) {
+	uint64_t start = ofGetElapsedTimeMicros();
+	//Pass 1: bounds
+	glm::vec3 boundsMin(infinity), boundsMax(-infinity);
+	uint64_t count = 0;
+	glm::vec4 sphere;
+	source.rewind();
+	while (source.next(sphere)) {
+		glm::vec3 c(sphere);
+		boundsMin = glm::min(boundsMin, c - sphere.w);
+		boundsMax = glm::max(boundsMax, c + sphere.w);
+		count++;
+	}
+	if (count == 0) {
+		error = "no spheres";
+		return false;
+	}
+	int dims[3];
+	gridDims(boundsMax - boundsMin, gridSize, dims);
+	glm::vec3 cellSize = (boundsMax - boundsMin) / glm::vec3(dims[0], dims[1], dims[2]);
+	for (int a = 0; a < 3; a++)
+		if (cellSize[a] <= 0) cellSize[a] = 1;
+	int cells = dims[0] * dims[1] * dims[2];
+	//Pass 2: spheres and bounds per cell
+	vector<uint32_t> counts(cells, 0);
+	vector<glm::vec3> cellMin(cells, glm::vec3(infinity)), cellMax(cells, glm::vec3(-infinity));
+	source.rewind();
+	while (source.next(sphere)) {
+		forEachCell(sphere, boundsMin, cellSize, dims, [&](int cell, const glm::vec3 &coords) {
+			glm::vec3 lo = boundsMin + coords * cellSize, hi = lo + cellSize;
+			counts[cell]++;
+			cellMin[cell] = glm::min(cellMin[cell], glm::max(glm::vec3(sphere) - sphere.w, lo));
+			cellMax[cell] = glm::max(cellMax[cell], glm::min(glm::vec3(sphere) + sphere.w, hi));
+		});
+	}
+	vector<GeometryFileChunk> table;
+	vector<int> chunkOfCell(cells, -1);
+	for (int cell = 0; cell < cells; cell++) {
+		if (counts[cell] == 0) continue;
+		GeometryFileChunk entry;
+		entry.cell = cell;
+		entry.count = counts[cell];
+		for (int a = 0; a < 3; a++) {
+			entry.min[a] = cellMin[cell][a];
+			entry.max[a] = cellMax[cell][a];
+		}
+		chunkOfCell[cell] = table.size();
+		table.push_back(entry);
+	}
+	uint64_t offset = sizeof(GeometryFileHeader) + table.size() * sizeof(GeometryFileChunk);
+	for (int k = 0; k < table.size(); k++) {
+		table[k].offset = offset;
+		offset += uint64_t(table[k].count) * 4 * sizeof(float);
+	}
+	fstream out(path, ios::in | ios::out | ios::binary | ios::trunc);
+	if (!out) {
+		error = "cannot write " + path;
+		return false;
+	}
+	GeometryFileHeader header;
+	memcpy(header.magic, "RTGC", 4);
+	header.version = 1;
+	header.chunks = table.size();
+	header.spheres = count;
+	for (int a = 0; a < 3; a++) {
+		header.dims[a] = dims[a];
+		header.boundsMin[a] = boundsMin[a];
+		header.boundsMax[a] = boundsMax[a];
+	}
+	out.write((const char *)&header, sizeof(header));
+	out.write((const char *)table.data(), table.size() * sizeof(GeometryFileChunk));
+	//Pass 3: spheres into their chunks, buffered per chunk within 64 MB in total
+	size_t flushAt = max(size_t(16), (size_t(64) << 20) / (table.size() * 4 * sizeof(float)));
+	vector<vector<float>> buffers(table.size());
+	vector<uint64_t> written(table.size(), 0);
+	auto flush = [&](int chunk) {
+		out.seekp(table[chunk].offset + written[chunk] * 4 * sizeof(float));
+		out.write((const char *)buffers[chunk].data(), buffers[chunk].size() * sizeof(float));
+		written[chunk] += buffers[chunk].size() / 4;
+		buffers[chunk].clear();
+	};
+	source.rewind();
+	while (source.next(sphere)) {
+		forEachCell(sphere, boundsMin, cellSize, dims, [&](int cell, const glm::vec3 &coords) {
+			int chunk = chunkOfCell[cell];
+			vector<float> &buffer = buffers[chunk];
+			buffer.insert(buffer.end(), { sphere.x, sphere.y, sphere.z, sphere.w });
+			if (buffer.size() >= flushAt * 4)
+				flush(chunk);
+		});
+	}
+	for (int k = 0; k < table.size(); k++)
+		if (!buffers[k].empty())
+			flush(k);
+	if (!out) {
+		error = "write failed for " + path;
+		return false;
+	}
+	cout << "Built " << path << ": " << count << " spheres in " << table.size() << " chunks (" << dims[0] << "x" << dims[1] << "x" << dims[2]
+		<< " grid, " << (offset >> 20) << " MB) in " << (ofGetElapsedTimeMicros() - start) / 1000 << " ms" << endl;
+	return true;
+}
+
+bool GeometryStore::open(const string &path) {
+	close();
+	ifstream file(path, ios::binary);
+	GeometryFileHeader header;
+	if (!file.read((char *)&header, sizeof(header)) || memcmp(header.magic, "RTGC", 4) != 0 || header.version != 1)
+		return false;
+	vector<GeometryFileChunk> table(header.chunks);
+	if (!file.read((char *)table.data(), table.size() * sizeof(GeometryFileChunk)))
+		return false;
+	this->path = path;
+	sphereCount = header.spheres;
+	for (int a = 0; a < 3; a++) {
+		dims[a] = header.dims[a];
+		boundsMin[a] = header.boundsMin[a];
+		boundsMax[a] = header.boundsMax[a];
+	}
+	cellSize = (boundsMax - boundsMin) / glm::vec3(dims[0], dims[1], dims[2]);
+	for (int a = 0; a < 3; a++)
+		if (cellSize[a] <= 0) cellSize[a] = 1;
+	cellChunk.assign(dims[0] * dims[1] * dims[2], -1);
+	chunks.resize(table.size());
+	for (int k = 0; k < table.size(); k++) {
+		chunks[k].cell = table[k].cell;
+		chunks[k].count = table[k].count;
+		chunks[k].offset = table[k].offset;
+		chunks[k].min = glm::vec3(table[k].min[0], table[k].min[1], table[k].min[2]);
+		chunks[k].max = glm::vec3(table[k].max[0], table[k].max[1], table[k].max[2]);
+		cellChunk[table[k].cell] = k;
+	}
+	entries = vector<Entry>(chunks.size());
+	stopping = false;
+	for (int t = 0; t < loaderThreads; t++)
+		loaders.push_back(std::thread(&GeometryStore::loader, this));
+	return true;
+}
+
+void GeometryStore::close() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	loaderWake.notify_all();
+	for (int t = 0; t < loaders.size(); t++)
+		loaders[t].join();
+	loaders.clear();
+	entries.clear();
+	lru.clear();
+	queue.clear();
+	resident = 0;
+	chunks.clear();
+	cellChunk.clear();
+}
+
+void GeometryStore::setBudget(size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (budget == bytes) return;
+	budget = bytes;
+	evictLocked();
+}
+
+bool GeometryStore::getBounds(glm::vec3 &min, glm::vec3 &max) const {
+	if (chunks.empty()) return false;
+	min = boundsMin;
+	max = boundsMax;
+	return true;
+}
+
+size_t GeometryStore::residentBytes() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return resident;
+}
+
+void GeometryStore::requestLocked(int chunk) {
+	Entry &entry = entries[chunk];
+	if (entry.data || entry.requested) return;
+	entry.requested = true;
+	queue.push_back(chunk);
+	loaderWake.notify_one();
+}
+
+//  Drop least recently used chunks until within budget, always keeping the newest
+//
+void GeometryStore::evictLocked() {
+	while (resident > budget && lru.size() > 1) {
+		Entry &entry = entries[lru.back()];
+		resident -= entry.data->bytes();
+		entry.data.reset();
+		lru.pop_back();
+		evictions++;
+	}
+}
+
+//  The chunk's data, or NULL if it is not resident and wait is false. Either way
+//  a missing chunk is requested.
+//
+shared_ptr<const GeometryStore::ChunkData> GeometryStore::acquire(int chunk, bool wait) {
+	std::unique_lock<std::mutex> lock(mutex);
+	Entry &entry = entries[chunk];
+	if (!entry.data) {
+		requestLocked(chunk);
+		if (!wait) return NULL;
+		uint64_t start = ofGetElapsedTimeMicros();
+		//Loop in case it was evicted again before this thread woke up
+		while (!entry.data) {
+			requestLocked(chunk);
+			arrived.wait(lock);
+		}
+		stallMicros += ofGetElapsedTimeMicros() - start;
+	}
+	lru.splice(lru.begin(), lru, entry.lru);
+	return entry.data;
+}
+
+void GeometryStore::loader() {
+	ifstream file(path, ios::binary);
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		while (!stopping && queue.empty())
+			loaderWake.wait(lock);
+		if (stopping) return;
+		int chunk = queue.front();
+		queue.pop_front();
+		lock.unlock();
+		shared_ptr<const ChunkData> data = readChunk(file, chunks[chunk]);
+		lock.lock();
+		Entry &entry = entries[chunk];
+		entry.requested = false;
+		entry.data = data;
+		lru.push_front(chunk);
+		entry.lru = lru.begin();
+		resident += data->bytes();
+		pageIns++;
+		bytesRead += uint64_t(chunks[chunk].count) * 4 * sizeof(float);
+		evictLocked();
+		arrived.notify_all();
+	}
+}
+
+//  Read a chunk and transpose it to structure of arrays, padding with copies of
+//  its last sphere so Float8 loops need no tail
+//
+shared_ptr<const GeometryStore::ChunkData> GeometryStore::readChunk(ifstream &file, const Chunk &chunk) {
+	vector<float> records(size_t(chunk.count) * 4);
+	file.clear();
+	file.seekg(chunk.offset);
+	file.read((char *)records.data(), records.size() * sizeof(float));
+	shared_ptr<ChunkData> data = make_shared<ChunkData>();
+	size_t padded = (chunk.count + Float8::lanes - 1) / Float8::lanes * Float8::lanes;
+	data->x.resize(padded);
+	data->y.resize(padded);
+	data->z.resize(padded);
+	data->r.resize(padded);
+	for (size_t k = 0; k < padded; k++) {
+		size_t s = min(k, size_t(chunk.count) - 1) * 4;
+		data->x[k] = records[s];
+		data->y[k] = records[s + 1];
+		data->z[k] = records[s + 2];
+		data->r[k] = records[s + 3];
+	}
+	return data;
+}
+
+bool GeometryStore::hitsChunk(const Chunk &chunk, const glm::vec3 &o, const glm::vec3 &invDir, float tMax, float &tNear) const {
+	glm::vec3 a = (chunk.min - o) * invDir, b = (chunk.max - o) * invDir;
+	glm::vec3 lo = glm::min(a, b), hi = glm::max(a, b);
+	tNear = max(max(lo.x, lo.y), max(lo.z, 0.0f));
+	float tFar = min(min(hi.x, hi.y), min(hi.z, tMax));
+	return tNear <= tFar;
+}
+
+//  Closest sphere of a chunk below t, eight spheres per step with the same math
+//  as glm::intersectRaySphere
+//
+bool GeometryStore::intersectChunk(const ChunkData &data, const glm::vec3 &o, const glm::vec3 &d, float &t, int &hit) {
+	Vec3x8 origin(o), dir(d);
+	Float8 eps(epsilon), zero(0.0f);
+	bool found = false;
+	for (size_t k = 0; k < data.x.size(); k += Float8::lanes) {
+		Vec3x8 e = Vec3x8::load(&data.x[k], &data.y[k], &data.z[k]) - origin;
+		Float8 r = Float8::load(&data.r[k]), r2 = r * r;
+		Float8 t0 = e.dot(dir);
+		Float8 d2 = e.dot(e) - t0 * t0;
+		Float8 t1 = sqrt(max(r2 - d2, zero));
+		Float8 dist = select(t0 > t1 + eps, t0 - t1, t0 + t1);
+		int mask = ((d2 <= r2) & (dist > eps) & (dist < Float8(t))).mask();
+		if (!mask) continue;
+		float lanes[Float8::lanes];
+		dist.store(lanes);
+		for (int l = 0; l < Float8::lanes; l++) {
+			if (((mask >> l) & 1) && lanes[l] < t) {
+				t = lanes[l];
+				hit = k + l;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+//  Non-empty cells along o + t d up to tMax in ray order (3D DDA). visit(chunk,
+//  cellExit) returns false to stop.
+//
+template <class F>
+void GeometryStore::walk(const glm::vec3 &o, const glm::vec3 &d, float tMax, F visit) const {
+	float tEnter = 0, tExit = tMax;
+	for (int a = 0; a < 3; a++) {
+		float inv = 1.0f / d[a];
+		float ta = (boundsMin[a] - o[a]) * inv, tb = (boundsMax[a] - o[a]) * inv;
+		if (ta > tb) std::swap(ta, tb);
+		if (d[a] == 0 && (o[a] < boundsMin[a] || o[a] > boundsMax[a])) return;
+		if (d[a] != 0) {
+			tEnter = max(tEnter, ta);
+			tExit = min(tExit, tb);
+		}
+	}
+	if (tEnter > tExit) return;
+	glm::vec3 p = o + d * tEnter;
+	int cell[3], step[3];
+	float tNext[3], tDelta[3];
+	for (int a = 0; a < 3; a++) {
+		cell[a] = ofClamp(int(floor((p[a] - boundsMin[a]) / cellSize[a])), 0, dims[a] - 1);
+		float lo = boundsMin[a] + cell[a] * cellSize[a];
+		if (d[a] > 0) {
+			step[a] = 1;
+			tNext[a] = tEnter + (lo + cellSize[a] - p[a]) / d[a];
+			tDelta[a] = cellSize[a] / d[a];
+		}
+		else if (d[a] < 0) {
+			step[a] = -1;
+			tNext[a] = tEnter + (lo - p[a]) / d[a];
+			tDelta[a] = -cellSize[a] / d[a];
+		}
+		else {
+			step[a] = 0;
+			tNext[a] = tDelta[a] = infinity;
+		}
+	}
+	while (true) {
+		int a = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+		int chunk = cellChunk[(cell[2] * dims[1] + cell[1]) * dims[0] + cell[0]];
+		if (chunk >= 0 && !visit(chunk, min(tNext[a], tExit)))
+			return;
+		if (tNext[a] >= tExit)
+			return;
+		cell[a] += step[a];
+		if (cell[a] < 0 || cell[a] >= dims[a])
+			return;
+		tNext[a] += tDelta[a];
+	}
+}
+
+bool GeometryStore::intersect(const glm::vec3 &o, const glm::vec3 &d, float &t, glm::vec4 &sphere) {
+	glm::vec3 invDir(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+	bool found = false;
+	walk(o, d, t, [&](int chunk, float cellExit) {
+		float tNear;
+		if (!hitsChunk(chunks[chunk], o, invDir, t, tNear))
+			return true;
+		shared_ptr<const ChunkData> data = acquire(chunk, true);
+		int hit;
+		if (intersectChunk(*data, o, d, t, hit)) {
+			sphere = glm::vec4(data->x[hit], data->y[hit], data->z[hit], data->r[hit]);
+			found = true;
+		}
+		//Later cells are farther than a hit inside this one
+		return !(found && t <= cellExit);
+	});
+	return found;
+}
+
+void GeometryStore::intersect(int n, const float *ox, const float *oy, const float *oz, const float *dx, const float *dy, const float *dz,
+	float *t, int *object, int index, bool anyHit, const glm::vec3 &offset) {
+	struct Deferred {
+		int chunk, ray;
+		float tNear;
+		bool operator<(const Deferred &other) const { return chunk < other.chunk; }
+	};
+	vector<Deferred> deferred;
+	std::unordered_map<int, shared_ptr<const ChunkData>> held;
+	//Trace one ray through one chunk, true if it is done with the chunks beyond
+	auto trace = [&](int r, const ChunkData &data, const glm::vec3 &o, const glm::vec3 &d) {
+		int hit;
+		float tHit = t[r];
+		if (!intersectChunk(data, o, d, tHit, hit))
+			return false;
+		if (anyHit)
+			object[r] = 1;
+		else {
+			t[r] = tHit;
+			object[r] = index;
+		}
+		return true;
+	};
+	//Resident chunks now, in ray order; missing ones are requested and queued
+	for (int r = 0; r < n; r++) {
+		if (anyHit && object[r]) continue;
+		glm::vec3 o = glm::vec3(ox[r], oy[r], oz[r]) - offset, d(dx[r], dy[r], dz[r]);
+		glm::vec3 invDir(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+		walk(o, d, t[r], [&](int chunk, float cellExit) {
+			float tNear;
+			if (!hitsChunk(chunks[chunk], o, invDir, t[r], tNear))
+				return true;
+			auto found = held.find(chunk);
+			if (found == held.end())
+				found = held.insert(make_pair(chunk, acquire(chunk, false))).first;
+			if (!found->second) {
+				deferred.push_back(Deferred{ chunk, r, tNear });
+				return true;
+			}
+			bool hit = trace(r, *found->second, o, d);
+			return !(hit && (anyHit || t[r] <= cellExit));
+		});
+	}
+	if (deferred.empty()) return;
+	deferredRays += deferred.size();
+	//Then each queue as its chunk arrives, dropping rays that found a closer hit
+	std::stable_sort(deferred.begin(), deferred.end());
+	vector<pair<int, int>> queues;           // [begin, end) in deferred
+	for (int k = 0; k < deferred.size(); k++)
+		if (k == 0 || deferred[k].chunk != deferred[k - 1].chunk)
+			queues.push_back(make_pair(k, k + 1));
+		else
+			queues.back().second = k + 1;
+	while (!queues.empty()) {
+		bool progressed = false;
+		for (int q = 0; q < queues.size(); q++) {
+			int chunk = deferred[queues[q].first].chunk;
+			bool needed = false;
+			for (int k = queues[q].first; k < queues[q].second && !needed; k++)
+				needed = anyHit ? !object[deferred[k].ray] : deferred[k].tNear < t[deferred[k].ray];
+			shared_ptr<const ChunkData> data;
+			if (needed) {
+				data = acquire(chunk, false);
+				if (!data) continue;
+				for (int k = queues[q].first; k < queues[q].second; k++) {
+					int r = deferred[k].ray;
+					if (anyHit ? object[r] != 0 : deferred[k].tNear >= t[r]) continue;
+					trace(r, *data, glm::vec3(ox[r], oy[r], oz[r]) - offset, glm::vec3(dx[r], dy[r], dz[r]));
+				}
+			}
+			queues.erase(queues.begin() + q--);
+			progressed = true;
+		}
+		if (!progressed && !queues.empty()) {
+			//Nothing resident yet, wait for the loaders
+			uint64_t start = ofGetElapsedTimeMicros();
+			std::unique_lock<std::mutex> lock(mutex);
+			bool ready = false;
+			for (int q = 0; q < queues.size() && !ready; q++)
+				ready = entries[deferred[queues[q].first].chunk].data != NULL;
+			if (!ready)
+				arrived.wait_for(lock, std::chrono::milliseconds(20));
+			stallMicros += ofGetElapsedTimeMicros() - start;
+		}
+	}
+}
+
+size_t GeometryStore::processResidentSize() {
+#if defined(__linux__)
+	ifstream statm("/proc/self/statm");
+	size_t pages = 0, residentPages = 0;
+	statm >> pages >> residentPages;
+	return residentPages * sysconf(_SC_PAGESIZE);
+#elif defined(__APPLE__)
+	mach_task_basic_info info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS)
+		return 0;
+	return info.resident_size;
+#else
+	return 0;
+#endif
+}
+
+string GeometryStore::report() {
+	size_t residentNow = residentBytes();
+	string text = "Geometry " + ofFilePath::getFileName(path) + ": " + ofToString(int(pageIns.load())) + " page-ins (" +
+		ofToString(bytesRead.load() / 1048576.0, 1) + " MB), " + ofToString(int(evictions.load())) + " evictions, stall " +
+		ofToString(stallMicros.load() / 1000.0, 1) + " ms, " + ofToString(int(deferredRays.load())) + " deferred rays; resident " +
+		ofToString(residentNow / 1048576.0, 1) + " / " + ofToString(budget / 1048576.0, 0) + " MB, process RSS " +
+		ofToString(processResidentSize() / 1048576.0, 1) + " MB";
+	pageIns = 0;
+	bytesRead = 0;
+	evictions = 0;
+	stallMicros = 0;
+	deferredRays = 0;
+	return text;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "ofMain.h"
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <random>
+#include <thread>
+
+//  Source of spheres for GeometryStore::build, read once per build pass
+//
+class SphereSource {
+public:
+	virtual ~SphereSource() {}
+	virtual void rewind() = 0;
+	virtual bool next(glm::vec4 &sphere) = 0;    // center xyz, radius w
+};
+
+//  Binary particle dump, float32 x, y, z, radius per sphere
+//
+class SphereDumpSource : public SphereSource {
+public:
+	SphereDumpSource(const string &path) : path(path) {}
+	void rewind();
+	bool next(glm::vec4 &sphere);
+private:
+	string path;
+	ifstream file;
+};
+
+//  Reproducible random spheres in a box, for test scenes of any size
+//
+class RandomSphereSource : public SphereSource {
+public:
+	RandomSphereSource(uint64_t count, const glm::vec3 &min, const glm::vec3 &max, float minRadius, float maxRadius, unsigned seed = 1)
+		: count(count), min(min), max(max), minRadius(minRadius), maxRadius(maxRadius), seed(seed) {}
+	void rewind() { rng.seed(seed); produced = 0; }
+	bool next(glm::vec4 &sphere);
+private:
+	uint64_t count, produced = 0;
+	glm::vec3 min, max;
+	float minRadius, maxRadius;
+	unsigned seed;
+	std::mt19937 rng;
+};
+
+//  Out of core sphere geometry for scenes larger than memory, e.g. particle
+//  dumps. build() sorts the spheres into the cells of a uniform grid on disk,
+//  one chunk per non-empty cell; a sphere goes into every cell its box
+//  overlaps. Only the chunk table stays in memory. Chunk data is read by
+//  loader threads on demand into a cache bounded by a budget, least recently
+//  used chunks are evicted first.
+//
+//  Two ways to trace:
+//  intersect(o, d, ...)    walks the grid in ray order and waits for each
+//                          missing chunk, for the depth first renderer
+//  intersect(n rays, ...)  tests a batch against resident chunks first; rays
+//                          that need missing chunks are queued per chunk, all
+//                          those chunks are requested at once and each queue is
+//                          traced when its chunk arrives, skipping rays whose
+//                          hit is already closer than the chunk
+//
+//  Chunks a thread is tracing stay alive after eviction, so memory can exceed
+//  the budget by the chunks of the batches in flight.
+//
+class GeometryStore {
+public:
+	static const int loaderThreads = 2;
+
+	~GeometryStore() { close(); }
+
+	//  Write the chunk file for source at path, gridSize cells along the longest
+	//  axis. Three passes over source; memory use does not depend on its size.
+	//
+	static bool build(const string &path, SphereSource &source, int gridSize, string &error);
+
+	bool open(const string &path);
+	void close();
+	void setBudget(size_t bytes);
+	bool getBounds(glm::vec3 &min, glm::vec3 &max) const;
+	int numChunks() const { return chunks.size(); }
+	uint64_t numSpheres() const { return sphereCount; }
+	const string &getPath() const { return path; }
+
+	//  Closest sphere along o + t d (d unit) with t below the given t, which is
+	//  set to the hit distance. sphere gets the center and radius hit.
+	//
+	bool intersect(const glm::vec3 &o, const glm::vec3 &d, float &t, glm::vec4 &sphere);
+
+	//  Batch of rays in structure of arrays form, the wavefront renderer's
+	//  convention: closest hits set t and object to index; any hit rays have
+	//  their maximum distance in t and get object 1 when blocked. offset is
+	//  subtracted from the origins.
+	//
+	void intersect(int n, const float *ox, const float *oy, const float *oz, const float *dx, const float *dy, const float *dz,
+		float *t, int *object, int index, bool anyHit, const glm::vec3 &offset);
+
+	//  Page-ins, stalls and memory use since the last report
+	//
+	string report();
+	size_t residentBytes();
+
+	//  Resident set size of the whole process, 0 where unknown
+	//
+	static size_t processResidentSize();
+
+	std::atomic<uint64_t> pageIns{ 0 }, bytesRead{ 0 }, evictions{ 0 }, stallMicros{ 0 }, deferredRays{ 0 };
+
+private:
+	struct Chunk {
+		int cell;
+		uint32_t count;
+		uint64_t offset;
+		glm::vec3 min, max;                  // bounds of its spheres inside the cell
+	};
+	struct ChunkData {
+		vector<float> x, y, z, r;            // padded to a multiple of 8
+		size_t bytes() const { return (x.size() + y.size() + z.size() + r.size()) * sizeof(float); }
+	};
+	struct Entry {
+		shared_ptr<const ChunkData> data;
+		bool requested = false;
+		std::list<int>::iterator lru;
+	};
+
+	shared_ptr<const ChunkData> acquire(int chunk, bool wait);
+	void requestLocked(int chunk);
+	void evictLocked();
+	void loader();
+	shared_ptr<const ChunkData> readChunk(ifstream &file, const Chunk &chunk);
+	bool hitsChunk(const Chunk &chunk, const glm::vec3 &o, const glm::vec3 &invDir, float tMax, float &tNear) const;
+	static bool intersectChunk(const ChunkData &data, const glm::vec3 &o, const glm::vec3 &d, float &t, int &hit);
+	template <class F> void walk(const glm::vec3 &o, const glm::vec3 &d, float tMax, F visit) const;
+
+	string path;
+	uint64_t sphereCount = 0;
+	int dims[3] = { 0, 0, 0 };
+	glm::vec3 boundsMin, boundsMax, cellSize;
+	vector<Chunk> chunks;
+	vector<int> cellChunk;                   // chunk of each grid cell, -1 if empty
+
+	std::mutex mutex;
+	std::condition_variable loaderWake, arrived;
+	vector<Entry> entries;                   // per chunk, guarded by mutex
+	std::list<int> lru;                      // resident chunks, most recent first
+	deque<int> queue;                        // chunks waiting for a loader
+	size_t budget = size_t(256) << 20;
+	size_t resident = 0;
+	bool stopping = false;
+	vector<std::thread> loaders;
+};
@@ -0,0 +1,189 @@
+#include "irradiance.h"
+#include "sampler.h"
+
+static const int maxDepth = 24;
+
+static bool overlaps(const glm::vec3 &minA, const glm::vec3 &maxA, const glm::vec3 &minB, const glm::vec3 &maxB) {
+	return minA.x <= maxB.x && minA.y <= maxB.y && minA.z <= maxB.z && maxA.x >= minB.x && maxA.y >= minB.y && maxA.z >= minB.z;
+}
+
+IrradianceCache::IrradianceCache(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const IrradianceSettings &settings) : settings(settings) {
+	//Cube around the bounds so nodes stay cubes
+	glm::vec3 center = (boundsMin + boundsMax) / 2;
+	glm::vec3 extent = boundsMax - boundsMin;
+	float half = max(max(extent.x, extent.y), max(extent.z, 1.0f)) * 0.5f * 1.01f;
+	rootMin = center - glm::vec3(half);
+	rootMax = center + glm::vec3(half);
+}
+
+bool IrradianceCache::interpolate(const glm::vec3 &p, const glm::vec3 &n, glm::vec3 &irradiance) {
+	lookups++;
+	if (!overlaps(p, p, rootMin, rootMax))
+		return false;
+	float a = settings.accuracy;
+	glm::vec3 sum(0);
+	float weights = 0;
+	const Node *node = &root;
+	glm::vec3 min = rootMin, max = rootMax;
+	while (node) {
+		for (const Entry *entry = node->entries.load(std::memory_order_acquire); entry; entry = entry->next) {
+			const Record &r = *entry->record;
+			glm::vec3 d = p - r.p;
+			//Skip records in front of p, they see a different hemisphere
+			if (glm::dot(d, (n + r.n) * 0.5f) < -0.05f * r.radius)
+				continue;
+			//Ward's error estimate, weights fade to zero at the limit so records don't leave seams
+			float error = glm::length(d) / r.radius + sqrt(std::max(0.0f, 1 - glm::dot(n, r.n)));
+			if (error >= a)
+				continue;
+			float w = 1 / std::max(error, 1e-6f) - 1 / a;
+			glm::vec3 turn = glm::cross(r.n, n);
+			glm::vec3 e;
+			for (int c = 0; c < 3; c++)
+				e[c] = std::max(0.0f, r.e[c] + glm::dot(turn, r.rotation[c]) + glm::dot(d, r.translation[c]));
+			sum += e * w;
+			weights += w;
+		}
+		//Down the one child that holds p
+		glm::vec3 mid = (min + max) * 0.5f;
+		int child = (p.x > mid.x ? 1 : 0) | (p.y > mid.y ? 2 : 0) | (p.z > mid.z ? 4 : 0);
+		for (int k = 0; k < 3; k++) {
+			if (child & (1 << k)) min[k] = mid[k];
+			else max[k] = mid[k];
+		}
+		node = node->children[child].load(std::memory_order_acquire);
+	}
+	if (weights <= 0)
+		return false;
+	irradiance = sum / weights;
+	interpolated++;
+	return true;
+}
+
+glm::vec3 IrradianceCache::compute(const glm::vec3 &p, const glm::vec3 &n, float footprint, const RadianceCast &cast) {
+	uint64_t start = ofGetElapsedTimeMicros();
+	int rows = settings.thetaSamples, cols = settings.phiSamples;
+	int count = rows * cols;
+	vector<glm::vec3> radiance(count);
+	vector<float> sinTheta(count), tanTheta(count), dist(count);
+	glm::vec3 u, v;
+	orthonormalBasis(n, u, v);
+	glm::vec3 origin = p + n * settings.rayOffset;
+	//Cosine weighted strata, jittered by a hash of p so neighbouring records decorrelate
+	uint32_t seed = hashPoint(p);
+	Record record;
+	record.p = p;
+	record.n = n;
+	record.e = glm::vec3(0);
+	float inverseDistances = 0;
+	for (int j = 0; j < rows; j++) {
+		for (int k = 0; k < cols; k++) {
+			int s = j * cols + k;
+			float xi1 = hashUInt(seed + 2 * s) / 4294967296.0f, xi2 = hashUInt(seed + 2 * s + 1) / 4294967296.0f;
+			float sin2 = (j + xi1) / rows;
+			sinTheta[s] = sqrt(sin2);
+			float cosTheta = sqrt(std::max(0.0f, 1 - sin2));
+			tanTheta[s] = sinTheta[s] / std::max(cosTheta, 1e-4f);
+			float phi = 2 * PI * (k + xi2) / cols;
+			glm::vec3 dir = (u * cos(phi) + v * sin(phi)) * sinTheta[s] + n * cosTheta;
+			radiance[s] = cast(origin, dir, dist[s]);
+			record.e += radiance[s];
+			inverseDistances += 1 / dist[s];
+		}
+	}
+	record.e /= count;
+	//Gradients (Ward and Heckbert 1992), divided by pi like the value
+	for (int c = 0; c < 3; c++) {
+		record.rotation[c] = glm::vec3(0);
+		record.translation[c] = glm::vec3(0);
+	}
+	for (int k = 0; k < cols; k++) {
+		float phi = 2 * PI * (k + 0.5f) / cols, phiStart = 2 * PI * k / cols;
+		glm::vec3 uk = u * cos(phi) + v * sin(phi);
+		glm::vec3 vk = -u * sin(phi) + v * cos(phi);
+		glm::vec3 vkStart = -u * sin(phiStart) + v * cos(phiStart);
+		int previous = (k + cols - 1) % cols;
+		glm::vec3 rotation(0), acrossTheta(0), acrossPhi(0);
+		for (int j = 0; j < rows; j++) {
+			int s = j * cols + k;
+			rotation += radiance[s] * tanTheta[s];
+			//Change across the boundary to the previous theta stratum
+			if (j > 0) {
+				float sin2 = float(j) / rows;
+				float weight = sqrt(sin2) * (1 - sin2) / std::min(dist[s], dist[s - cols]);
+				acrossTheta += (radiance[s] - radiance[s - cols]) * weight;
+			}
+			//And to the previous phi stratum
+			float weight = (sqrt(float(j + 1) / rows) - sqrt(float(j) / rows)) / std::min(dist[s], dist[j * cols + previous]);
+			acrossPhi += (radiance[s] - radiance[j * cols + previous]) * weight;
+		}
+		for (int c = 0; c < 3; c++) {
+			record.rotation[c] += vk * (rotation[c] / count);
+			record.translation[c] += (uk * (acrossTheta[c] * 2 * PI / cols) + vkStart * acrossPhi[c]) / PI;
+		}
+	}
+	//Harmonic mean distance, shortened where the gradient is steep, within the pixel limits
+	record.radius = inverseDistances > 0 ? count / inverseDistances : std::numeric_limits<float>::max();
+	for (int c = 0; c < 3; c++) {
+		float gradient = glm::length(record.translation[c]);
+		if (gradient > 0 && record.e[c] > 0)
+			record.radius = std::min(record.radius, record.e[c] / gradient);
+	}
+	record.radius = ofClamp(record.radius, settings.minPixels * footprint, settings.maxPixels * footprint);
+	computed++;
+	computeMicros += ofGetElapsedTimeMicros() - start;
+	//Keep it where its influence overlaps the octree
+	glm::vec3 reach(settings.accuracy * record.radius);
+	glm::vec3 influenceMin = p - reach, influenceMax = p + reach;
+	if (!overlaps(p, p, rootMin, rootMax)) {
+		outside++;
+		return record.e;
+	}
+	std::lock_guard<std::mutex> lock(insertMutex);
+	records.push_back(record);
+	insert(&root, rootMin, rootMax, &records.back(), influenceMin, influenceMax, 0);
+	numStored++;
+	return record.e;
+}
+
+//  Store in node if it is no larger than the area of influence, otherwise in
+//  every child the area overlaps. Called with insertMutex held.
+//
+void IrradianceCache::insert(Node *node, const glm::vec3 &min, const glm::vec3 &max, const Record *record, const glm::vec3 &influenceMin,
+	const glm::vec3 &influenceMax, int depth) {
+	if (depth == maxDepth || max.x - min.x <= influenceMax.x - influenceMin.x) {
+		entries.push_back({ record, node->entries.load(std::memory_order_relaxed) });
+		node->entries.store(&entries.back(), std::memory_order_release);
+		return;
+	}
+	glm::vec3 mid = (min + max) * 0.5f;
+	for (int child = 0; child < 8; child++) {
+		glm::vec3 childMin, childMax;
+		for (int k = 0; k < 3; k++) {
+			childMin[k] = (child & (1 << k)) ? mid[k] : min[k];
+			childMax[k] = (child & (1 << k)) ? max[k] : mid[k];
+		}
+		if (!overlaps(influenceMin, influenceMax, childMin, childMax))
+			continue;
+		Node *next = node->children[child].load(std::memory_order_relaxed);
+		if (!next) {
+			nodes.emplace_back();
+			next = &nodes.back();
+			node->children[child].store(next, std::memory_order_release);
+		}
+		insert(next, childMin, childMax, record, influenceMin, influenceMax, depth + 1);
+	}
+}
+
+string IrradianceCache::report() {
+	uint64_t n = lookups.load();
+	string text = "Irradiance cache: " + ofToString(numRecords()) + " records, " + ofToString((int)computed.load()) + " computed (" +
+		ofToString((int)outside.load()) + " outside the octree) in " + ofToString(computeMicros.load() / 1000.0, 1) + " ms (thread total), " +
+		ofToString(100.0 * interpolated.load() / max(n, uint64_t(1)), 1) + "% of " + ofToString((int)n) + " lookups interpolated";
+	lookups = 0;
+	interpolated = 0;
+	computed = 0;
+	outside = 0;
+	computeMicros = 0;
+	return text;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "ofMain.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+//  Quality settings of an irradiance cache, part of its key
+//
+struct IrradianceSettings {
+	float accuracy = 0.25;        // Ward's a, larger reuses records farther away
+	int thetaSamples = 10;        // hemisphere strata, thetaSamples * phiSamples rays per record
+	int phiSamples = 30;
+	float minPixels = 2;          // record radius limits in pixels at the record
+	float maxPixels = 48;
+	float rayOffset = 0.1;        // hemisphere ray origins, along the normal like shadow rays
+	bool operator==(const IrradianceSettings &other) const {
+		return accuracy == other.accuracy && thetaSamples == other.thetaSamples && phiSamples == other.phiSamples &&
+			minPixels == other.minPixels && maxPixels == other.maxPixels && rayOffset == other.rayOffset;
+	}
+};
+
+//  Diffuse indirect light for one static scene (Ward's irradiance cache).
+//  Irradiance is sampled over the hemisphere only at sparse records; every
+//  other shading point interpolates the records around it, extrapolated
+//  with each record's rotational and translational gradients (Ward and
+//  Heckbert). A point with no valid record computes one, so records gather
+//  where irradiance changes quickly: close to other surfaces, where the
+//  record radius (harmonic mean hit distance) is small, and where the
+//  gradient is steep, which limits the radius further.
+//
+//  Records live in an octree, stored in every node their area of influence
+//  overlaps down to the node size of that area. Records are computed by
+//  whichever render thread needs them; inserts are serialized by a mutex and
+//  publish nodes with release stores, so lookups never lock.
+//
+//  Values are irradiance / pi in the [0, 1] units of the beauty buffer, so the
+//  indirect light of a diffuse surface is its color times the value.
+//
+class IrradianceCache {
+public:
+	//  Radiance arriving at origin from unit direction dir, and the distance to
+	//  the surface it left (infinity for the background). Called from render
+	//  threads.
+	//
+	typedef std::function<glm::vec3(const glm::vec3 &origin, const glm::vec3 &dir, float &distance)> RadianceCast;
+
+	//  Records may be anywhere; those outside the bounds are computed but not kept
+	//
+	IrradianceCache(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const IrradianceSettings &settings);
+
+	//  Interpolated value at p with unit normal n, false if no record is valid there
+	//
+	bool interpolate(const glm::vec3 &p, const glm::vec3 &n, glm::vec3 &irradiance);
+
+	//  Sample the hemisphere at p and add a record. footprint is the world size
+	//  of a pixel at p.
+	//
+	glm::vec3 compute(const glm::vec3 &p, const glm::vec3 &n, float footprint, const RadianceCast &cast);
+
+	const IrradianceSettings settings;
+	int numRecords() const { return numStored; }
+
+	//  Lookups and records computed since the last report
+	//
+	string report();
+	std::atomic<uint64_t> lookups{ 0 }, interpolated{ 0 }, computed{ 0 }, outside{ 0 }, computeMicros{ 0 };
+
+private:
+	struct Record {
+		glm::vec3 p, n;
+		glm::vec3 e;                  // irradiance / pi
+		float radius;
+		glm::vec3 rotation[3];        // gradients per channel
+		glm::vec3 translation[3];
+	};
+	struct Entry {
+		const Record *record;
+		const Entry *next;
+	};
+	struct Node {
+		std::atomic<Node *> children[8];
+		std::atomic<const Entry *> entries{ nullptr };
+		Node() { for (int c = 0; c < 8; c++) children[c] = nullptr; }
+	};
+
+	void insert(Node *node, const glm::vec3 &min, const glm::vec3 &max, const Record *record, const glm::vec3 &influenceMin,
+		const glm::vec3 &influenceMax, int depth);
+
+	glm::vec3 rootMin, rootMax;
+	Node root;
+	std::mutex insertMutex;
+	deque<Record> records;            // deques keep addresses, guarded by insertMutex
+	deque<Entry> entries;
+	deque<Node> nodes;
+	std::atomic<int> numStored{ 0 };
+};
@@ -0,0 +1,129 @@
+#include "jobs.h"
+
+void RenderJob::cancel() {
+	cancelled.store(true);
+	if (scheduler) scheduler->wake();
+}
+
+void RenderJob::setPriority(int priority) {
+	this->priority.store(priority);
+}
+
+void RenderScheduler::start(int threads, TileFunction renderTile, FinishFunction finishJob) {
+	this->renderTile = renderTile;
+	this->finishJob = finishJob;
+	stopping = false;
+	for (int t = 0; t < threads; t++)
+		workers.push_back(std::thread(&RenderScheduler::worker, this));
+}
+
+//  Stop the workers, jobs still queued complete as cancelled
+//
+void RenderScheduler::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeup.notify_all();
+	for (int t = 0; t < workers.size(); t++)
+		workers[t].join();
+	workers.clear();
+	vector<shared_ptr<RenderJob>> remaining;
+	remaining.swap(jobs);
+	for (int k = 0; k < remaining.size(); k++) {
+		remaining[k]->cancelled.store(true);
+		complete(remaining[k]);
+	}
+}
+
+void RenderScheduler::submit(shared_ptr<RenderJob> job) {
+	const RenderTarget &target = job->target;
+	job->tilesX = (target.colEnd - target.colBegin + target.regionWidth - 1) / target.regionWidth;
+	int tilesY = (target.rowEnd - target.rowBegin + target.regionHeight - 1) / target.regionHeight;
+	job->tileCount = max(0, job->tilesX) * max(0, tilesY);
+	job->scheduler = this;
+	job->submitTime = ofGetElapsedTimeMicros();
+	job->result = job->promise.get_future().share();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job->sequence = sequence++;
+		jobs.push_back(job);
+	}
+	wakeup.notify_all();
+}
+
+vector<shared_ptr<RenderJob>> RenderScheduler::activeJobs() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return jobs;
+}
+
+void RenderScheduler::worker() {
+	while (true) {
+		shared_ptr<RenderJob> job;
+		int tile = 0;
+		bool retire = false;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (!job) {
+				if (stopping) return;
+				//Retire jobs that are done or cancelled with no tiles still rendering
+				for (int k = 0; k < jobs.size() && !job; k++) {
+					RenderJob *j = jobs[k].get();
+					if (j->inFlight == 0 && (j->cancelled.load() || j->tilesDone.load() == j->tileCount)) {
+						job = jobs[k];
+						job->finished = true;
+						jobs.erase(jobs.begin() + k);
+						retire = true;
+					}
+				}
+				if (job) break;
+				//Otherwise take the next tile of the highest priority job
+				for (int k = 0; k < jobs.size(); k++) {
+					RenderJob *j = jobs[k].get();
+					if (j->cancelled.load() || j->nextTile >= j->tileCount) continue;
+					if (!job || j->priority.load() > job->priority.load() ||
+						(j->priority.load() == job->priority.load() && j->sequence < job->sequence))
+						job = jobs[k];
+				}
+				if (job) {
+					tile = job->nextTile++;
+					job->inFlight++;
+				}
+				else
+					wakeup.wait(lock);
+			}
+		}
+		if (retire) {
+			complete(job);
+			continue;
+		}
+		RenderTarget &target = job->target;
+		int x0 = target.colBegin + (tile % job->tilesX) * target.regionWidth;
+		int y0 = target.rowBegin + (tile / job->tilesX) * target.regionHeight;
+		int x1 = min(x0 + target.regionWidth, target.colEnd), y1 = min(y0 + target.regionHeight, target.rowEnd);
+		renderTile(target, x0, x1, y0, y1);
+		if (job->onTile)
+			job->onTile(*job, x0, x1, y0, y1);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job->inFlight--;
+			job->tilesDone++;
+		}
+		wakeup.notify_all();
+	}
+}
+
+//  Post process a finished job and fulfil its future
+//
+void RenderScheduler::complete(shared_ptr<RenderJob> job) {
+	shared_ptr<RenderResult> result = make_shared<RenderResult>();
+	result->jobId = job->id;
+	result->name = job->name;
+	result->cancelled = job->cancelled.load();
+	if (!result->cancelled && finishJob)
+		finishJob(job->target);
+	job->target.snapshot.release();
+	result->ms = (ofGetElapsedTimeMicros() - job->submitTime) / 1000.0f;
+	result->target = std::move(job->target);
+	job->promise.set_value(result);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "ofMain.h"
+#include "render.h"
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+
+class RenderScheduler;
+
+//  Output of a render job. The target keeps the settings, color and AOV buffers.
+//
+struct RenderResult {
+	int jobId = 0;
+	string name;
+	bool cancelled = false;
+	float ms = 0;
+	RenderTarget target;
+};
+
+//  One render of one camera at one quality, split into tiles that the
+//  scheduler hands to its workers. Priority and cancellation may be changed
+//  from any thread while the job runs.
+//
+class RenderJob {
+public:
+	typedef std::function<void(const RenderJob &job, int x0, int x1, int y0, int y1)> TileCallback;
+
+	void cancel();
+	void setPriority(int priority);
+	int getPriority() const { return priority.load(); }
+	bool isCancelled() const { return cancelled.load(); }
+	float progress() const { return tileCount ? float(tilesDone.load()) / tileCount : 1; }
+
+	int id = 0;
+	string name;
+	RenderTarget target;                           // set up before submit
+	TileCallback onTile;                           // optional, runs on the worker after each tile
+	std::shared_future<shared_ptr<RenderResult>> result;
+
+private:
+	friend class RenderScheduler;
+	std::atomic<int> priority{ 0 };
+	std::atomic<bool> cancelled{ false };
+	std::atomic<int> tilesDone{ 0 };
+	int tileCount = 0;
+	int tilesX = 0;
+	int nextTile = 0;                              // guarded by the scheduler mutex
+	int inFlight = 0;
+	uint64_t sequence = 0;
+	bool finished = false;
+	uint64_t submitTime = 0;
+	std::promise<shared_ptr<RenderResult>> promise;
+	RenderScheduler *scheduler = NULL;
+};
+
+//  A fixed pool of worker threads shared by all render jobs. Workers always take
+//  the next tile of the highest priority job (oldest first on ties), so a small
+//  high priority job runs next to a large one without adding threads.
+//
+class RenderScheduler {
+public:
+	typedef std::function<void(RenderTarget &target, int x0, int x1, int y0, int y1)> TileFunction;
+	typedef std::function<void(RenderTarget &target)> FinishFunction;
+
+	~RenderScheduler() { stop(); }
+	void start(int threads, TileFunction renderTile, FinishFunction finishJob);
+	void stop();
+	void submit(shared_ptr<RenderJob> job);
+	void wake() { wakeup.notify_all(); }
+	vector<shared_ptr<RenderJob>> activeJobs();
+	int numThreads() const { return workers.size(); }
+
+private:
+	void worker();
+	void complete(shared_ptr<RenderJob> job);
+
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	vector<shared_ptr<RenderJob>> jobs;
+	vector<std::thread> workers;
+	bool stopping = false;
+	uint64_t sequence = 0;
+	TileFunction renderTile;
+	FinishFunction finishJob;
+};
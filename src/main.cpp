@@ -1,13 +1,38 @@
 #include "ofMain.h"
 #include "ofApp.h"
+#include "ofAppNoWindow.h"
 
 //========================================================================
-int main( ){
-	ofSetupOpenGL(1200,800,OF_WINDOW);			// <-------- setup the GL context
+int main(int argc, char *argv[]){
+	ofApp *app = new ofApp();
+	//--daemon [--socket path]: no window, the render server only
+	//--viewport-bench objects: time viewport frames for a generated scene, then quit
+	for (int k = 1; k < argc; k++) {
+		string arg = argv[k];
+		if (arg == "--daemon")
+			app->daemonMode = true;
+		else if (arg == "--socket" && k + 1 < argc)
+			app->serverPath = argv[++k];
+		else if (arg == "--viewport-bench" && k + 1 < argc)
+			app->viewportBenchObjects = atoi(argv[++k]);
+	}
+	if (app->daemonMode) {
+		ofInit();
+		shared_ptr<ofAppNoWindow> window = make_shared<ofAppNoWindow>();
+		ofGetMainLoop()->addWindow(window);
+		ofRunApp(window, shared_ptr<ofBaseApp>(app));
+		return ofRunMainLoop();
+	}
+
+	//GL 3.2 for the programmable renderer, the viewport draws instanced
+	ofGLWindowSettings settings;
+	settings.setGLVersion(3, 2);
+	settings.setSize(1200, 800);
+	ofCreateWindow(settings);			// <-------- setup the GL context
 
 	// this kicks off the running of my app
 	// can be OF_WINDOW or OF_FULLSCREEN
 	// pass in width and height too:
-	ofRunApp(new ofApp());
+	ofRunApp(app);
 
 }
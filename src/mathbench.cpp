@@ -0,0 +1,147 @@
+#include "mathbench.h"
+#include "simd.h"
+#include "box.h"
+#include "glm/gtx/intersect.hpp"
+#include <random>
+
+static const int benchCount = 1 << 16;
+static const int benchRounds = 16;
+
+struct BenchRow {
+	string name;
+	double referenceNs, fastNs;
+	float maxError;
+};
+
+//  Fastest of benchRounds passes of f over benchCount inputs, ns per input. f
+//  returns a value folded into sink so the work is not optimized away.
+//
+template <class F>
+static double timeLoop(F f, volatile float &sink) {
+	uint64_t best = UINT64_MAX;
+	float sum = 0;
+	for (int k = 0; k < benchRounds; k++) {
+		uint64_t start = ofGetElapsedTimeMicros();
+		sum += f();
+		best = min(best, ofGetElapsedTimeMicros() - start);
+	}
+	sink = sum;
+	return best * 1000.0 / benchCount;
+}
+
+void runMathBenchmark(const string &path) {
+	std::mt19937 rng(116);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	vector<float> a(benchCount), b(benchCount), out(benchCount), ref(benchCount);
+	vector<glm::vec3> v(benchCount), d(benchCount);
+	for (int k = 0; k < benchCount; k++) {
+		a[k] = unit(rng);
+		b[k] = unit(rng);
+		v[k] = glm::vec3(unit(rng), unit(rng), unit(rng)) * 20.0f - 10.0f;
+		d[k] = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) * 2.0f - 1.0f + glm::vec3(0, 0, 0.01f));
+	}
+	vector<BenchRow> rows;
+	volatile float sink;
+	auto compare = [&](const string &name, double refNs, double fastNs, bool relative) {
+		float error = 0;
+		for (int k = 0; k < benchCount; k++) {
+			float e = fabsf(out[k] - ref[k]);
+			if (relative) e /= max(fabsf(ref[k]), 1e-30f);
+			error = max(error, e);
+		}
+		rows.push_back(BenchRow{ name, refNs, fastNs, error });
+	};
+
+	//exp over the denoiser's range, four lanes as in its filter loop
+	double refNs = timeLoop([&]() { for (int k = 0; k < benchCount; k++) ref[k] = expf(-20 * a[k]); return ref[benchCount - 1]; }, sink);
+#if defined(__SSE2__)
+	double fastNs = timeLoop([&]() {
+		for (int k = 0; k < benchCount; k += 4)
+			_mm_storeu_ps(&out[k], fastExp4(_mm_mul_ps(_mm_set1_ps(-20.0f), _mm_loadu_ps(&a[k]))));
+		return out[benchCount - 1];
+	}, sink);
+	compare("exp x4 (rel)", refNs, fastNs, true);
+#else
+	double fastNs = timeLoop([&]() { for (int k = 0; k < benchCount; k++) out[k] = fastExp(-20 * a[k]); return out[benchCount - 1]; }, sink);
+	compare("exp (rel)", refNs, fastNs, true);
+#endif
+
+	//acos of spot light cone cosines
+	refNs = timeLoop([&]() { for (int k = 0; k < benchCount; k++) ref[k] = acosf(2 * a[k] - 1); return ref[benchCount - 1]; }, sink);
+	fastNs = timeLoop([&]() { for (int k = 0; k < benchCount; k++) out[k] = fastAcos(2 * a[k] - 1); return out[benchCount - 1]; }, sink);
+	compare("acos (abs)", refNs, fastNs, false);
+
+	//Normalize, error of the x component
+	refNs = timeLoop([&]() { for (int k = 0; k < benchCount; k++) ref[k] = glm::normalize(v[k]).x; return ref[benchCount - 1]; }, sink);
+	fastNs = timeLoop([&]() { for (int k = 0; k < benchCount; k++) out[k] = Vec4f(v[k]).normalized3()[0]; return out[benchCount - 1]; }, sink);
+	compare("normalize Vec4f (abs)", refNs, fastNs, false);
+	vector<float> vx(benchCount), vy(benchCount), vz(benchCount);
+	for (int k = 0; k < benchCount; k++) {
+		vx[k] = v[k].x; vy[k] = v[k].y; vz[k] = v[k].z;
+	}
+	fastNs = timeLoop([&]() {
+		for (int k = 0; k < benchCount; k += Float8::lanes)
+			Vec3x8::load(&vx[k], &vy[k], &vz[k]).normalized().x.store(&out[k]);
+		return out[benchCount - 1];
+	}, sink);
+	compare("normalize Vec3x8 (abs)", refNs, fastNs, false);
+
+	//Ray / box, fraction of disagreeing rays
+	glm::vec3 boxMin(-2, -2, 0), boxMax(2, 2, 6);
+	refNs = timeLoop([&]() {
+		Box box(Vector3(boxMin.x, boxMin.y, boxMin.z), Vector3(boxMax.x, boxMax.y, boxMax.z));
+		for (int k = 0; k < benchCount; k++)
+			ref[k] = box.intersect(_Ray(Vector3(v[k].x, v[k].y, v[k].z), Vector3(d[k].x, d[k].y, d[k].z)), -1000, 1000);
+		return ref[benchCount - 1];
+	}, sink);
+	fastNs = timeLoop([&]() {
+		Vec4f lo(boxMin), hi(boxMax);
+		for (int k = 0; k < benchCount; k++)
+			out[k] = rayBoxIntersect(Vec4f(v[k]), Vec4f(1.0f / d[k].x, 1.0f / d[k].y, 1.0f / d[k].z), lo, hi, -1000, 1000);
+		return out[benchCount - 1];
+	}, sink);
+	int mismatches = 0;
+	for (int k = 0; k < benchCount; k++)
+		mismatches += out[k] != ref[k];
+	rows.push_back(BenchRow{ "ray/box (mismatch rate)", refNs, fastNs, float(mismatches) / benchCount });
+
+	//Ray / sphere distance, glm against eight lanes of the wavefront loop
+	glm::vec3 center(1, 2, 3);
+	float radius = 4, r2 = radius * radius;
+	vector<float> dx(benchCount), dy(benchCount), dz(benchCount);
+	for (int k = 0; k < benchCount; k++) {
+		dx[k] = d[k].x; dy[k] = d[k].y; dz[k] = d[k].z;
+	}
+	refNs = timeLoop([&]() {
+		for (int k = 0; k < benchCount; k++) {
+			float dist = 0;
+			ref[k] = glm::intersectRaySphere(v[k], d[k], center, r2, dist) ? dist : -1;
+		}
+		return ref[benchCount - 1];
+	}, sink);
+	fastNs = timeLoop([&]() {
+		Vec3x8 c(center);
+		Float8 radius2(r2), eps(std::numeric_limits<float>::epsilon()), zero(0.0f), miss(-1.0f);
+		for (int k = 0; k < benchCount; k += Float8::lanes) {
+			Vec3x8 e = c - Vec3x8::load(&vx[k], &vy[k], &vz[k]);
+			Float8 t0 = e.dot(Vec3x8::load(&dx[k], &dy[k], &dz[k]));
+			Float8 dd = e.dot(e) - t0 * t0;
+			Float8 t1 = sqrt(max(radius2 - dd, zero));
+			Float8 dist = select(t0 > t1 + eps, t0 - t1, t0 + t1);
+			select((dd <= radius2) & (dist > eps), dist, miss).store(&out[k]);
+		}
+		return out[benchCount - 1];
+	}, sink);
+	compare("ray/sphere Vec3x8 (abs)", refNs, fastNs, false);
+
+	ofstream csv(path);
+	csv << "op,reference_ns,fast_ns,speedup,max_error" << endl;
+	cout << "Math benchmark, " << benchCount << " inputs, best of " << benchRounds << " runs" << endl;
+	for (int k = 0; k < rows.size(); k++) {
+		const BenchRow &row = rows[k];
+		double speedup = row.fastNs > 0 ? row.referenceNs / row.fastNs : 0;
+		cout << "  " << row.name << ": " << row.referenceNs << " -> " << row.fastNs << " ns/op ("
+			<< speedup << "x), max error " << row.maxError << endl;
+		csv << row.name << "," << row.referenceNs << "," << row.fastNs << "," << speedup << "," << row.maxError << endl;
+	}
+}
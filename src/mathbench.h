@@ -0,0 +1,9 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Microbenchmark of the simd.h paths against the glm / libm / _Ray + Box code
+//  they replace. Prints ns per operation and the largest error of each pair and
+//  writes the same table to path as CSV.
+//
+void runMathBenchmark(const string &path);
@@ -1,6 +1,7 @@
 //Sair Abbas - CS116
 
 #include "ofApp.h"
+#include <cstring>
 
 // Intersect Ray with Plane  (wrapper on glm::intersect*
 //
@@ -27,7 +28,7 @@ bool Plane::intersect(const Ray &ray, glm::vec3 & point, glm::vec3 & normalAtInt
 glm::vec3 ViewPlane::toWorld(float u, float v) {
 	float w = width();
 	float h = height();
-	return (glm::vec3((u * w) + min.x, (v * h) + min.y, position.z));
+	return (position + right * ((u * w) + min.x) + up * ((v * h) + min.y));
 }
 
 // Get a ray from the current camera position to the (u, v) position on
@@ -38,71 +39,815 @@ Ray RenderCam::getRay(float u, float v) {
 	return(Ray(position, glm::normalize(pointOnPlane - position)));
 }
 
+// Rebuild the orthonormal camera basis and place the ViewPlane viewDistance
+// along the aim direction, sized from fov and aspect
+//
+void RenderCam::update() {
+	glm::vec3 forward = glm::normalize(aim);
+	glm::vec3 right = glm::normalize(glm::cross(forward, up));
+	float halfHeight = viewDistance * tan(glm::radians(fov) / 2);
+	float halfWidth = halfHeight * aspect;
+	view.position = position + forward * viewDistance;
+	view.normal = -forward;
+	view.right = right;
+	view.up = glm::cross(right, forward);
+	view.setSize(glm::vec2(-halfWidth, -halfHeight), glm::vec2(halfWidth, halfHeight));
+}
+
+// Take position, orientation and fov from an openFrameworks camera
+//
+void RenderCam::setFromCamera(const ofCamera &cam, float aspect) {
+	position = cam.getGlobalPosition();
+	aim = cam.getLookAtDir();
+	up = cam.getUpDir();
+	fov = cam.getFov();
+	this->aspect = aspect;
+	update();
+}
+
+// Precompute the direction to raster position (0, 0) and the per pixel steps,
+// so ray directions can be generated incrementally across a scanline
+//
+void RenderCam::beginRaster(int width, int height) {
+	rasterOrigin = view.toWorld(0, 0) - position;
+	rasterStepX = view.right * (view.width() / width);
+	rasterStepY = view.up * (view.height() / height);
+}
+
 //Raytracing function
 void ofApp::rayTrace() {
     //Begin render
-	ofColor color;
     cout << "Rendering..." << endl;
+	publishScene();
+	renderCam.setFromCamera(previewCam, float(imageWidth) / imageHeight);
+	//Traced on the worker pool ahead of any background jobs, wait for it
+	shared_ptr<RenderJob> job = submitJob(previewCam, guiSettings(), 100, "final", nullptr, &reprojection);
+	shared_ptr<RenderResult> result = job->result.get();
+	if (result->cancelled)
+	{
+		cout << "Render cancelled" << endl << endl;
+		return;
+	}
+	const RenderTarget &finalTarget = result->target;
+    //Save image right side up
+	finalTarget.toImage(image);
+	image.save("image.png");
+	//Save AOVs with the beauty image in one multi-channel file
+	if (!finalTarget.aovs.empty())
+		finalTarget.aovs.saveEXR("image.exr", image);
+    //Confirm render as complete
+    cout << "Finished" << endl << endl;
+	renderFinish = true;
+}
+
+//Render settings from the GUI
+RenderSettings ofApp::guiSettings() {
+	RenderSettings settings;
+	settings.width = imageWidth;
+	settings.height = imageHeight;
+	settings.samples = pixelSamples;
+	settings.softShadows = softShadows;
+	settings.shadowSamples = shadowSamples;
+	settings.denoise = denoise;
+	settings.aovMask = (aovDepth ? 1 << AOV_DEPTH : 0) | (aovNormal ? 1 << AOV_NORMAL : 0) |
+		(aovObjectId ? 1 << AOV_OBJECT_ID : 0) | (aovAlbedo ? 1 << AOV_ALBEDO : 0);
+	settings.crop = cropRegion;
+	settings.shadowMaps = shadowMaps;
+	settings.shadowMapSize = shadowMapSize;
+	settings.shadowBias = shadowBias;
+	settings.wavefront = wavefront;
+	settings.reproject = reprojectFrames;
+	settings.indirect = indirectLight;
+	settings.irradiance.accuracy = irradianceAccuracy;
+	settings.environmentSamples = environmentSamples;
+	settings.environmentImportance = environmentImportance;
+	settings.beautyFormat = FrameFormat(int(beautyFormat));
+	settings.frameBudget = size_t(int(frameBudget)) << 20;
+	return settings;
+}
+
+//Set up a render pass through the given camera: buffers and per tile object lists.
+//Returns false, leaving an empty pass with nothing to trace, if the scene could
+//not be pinned because every reader slot is taken by passes still in flight.
+bool ofApp::beginRender(RenderTarget &target, const RenderSettings &settings, RenderCam &camera, ReprojectionCache *reprojection) {
+	target.startTime = ofGetElapsedTimeMicros();
+	camera.crop = settings.crop;
+	camera.beginRaster(settings.width, settings.height);
+	//Pin the current scene version for the whole pass
+	target.snapshot = sceneStore.read();
+	if (!target.snapshot)
+	{
+		cout << "Render: all scene reader slots busy, pass skipped" << endl;
+		target.allocate(settings, ofColor::black);
+		target.colEnd = target.colBegin;
+		target.rowBegin = target.rowEnd = target.nextRow = 0;
+		target.reprojection = NULL;
+		target.tileLists.clear();
+		target.objectIds.clear();
+		target.shadowMaps.reset();
+		target.irradiance.reset();
+		target.wavefrontStats.reset();
+		target.occluders.reset();
+		return false;
+	}
+	const SceneSnapshot &snapshot = *target.snapshot;
+	target.allocate(settings, snapshot.background);
+	target.origin = camera.position;
+	target.rasterOrigin = camera.rasterOrigin;
+	target.rasterStepX = camera.rasterStepX;
+	target.rasterStepY = camera.rasterStepY;
+	//Reuse what the previous frame of this cache still shows, trace the rest
+	target.reprojection = settings.reproject ? reprojection : NULL;
+	if (target.reprojection)
+		target.reprojection->reproject(target);
+	target.objectIds.clear();
+	for (int a = 0; a < snapshot.scene.size(); a++)
+		target.objectIds[snapshot.scene[a]] = a + 1;
+	//Cull the scene against each tile's frustum, primary rays only test their tile's list
+	buildTileLists(snapshot, camera, settings.width, settings.height, target.tileSize, target.tileLists, settings.verbose);
+	target.wavefrontStats.reset();
+	target.occluders.reset();
+	if (settings.wavefront) {
+		target.wavefrontStats = make_shared<WavefrontStats>();
+		shared_ptr<WavefrontGeometry> occluders = make_shared<WavefrontGeometry>();
+		occluders->build(snapshot.scene);
+		target.occluders = occluders;
+		//Full width bands of about one batch, but enough of them to keep every worker busy
+		int cropWidth = max(1, target.colEnd - target.colBegin), cropHeight = target.rowEnd - target.rowBegin;
+		int rows = max(1, WavefrontRenderer::batchRays / (cropWidth * max(1, settings.samples)));
+		target.regionWidth = cropWidth;
+		target.regionHeight = max(1, min(rows, cropHeight / (2 * max(1, scheduler.numThreads()))));
+	}
+	target.shadowMaps.reset();
+	if (settings.shadowMaps)
+		target.shadowMaps = buildShadowMaps(snapshot, settings);
+	target.irradiance.reset();
+	if (settings.indirect)
+		target.irradiance = getIrradianceCache(snapshot, settings);
+	return true;
+}
+
+//Irradiance records stay valid while the scene does not change, so frames of
+//one version share a cache whatever the camera
+shared_ptr<IrradianceCache> ofApp::getIrradianceCache(const SceneSnapshot &snapshot, const RenderSettings &settings) {
+	if (irradianceCache && irradianceVersion == snapshot.version && irradianceCache->settings == settings.irradiance)
+		return irradianceCache;
+	glm::vec3 min(0), max(0);
+	for (int a = 0; a < snapshot.bounded.size(); a++)
+	{
+		min = a ? glm::min(min, snapshot.boundsMin[a]) : snapshot.boundsMin[a];
+		max = a ? glm::max(max, snapshot.boundsMax[a]) : snapshot.boundsMax[a];
+	}
+	irradianceCache = make_shared<IrradianceCache>(min, max, settings.irradiance);
+	irradianceVersion = snapshot.version;
+	return irradianceCache;
+}
+
+//Shadow maps for every light of the snapshot, reusing the previous pass's maps
+//for lights and occluders that have not moved
+shared_ptr<const ShadowMapSet> ofApp::buildShadowMaps(const SceneSnapshot &snapshot, const RenderSettings &settings) {
+	shared_ptr<ShadowMapSet> set = make_shared<ShadowMapSet>();
+	ShadowMap::RayCast cast = [this, &snapshot](const glm::vec3 &origin, const glm::vec3 &dir) {
+		glm::vec3 point, normal;
+		SceneObject *object;
+		if (closestHit(Ray(origin, dir), snapshot.scene, point, normal, object))
+			return glm::length(point - origin);
+		return std::numeric_limits<float>::infinity();
+	};
+	shadowMapCache.beginPass();
+	for (int i = 0; i < snapshot.pointLights.size(); i++)
+	{
+		ShadowMapKey key;
+		key.position = snapshot.pointLights[i]->position;
+		key.size = settings.shadowMapSize;
+		key.geometryVersion = snapshot.geometryVersion;
+		set->maps[snapshot.pointLights[i]] = shadowMapCache.get(key, cast);
+	}
+	for (int i = 0; i < snapshot.spotLights.size(); i++)
+	{
+		ShadowMapKey key;
+		key.cube = false;
+		key.position = snapshot.spotLights[i]->position;
+		key.aim = snapshot.spotLights[i]->aim;
+		key.cone = snapshot.spotSize;
+		key.size = settings.shadowMapSize;
+		key.geometryVersion = snapshot.geometryVersion;
+		set->maps[snapshot.spotLights[i]] = shadowMapCache.get(key, cast);
+	}
+	shadowMapCache.endPass();
+	if (settings.verbose && shadowMapCache.builds)
+		cout << "Shadow maps: built " << shadowMapCache.builds << ", reused " << shadowMapCache.reuses
+		<< " in " << shadowMapCache.buildMs << " ms" << endl;
+	return set;
+}
+
+//Trace the target's rows up to (not including) endRow
+void ofApp::renderRows(RenderTarget &target, int endRow) {
+	endRow = min(endRow, target.rowEnd);
+	renderRegion(target, target.colBegin, target.colEnd, target.nextRow, endRow);
+	target.nextRow = max(target.nextRow, endRow);
+}
+
+//Trace pixels [x0, x1) x [y0, y1). Only reads the pass state and writes its own
+//pixels, so disjoint regions of a target can be traced on different threads.
+void ofApp::renderRegion(RenderTarget &target, int x0, int x1, int y0, int y1) {
+	ofColor color;
+	RenderContext ctx = { target.snapshot.get(), &target.settings, target.origin, target.shadowMaps.get(), &textureCache };
+	ctx.irradiance = target.irradiance.get();
+	glm::vec3 stepX = target.rasterStepX, stepY = target.rasterStepY;
+	//Angle covered by one pixel, for texture filtering
+	ctx.pixelAngle = glm::length(stepX) / glm::length(target.rasterOrigin + stepX * (target.settings.width * 0.5f) + stepY * (target.settings.height * 0.5f));
+	//Same pixels through the batched renderer, one per thread
+	if (target.settings.wavefront)
+	{
+		static thread_local WavefrontRenderer wavefrontRenderer;
+		wavefrontRenderer.render(*this, ctx, target, x0, x1, y0, y1);
+		textureCache.flushThread();
+		target.frame.finish(x0, x1, y0, y1);
+		return;
+	}
+	const SceneSnapshot &snapshot = *ctx.scene;
+	int width = target.settings.width;
+	int samples = target.settings.samples;
+	int tileSize = target.tileSize;
+	float pixelAngle = ctx.pixelAngle;
     //Iterate through each pixel
-	for (int j = 0; j < image.getHeight(); j++)
-	{
-		for (int i = 0; i < image.getWidth(); i++)
-		{
-            //Initialize variables
-			float u = (i + 0.5) / image.getWidth();
-			float v = (j + 0.5) / image.getHeight();
-			float currentDist, closestDist = std::numeric_limits<float>::infinity();
-			Ray ray = renderCam.getRay(u, v);
-			bool hit = false;
-			SceneObject *closestObject = NULL;
-			glm::vec3 intersectPoint, normal, closestIntersect, closestNormal;
-            //Iterate through each scene object
-			for (int a = 0; a < scene.size(); a++)
+	for (int j = y0; j < y1; j++)
+	{
+		//Ray directions are stepped across the scanline
+		glm::vec3 pixelDir = target.rasterOrigin + stepX * float(x0) + stepY * float(j);
+		for (int i = x0; i < x1; i++, pixelDir += stepX)
+		{
+			//Filled by reprojection
+			if (!target.traceMask.empty() && !target.traceMask[j * width + i])
+				continue;
+			Sampler sampler(snapshot.samplerType, samples, j * width + i);
+			glm::vec3 sum = glm::vec3(0, 0, 0);
+			for (int s = 0; s < samples; s++)
 			{
-                //Check if ray intersected with scene object
-				if (scene[a]->intersect(ray, intersectPoint, normal))
-				{
-					hit = true;
-					currentDist = glm::length(intersectPoint - renderCam.position);
-                    //If closest object assign values to variables
-					if (currentDist < closestDist)
-					{
-						closestIntersect = intersectPoint;
-						closestNormal = normal;
-						closestDist = currentDist;
-						closestObject = scene[a];
-					}
-				}
+				//Initialize variables, one sample is taken at the pixel center
+				glm::vec2 offset = (samples == 1) ? glm::vec2(0.5, 0.5) : sampler.get(s);
+				Ray ray = Ray(target.origin, glm::normalize(pixelDir + stepX * offset.x + stepY * offset.y));
+				SceneObject *closestObject = NULL;
+				glm::vec3 closestIntersect, closestNormal;
 				//If closest object color pixel same as object
-				if (hit == true)
+				const vector<SceneObject *> &candidates = target.tileLists[(j / tileSize) * target.tilesX + i / tileSize];
+				if (closestHit(ray, candidates, closestIntersect, closestNormal, closestObject))
 				{
+					ofColor diffuse = surfaceColor(ctx, closestObject, closestIntersect, closestNormal, ray, pixelAngle);
 					//Toggle shaders
-					if (toggleShading)
-						color = phong(closestIntersect, closestNormal, closestObject->diffuseColor, closestObject->specularColor, power);
+					if (snapshot.phong)
+						color = phong(ctx, closestIntersect, closestNormal, diffuse, closestObject->specularColor, snapshot.power);
 					else
-						color = lambert(closestIntersect, closestNormal, closestObject->diffuseColor);
-					image.setColor(i, j, color);
+						color = lambert(ctx, closestIntersect, closestNormal, diffuse);
+					if (s == 0 && !target.aovs.empty())
+						target.aovs.write(i, j, glm::length(closestIntersect - ray.p), normalize(closestNormal),
+							target.objectIds.find(closestObject)->second, diffuse);
 				}
 				//If no intersect color pixel as background
 				else
 				{
-					image.setColor(i, j, ofGetBackgroundColor());
+					color = missColor(ctx, ray.d);
+					if (s == 0 && !target.aovs.empty())
+						target.aovs.writeMiss(i, j);
 				}
+				sum += glm::vec3(color.r, color.g, color.b);
 			}
+			sum /= 255.0 * samples;
+			target.setPixel(i, j, sum);
 		}
 	}
-    //Save image right side up
-    image.mirror(true, false);
-	image.save("image.png");
-    //Confirm render as complete
-    cout << "Finished" << endl << endl;
-	renderFinish = true;
+	//Batched texture counters, before the pass can be reported
+	textureCache.flushThread();
+	target.frame.finish(x0, x1, y0, y1);
+}
+
+//Post process a completed pass
+void ofApp::finishRender(RenderTarget &target, Denoiser &denoiser, int denoiseThreads) {
+	if (target.settings.verbose)
+		cout << "Traced " << target.settings.samples << " spp in " << (ofGetElapsedTimeMicros() - target.startTime) / 1000.0 << " ms" << endl;
+	if (target.settings.verbose && target.wavefrontStats)
+		cout << target.wavefrontStats->report() << endl;
+	if (target.settings.verbose && textureCache.numTextures())
+		cout << textureCache.report() << endl;
+	//Workers can't touch the editor scene, report from the rendered copies instead
+	const vector<SceneObject *> &rendered = target.snapshot->scene;
+	if (target.settings.verbose) {
+		set<GeometryStore *> reported;
+		for (int k = 0; k < rendered.size(); k++)
+			if (SphereCloud *cloud = dynamic_cast<SphereCloud *>(rendered[k]))
+				if (reported.insert(cloud->store.get()).second)
+					cout << cloud->store->report() << endl;
+	}
+	if (target.settings.verbose && target.irradiance)
+		cout << target.irradiance->report() << endl;
+	if (target.settings.verbose)
+		for (int k = 0; k < rendered.size(); k++)
+			if (ImplicitSurface *implicit = dynamic_cast<ImplicitSurface *>(rendered[k]))
+				cout << implicit->stats->report(implicit->name) << endl;
+	//Keep the noisy frame for the next one to reproject
+	if (target.reprojection)
+	{
+		int pixels = (target.colEnd - target.colBegin) * (target.rowEnd - target.rowBegin);
+		if (target.settings.verbose)
+			cout << "Reprojection: reused " << target.reusedPixels << " of " << pixels << " pixels (" <<
+				int(100.0 * target.reusedPixels / max(1, pixels)) << "%)" << endl;
+		target.reprojection->store(target);
+		target.reprojection = NULL;
+	}
+	//Filter low sample noise, guided by the primary hit AOVs
+	if (target.settings.denoise)
+	{
+		DenoiseSettings denoiseSettings;
+		denoiseSettings.threads = denoiseThreads;
+		//The filter works on whole float planes, converted from the beauty precision and back
+		vector<float> planes[3];
+		target.frame.readPlanes(target.beauty, planes);
+		float ms = denoiser.denoise(planes[0].data(), planes[1].data(), planes[2].data(), target.aovs, denoiseSettings);
+		if (target.settings.verbose)
+			cout << "Denoised " << target.settings.width << "x" << target.settings.height << " in " << ms << " ms (" <<
+				denoiseSettings.iterations << " passes)" << endl;
+		target.frame.writePlanes(target.beauty, planes);
+	}
+	if (target.settings.verbose)
+		cout << target.frame.report() << ", AOVs " << target.aovs.bytesPerPixel() << " B/px" << endl;
+	//Let the scene version go so it can be reclaimed
+	target.snapshot.release();
+	target.tileLists.clear();
+	target.objectIds.clear();
+	target.shadowMaps.reset();
+	target.wavefrontStats.reset();
+	target.occluders.reset();
+}
+
+//Queue a render of any camera at the given quality on the worker pool. Higher
+//priority jobs get their tiles traced first; the job can be cancelled or
+//reprioritized while it runs and its result is delivered through job->result.
+//onTile, if given, sees each tile as soon as it is traced. With a reprojection
+//cache the job reuses the cache's last frame and then replaces it.
+shared_ptr<RenderJob> ofApp::submitJob(const ofCamera &cam, const RenderSettings &settings, int priority, const string &name, RenderJob::TileCallback onTile,
+	ReprojectionCache *reprojection) {
+	shared_ptr<RenderJob> job = make_shared<RenderJob>();
+	job->id = nextJobId++;
+	job->name = name;
+	job->onTile = onTile;
+	job->setPriority(priority);
+	RenderCam camera;
+	camera.setFromCamera(cam, float(settings.width) / settings.height);
+	//Without a scene version the job completes at once as cancelled
+	if (!beginRender(job->target, settings, camera, reprojection))
+		job->cancel();
+	scheduler.submit(job);
+	return job;
+}
+
+//Render the main and side views together: the side view as a quick low
+//resolution check ahead of the full quality main view
+void ofApp::submitCameraJobs() {
+	publishScene();
+	RenderSettings quick;
+	quick.width = imageWidth / 4;
+	quick.height = imageHeight / 4;
+	quick.verbose = false;
+	jobs.push_back(submitJob(sideCam, quick, 10, "side"));
+	jobs.push_back(submitJob(mainCam, guiSettings(), 1, "main"));
+	cout << "Submitted render jobs on " << scheduler.numThreads() << " threads" << endl;
+}
+
+//Save finished background jobs
+void ofApp::updateJobs() {
+	for (int k = 0; k < jobs.size(); k++)
+	{
+		if (jobs[k]->result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			continue;
+		shared_ptr<RenderResult> result = jobs[k]->result.get();
+		if (result->cancelled)
+			cout << "Job " << result->jobId << " (" << result->name << ") cancelled" << endl;
+		else
+		{
+			ofImage jobImage;
+			result->target.toImage(jobImage);
+			string path = "job_" + ofToString(result->jobId) + "_" + result->name + ".png";
+			jobImage.save(path);
+			cout << "Job " << result->jobId << " (" << result->name << ") finished in " << result->ms << " ms, saved " << path << endl;
+		}
+		jobs.erase(jobs.begin() + k--);
+	}
+}
+
+//Listen for render server clients. The scene, its snapshots and the shadow map
+//and texture caches stay warm between their edits.
+void ofApp::startServer() {
+	if (server.isRunning())
+		return;
+	serverCam.setPosition(previewCam.getGlobalPosition());
+	serverCam.setOrientation(previewCam.getGlobalOrientation());
+	serverCam.setFov(renderCam.fov);
+	server.start(serverPath);
+}
+
+//Apply queued client commands, then send the images of finished server jobs
+void ofApp::updateServer() {
+	if (!server.isRunning())
+		return;
+	server.poll([this](int client, const string &line) { serverCommand(client, line); });
+	for (int k = 0; k < serverJobs.size(); k++)
+	{
+		shared_ptr<RenderJob> job = serverJobs[k].job;
+		if (job->result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			continue;
+		shared_ptr<RenderResult> result = job->result.get();
+		int client = serverJobs[k].client;
+		if (result->cancelled)
+			server.send(client, "cancelled " + ofToString(result->jobId));
+		else
+		{
+			const RenderTarget &target = result->target;
+			vector<unsigned char> rgb;
+			target.toRGB(0, target.settings.width, 0, target.settings.height, rgb);
+			server.send(client, "image " + ofToString(result->jobId) + " " + ofToString(target.settings.width) + " " + ofToString(target.settings.height), rgb);
+			float pixels = (target.colEnd - target.colBegin) * (target.rowEnd - target.rowBegin);
+			server.send(client, "done " + ofToString(result->jobId) + " " + ofToString(result->ms) + " " +
+				ofToString(target.reusedPixels / max(1.0f, pixels), 3));
+		}
+		serverJobs.erase(serverJobs.begin() + k--);
+	}
+}
+
+//Run one protocol command from a render server client (see server.h)
+void ofApp::serverCommand(int client, const string &line) {
+	istringstream in(line);
+	string command;
+	in >> command;
+	//Cancel this client's job, a new edit or render replaces it
+	auto cancelJobs = [&]() {
+		for (int k = 0; k < serverJobs.size(); k++)
+			if (serverJobs[k].client == client)
+				serverJobs[k].job->cancel();
+	};
+	if (command == "scene")
+	{
+		for (int i = 0; i < scene.size(); i++)
+		{
+			string type = "object";
+			if (dynamic_cast<Sphere *>(scene[i])) type = "sphere";
+			else if (dynamic_cast<RectLight *>(scene[i])) type = "rectlight";
+			else if (dynamic_cast<PointLight *>(scene[i])) type = "pointlight";
+			else if (dynamic_cast<SpotLight *>(scene[i])) type = "spotlight";
+			else if (dynamic_cast<Plane *>(scene[i])) type = "plane";
+			glm::vec3 p = scene[i]->position;
+			server.send(client, "object " + ofToString(i) + " " + type + " " + ofToString(p.x) + " " + ofToString(p.y) + " " + ofToString(p.z));
+		}
+		server.send(client, "ok " + ofToString(int(scene.size())));
+	}
+	else if (command == "move")
+	{
+		int i;
+		glm::vec3 p;
+		if (!(in >> i >> p.x >> p.y >> p.z) || i < 0 || i >= scene.size())
+		{
+			server.send(client, "error usage: move <object> <x> <y> <z>");
+			return;
+		}
+		scene[i]->position = p;
+		markDirty(scene[i]);
+		cancelJobs();
+		server.send(client, "ok");
+	}
+	else if (command == "intensity")
+	{
+		int i;
+		float value;
+		if (!(in >> i >> value) || i < 0 || i >= scene.size())
+		{
+			server.send(client, "error usage: intensity <light> <value>");
+			return;
+		}
+		PointLight *point = dynamic_cast<PointLight *>(scene[i]);
+		SpotLight *spot = dynamic_cast<SpotLight *>(scene[i]);
+		if (!point && !spot)
+		{
+			server.send(client, "error object " + ofToString(i) + " is not a light");
+			return;
+		}
+		//updateLights applies the slider to a sole or selected light, keep it in step
+		bool followsSlider = objSelected() && selected[0] == scene[i];
+		if (point)
+		{
+			point->intensity = value;
+			if (followsSlider || pointLights.size() == 1) pointIntensity = value;
+		}
+		else
+		{
+			spot->intensity = value;
+			if (followsSlider || spotLights.size() == 1) spotIntensity = value;
+		}
+		markDirty(scene[i]);
+		cancelJobs();
+		server.send(client, "ok");
+	}
+	else if (command == "camera")
+	{
+		glm::vec3 p, target;
+		if (!(in >> p.x >> p.y >> p.z >> target.x >> target.y >> target.z))
+		{
+			server.send(client, "error usage: camera <px> <py> <pz> <tx> <ty> <tz>");
+			return;
+		}
+		serverCam.setPosition(p);
+		serverCam.lookAt(target);
+		cancelJobs();
+		server.send(client, "ok");
+	}
+	else if (command == "render")
+	{
+		RenderSettings settings = guiSettings();
+		if (!(in >> settings.width >> settings.height) || settings.width <= 0 || settings.height <= 0)
+		{
+			server.send(client, "error usage: render <width> <height> [samples]");
+			return;
+		}
+		if (settings.width > maxServerImageSize || settings.height > maxServerImageSize)
+		{
+			server.send(client, "error image larger than " + ofToString(int(maxServerImageSize)) + " pixels per side");
+			return;
+		}
+		int samples;
+		if (in >> samples)
+			settings.samples = max(1, samples);
+		settings.crop = glm::vec4(0, 0, 1, 1);
+		settings.verbose = false;
+		cancelJobs();
+		publishScene();
+		//Stream each tile back as soon as it is traced
+		shared_ptr<RenderJob> job = submitJob(serverCam, settings, 50, "server", [this, client](const RenderJob &job, int x0, int x1, int y0, int y1) {
+			vector<unsigned char> rgb;
+			job.target.toRGB(x0, x1, y0, y1, rgb);
+			server.send(client, "tile " + ofToString(job.id) + " " + ofToString(x0) + " " + ofToString(job.target.settings.height - y1) + " " +
+				ofToString(x1 - x0) + " " + ofToString(y1 - y0), rgb);
+		}, &reprojection);
+		serverJobs.push_back(ServerJob{ client, job });
+		server.send(client, "job " + ofToString(job->id));
+	}
+	else if (command == "reproject")
+	{
+		string mode;
+		in >> mode;
+		if (mode != "on" && mode != "off")
+		{
+			server.send(client, "error usage: reproject <on|off>");
+			return;
+		}
+		reprojectFrames = mode == "on";
+		server.send(client, "ok");
+	}
+	else if (command == "cancel")
+	{
+		cancelJobs();
+		server.send(client, "ok");
+	}
+	else if (command == "stats")
+	{
+		const SceneSnapshot *snapshot = sceneStore.latest();
+		server.send(client, "ok version " + ofToString(snapshot ? int(snapshot->version) : 0) +
+			" geometry " + ofToString(snapshot ? int(snapshot->geometryVersion) : 0) +
+			" jobs " + ofToString(int(scheduler.activeJobs().size())) +
+			" clients " + ofToString(server.numClients()) +
+			" shadowmaps " + ofToString(int(shadowMapCache.builds)) + "/" + ofToString(int(shadowMapCache.reuses)) +
+			" textures " + ofToString(textureCache.numTextures()));
+	}
+	else if (command == "shutdown")
+	{
+		server.send(client, "ok");
+		ofExit();
+	}
+	else
+		server.send(client, "error unknown command: " + command);
+}
+
+//Interactive preview through previewCam, which follows the main camera. Each
+//frame is sized to the time budget while the view changes, then the full
+//quality image is refined over the following frames.
+void ofApp::updatePreview() {
+	previewCam.setPosition(mainCam.getGlobalPosition());
+	previewCam.setOrientation(mainCam.getGlobalOrientation());
+	preview.targetMs = previewBudget;
+	preview.setQuality(guiSettings());
+	uint64_t signature = viewSignature();
+	if (signature != lastViewSignature)
+		preview.viewChanged();
+	else
+		preview.viewStill();
+	lastViewSignature = signature;
+	uint64_t start = ofGetElapsedTimeMicros();
+	if (preview.stage == PreviewController::INTERACTIVE)
+	{
+		RenderSettings settings = preview.plan(ofGetWindowWidth(), ofGetWindowHeight());
+		renderCam.setFromCamera(previewCam, float(settings.width) / settings.height);
+		if (!beginRender(previewTarget, settings, renderCam, &previewReprojection))
+			return;
+		renderRows(previewTarget, previewTarget.rowEnd);
+		finishRender(previewTarget, denoiser, 0);
+		previewTarget.toImage(previewImage);
+		//Drop any unfinished refinement and the scene version it pinned
+		refineTarget.nextRow = refineTarget.rowEnd = 0;
+		refineTarget.snapshot.release();
+		preview.report((ofGetElapsedTimeMicros() - start) / 1000.0, settings, float(settings.width) * settings.height - previewTarget.reusedPixels);
+	}
+	else if (preview.stage == PreviewController::REFINING)
+	{
+		//Full quality at window size, a few rows at a time until the budget is spent
+		if (refineTarget.rowEnd == 0)
+		{
+			RenderSettings settings = preview.full;
+			settings.width = ofGetWindowWidth();
+			settings.height = ofGetWindowHeight();
+			settings.crop = glm::vec4(0, 0, 1, 1);
+			settings.verbose = false;
+			renderCam.setFromCamera(previewCam, float(settings.width) / settings.height);
+			//Try again next frame
+			if (!beginRender(refineTarget, settings, renderCam))
+			{
+				refineTarget.rowEnd = 0;
+				return;
+			}
+		}
+		int firstRow = refineTarget.nextRow;
+		while (!refineTarget.done() && (ofGetElapsedTimeMicros() - start) / 1000.0 < preview.targetMs)
+			renderRows(refineTarget, refineTarget.nextRow + 4);
+		preview.report((ofGetElapsedTimeMicros() - start) / 1000.0, refineTarget.settings,
+			float(refineTarget.nextRow - firstRow) * refineTarget.settings.width);
+		if (refineTarget.done())
+		{
+			finishRender(refineTarget, denoiser, 0);
+			refineTarget.toImage(previewImage);
+			preview.refineComplete();
+		}
+	}
+}
+
+//Cheap signature of everything the preview depends on: camera, scene version and quality controls
+uint64_t ofApp::viewSignature() {
+	uint64_t hash = 1469598103934665603ULL;
+	auto mix = [&hash](float f) {
+		uint32_t bits;
+		memcpy(&bits, &f, 4);
+		hash = (hash ^ bits) * 1099511628211ULL;
+	};
+	glm::vec3 p = mainCam.getGlobalPosition(), d = mainCam.getLookAtDir(), up = mainCam.getUpDir();
+	mix(p.x); mix(p.y); mix(p.z); mix(d.x); mix(d.y); mix(d.z); mix(up.x); mix(up.y); mix(up.z);
+	mix(ofGetWindowWidth()); mix(ofGetWindowHeight());
+	//Any scene or shading edit publishes a new scene version
+	mix(sceneStore.latest()->version);
+	mix(softShadows); mix(shadowSamples); mix(pixelSamples); mix(denoise);
+	mix(shadowMaps); mix(shadowMapSize); mix(shadowBias); mix(wavefront);
+	mix(indirectLight); mix(irradianceAccuracy); mix(environmentSamples); mix(environmentImportance); mix(beautyFormat);
+	return hash;
+}
+
+//Publish a new scene snapshot if anything the renderer reads has changed.
+//Objects edited since the last version are cloned, the rest are shared with it.
+void ofApp::publishScene() {
+	const SceneSnapshot *previous = sceneStore.latest();
+	ofColor background = ofGetBackgroundColor();
+	if (previous && !sceneChanged && dirtyObjects.empty() &&
+		previous->phong == toggleShading && previous->power == power && previous->spotSize == spotSize &&
+		previous->samplerType == samplerType && previous->background == background &&
+		previous->environment == environmentMap && previous->environmentIntensity == environmentIntensity)
+		return;
+	SceneSnapshot *next = new SceneSnapshot();
+	next->version = previous ? previous->version + 1 : 1;
+	//Lights do not occlude, so light only edits keep the geometry version
+	bool geometryChanged = !previous || sceneChanged;
+	for (auto it = dirtyObjects.begin(); it != dirtyObjects.end() && !geometryChanged; it++)
+		geometryChanged = find(pointLights.begin(), pointLights.end(), *it) == pointLights.end() &&
+			find(spotLights.begin(), spotLights.end(), *it) == spotLights.end();
+	next->geometryVersion = geometryChanged ? next->version : previous->geometryVersion;
+	for (int a = 0; a < scene.size(); a++)
+	{
+		shared_ptr<SceneObject> copy;
+		if (previous && !dirtyObjects.count(scene[a]))
+		{
+			auto found = previous->copies.find(scene[a]);
+			if (found != previous->copies.end())
+				copy = found->second;
+		}
+		if (!copy)
+			copy = shared_ptr<SceneObject>(scene[a]->clone());
+		next->copies[scene[a]] = copy;
+		next->scene.push_back(copy.get());
+	}
+	//Copies have the same type as the editor objects
+	for (int i = 0; i < pointLights.size(); i++)
+		next->pointLights.push_back(static_cast<PointLight *>(next->copies[pointLights[i]].get()));
+	for (int i = 0; i < spotLights.size(); i++)
+		next->spotLights.push_back(static_cast<SpotLight *>(next->copies[spotLights[i]].get()));
+	next->phong = toggleShading;
+	next->power = power;
+	next->spotSize = spotSize;
+	next->samplerType = samplerType;
+	next->background = background;
+	next->environment = environmentMap;
+	next->environmentIntensity = environmentIntensity;
+	for (int a = 0; a < next->scene.size(); a++)
+	{
+		glm::vec3 min, max;
+		if (next->scene[a]->getBounds(min, max))
+		{
+			next->bounded.push_back(next->scene[a]);
+			next->boundsMin.push_back(min);
+			next->boundsMax.push_back(max);
+		}
+		else
+			next->unbounded.push_back(next->scene[a]);
+	}
+	sceneStore.publish(next);
+	dirtyObjects.clear();
+	sceneChanged = false;
+}
+
+//Find the closest scene object along a ray
+bool ofApp::closestHit(const RenderContext &ctx, const Ray &ray, glm::vec3 &point, glm::vec3 &normal, SceneObject *&object) {
+	return closestHit(ray, ctx.scene->scene, point, normal, object);
+}
+
+//Find the closest of the given objects along a ray
+bool ofApp::closestHit(const Ray &ray, const vector<SceneObject *> &objects, glm::vec3 &point, glm::vec3 &normal, SceneObject *&object) {
+	float currentDist, closestDist = std::numeric_limits<float>::infinity();
+	glm::vec3 intersectPoint, intersectNormal;
+	object = NULL;
+	//Iterate through each scene object
+	for (int a = 0; a < objects.size(); a++)
+	{
+		//Check if ray intersected with scene object
+		if (objects[a]->intersect(ray, intersectPoint, intersectNormal))
+		{
+			currentDist = glm::length(intersectPoint - ray.p);
+			//If closest object assign values to variables
+			if (currentDist < closestDist)
+			{
+				point = intersectPoint;
+				normal = intersectNormal;
+				closestDist = currentDist;
+				object = objects[a];
+			}
+		}
+	}
+	return object != NULL;
+}
+
+//Build a candidate object list for each screen tile by culling object bounds
+//against the frustum from the camera through the tile's ViewPlane corners.
+//Unbounded objects go in every list.
+void ofApp::buildTileLists(const SceneSnapshot &snapshot, RenderCam &camera, int width, int height, int tileSize, vector<vector<SceneObject *>> &lists, bool verbose) {
+	uint64_t start = ofGetElapsedTimeMicros();
+	int tilesX = (width + tileSize - 1) / tileSize;
+	int tilesY = (height + tileSize - 1) / tileSize;
+	const vector<SceneObject *> &bounded = snapshot.bounded;
+	const vector<glm::vec3> &mins = snapshot.boundsMin, &maxs = snapshot.boundsMax;
+	lists.assign(tilesX * tilesY, snapshot.unbounded);
+	long total = 0;
+	for (int ty = 0; ty < tilesY; ty++)
+	{
+		for (int tx = 0; tx < tilesX; tx++)
+		{
+			float u0 = float(tx * tileSize) / width, u1 = float(min((tx + 1) * tileSize, width)) / width;
+			float v0 = float(ty * tileSize) / height, v1 = float(min((ty + 1) * tileSize, height)) / height;
+			glm::vec3 corners[4] = { camera.view.toWorld(u0, v0), camera.view.toWorld(u1, v0),
+				camera.view.toWorld(u1, v1), camera.view.toWorld(u0, v1) };
+			Frustum frustum(camera.position, corners);
+			vector<SceneObject *> &list = lists[ty * tilesX + tx];
+			for (int a = 0; a < bounded.size(); a++)
+				if (frustum.intersectsBox(mins[a], maxs[a]))
+					list.push_back(bounded[a]);
+			total += list.size();
+		}
+	}
+	if (verbose)
+		cout << "Tile culling: " << tilesX * tilesY << " tiles, " << float(total) / (tilesX * tilesY)
+		<< " of " << snapshot.scene.size() << " objects per tile, " << (ofGetElapsedTimeMicros() - start) / 1000.0 << " ms" << endl;
+}
+
+//Diffuse color at a hit, from the object's texture if it has one. The texture
+//level is picked from the pixel's footprint on the surface.
+ofColor ofApp::surfaceColor(const RenderContext &ctx, SceneObject *object, const glm::vec3 &p, const glm::vec3 &n, const Ray &ray, float pixelAngle) {
+	glm::vec2 uv;
+	float uvScale;
+	if (object->texture < 0 || !ctx.textures || !object->getUV(p, uv, uvScale))
+		return object->diffuseColor;
+	//Pixel width on the surface, stretched at grazing angles
+	float cosine = max(0.2f, fabs(glm::dot(normalize(n), ray.d)));
+	float footprint = glm::length(p - ray.p) * pixelAngle / cosine / uvScale;
+	glm::vec3 c = ctx.textures->sample(object->texture, uv, footprint);
+	return ofColor(c.x * 255, c.y * 255, c.z * 255);
 }
 
 //Lambert shading function
-ofColor ofApp::lambert(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse) {
+ofColor ofApp::lambert(const RenderContext &ctx, const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse) {
+	const vector<PointLight *> &pointLights = ctx.scene->pointLights;
+	const vector<SpotLight *> &spotLights = ctx.scene->spotLights;
 	//Set ambient 
-	ofColor color = diffuse * 0.25;
+	ofColor color = ambient(ctx, p, norm, diffuse) + environment(ctx, p, norm, diffuse);
 	//Point light shading
 	for (int i = 0; i < pointLights.size(); i++)
 	{
@@ -112,14 +857,14 @@ ofColor ofApp::lambert(const glm::vec3 &p, const glm::vec3 &norm, const ofColor
 		float lightSource = (intensity / (radius * radius));
 		glm::vec3 l = normalize(pointLights[i]->position - p);
 		glm::vec3 n = normalize(norm);
-		Ray shadowRay = Ray(p + (n * 0.1), l);
+		float visibility = lightVisibility(ctx, p, n, pointLights[i]);
 		//Accumulate color
-		if (insideShadow(shadowRay))
+		if (visibility == 0)
 		{
 			//Ambient shading
 		}
 		else
-			color += diffuse * lightSource * max(float(0), dot(n, l));
+			color += diffuse * lightSource * max(float(0), dot(n, l)) * visibility;
 	}
 	//Spot light shading
 	for (int i = 0; i < spotLights.size(); i++)
@@ -130,28 +875,125 @@ ofColor ofApp::lambert(const glm::vec3 &p, const glm::vec3 &norm, const ofColor
 		float lightSource = (intensity / (radius * radius));
 		glm::vec3 l = normalize(spotLights[i]->position - p);
 		glm::vec3 n = normalize(norm);
-		Ray shadowRay = Ray(p + (n * 0.1), l);
 		//Calculate spot light direction
 		glm::vec3 dir = normalize(spotLights[i]->position - spotLights[i]->aim);
 		float angle = glm::dot(l, dir);
-		angle = glm::acos(angle);
+		angle = fastAcos(angle);
 		//Accumulate color
-		if (insideShadow(shadowRay))
+		if (angle >= ctx.scene->spotSize)
 		{
 			//Ambient shading
 		}
-		else if (angle < spotSize)
+		else
 		{
-			color += diffuse * lightSource * max(float(0), dot(n, l));
+			float visibility = lightVisibility(ctx, p, n, spotLights[i]);
+			color += diffuse * lightSource * max(float(0), dot(n, l)) * visibility;
 		}
 	}
 	return color;
 }
 
+//Indirect light reaching a diffuse surface: the flat ambient term, or one
+//bounce of interreflection interpolated from the irradiance cache
+ofColor ofApp::ambient(const RenderContext &ctx, const glm::vec3 &p, const glm::vec3 &norm, const ofColor &diffuse) {
+	if (ctx.bounce)
+		return ofColor::black;
+	if (!ctx.irradiance)
+		return diffuse * 0.25;
+	glm::vec3 n = normalize(norm);
+	glm::vec3 e;
+	if (!ctx.irradiance->interpolate(p, n, e))
+	{
+		//Hemisphere samples see direct light only, with hard shadows
+		RenderSettings bounceSettings = *ctx.settings;
+		bounceSettings.softShadows = false;
+		RenderContext bounce = ctx;
+		bounce.settings = &bounceSettings;
+		bounce.bounce = true;
+		float angle = 2 * PI / ctx.irradiance->settings.phiSamples;
+		IrradianceCache::RadianceCast cast = [this, &bounce, angle](const glm::vec3 &origin, const glm::vec3 &dir, float &distance) {
+			glm::vec3 point, normal;
+			SceneObject *object;
+			Ray ray(origin, dir);
+			if (!closestHit(bounce, ray, point, normal, object))
+			{
+				//An environment map is sampled as a light already
+				distance = std::numeric_limits<float>::infinity();
+				ofColor background = bounce.scene->environment ? ofColor::black : bounce.scene->background;
+				return glm::vec3(background.r, background.g, background.b) / 255.0f;
+			}
+			distance = glm::length(point - origin);
+			//Light leaving the side the ray came from
+			if (glm::dot(normal, dir) > 0)
+				normal = -normal;
+			ofColor color = lambert(bounce, point, normal, surfaceColor(bounce, object, point, normal, ray, angle));
+			return glm::vec3(color.r, color.g, color.b) / 255.0f;
+		};
+		e = ctx.irradiance->compute(p, n, ctx.pixelAngle * glm::length(p - ctx.eye), cast);
+	}
+	return ofColor(min(255.0f, diffuse.r * e.x), min(255.0f, diffuse.g * e.y), min(255.0f, diffuse.b * e.z));
+}
+
+//Diffuse light from the environment map, the direct light of the sky
+ofColor ofApp::environment(const RenderContext &ctx, const glm::vec3 &p, const glm::vec3 &norm, const ofColor &diffuse) {
+	if (!ctx.scene->environment)
+		return ofColor::black;
+	//Hemisphere samples for the irradiance cache are averaged already, one ray is enough there
+	int rays;
+	int samples = ctx.bounce ? 1 : ctx.settings->environmentSamples;
+	glm::vec3 e = environmentLight(ctx, p, normalize(norm), samples, ctx.settings->environmentImportance, rays);
+	return ofColor(min(255.0f, diffuse.r * e.x), min(255.0f, diffuse.g * e.y), min(255.0f, diffuse.b * e.z));
+}
+
+//Monte Carlo estimate of environment irradiance / pi at p, one shadow ray per
+//sample above the surface. Directions come from the map's alias tables or
+//uniformly from the hemisphere; rays is set to the shadow rays traced.
+//Always stratified: the alias tables reuse the low digits of each coordinate,
+//which a short Halton sequence leaves almost the same for every sample.
+glm::vec3 ofApp::environmentLight(const RenderContext &ctx, const glm::vec3 &p, const glm::vec3 &n, int samples, bool importance, int &rays) {
+	const EnvironmentMap &map = *ctx.scene->environment;
+	glm::vec3 u, v;
+	orthonormalBasis(n, u, v);
+	Sampler sampler(SAMPLER_STRATIFIED, samples, hashPoint(p) ^ 0x9e3779b9);
+	glm::vec3 sum(0);
+	rays = 0;
+	for (int s = 0; s < samples; s++)
+	{
+		glm::vec2 uv = sampler.get(s);
+		glm::vec3 dir;
+		float pdf;
+		if (importance)
+			dir = map.sample(uv, pdf);
+		else
+		{
+			float cosTheta = uv.y, sinTheta = sqrt(max(0.0f, 1 - cosTheta * cosTheta)), phi = 2 * PI * uv.x;
+			dir = (u * cos(phi) + v * sin(phi)) * sinTheta + n * cosTheta;
+			pdf = 1 / (2 * PI);
+		}
+		float cosine = glm::dot(n, dir);
+		if (cosine <= 0 || pdf <= 0)
+			continue;
+		rays++;
+		if (!insideShadow(ctx, Ray(p + (n * 0.1), dir)))
+			sum += map.lookup(dir) * (cosine / (PI * pdf));
+	}
+	return sum * (ctx.scene->environmentIntensity / samples);
+}
+
+//Color of a ray that leaves the scene
+ofColor ofApp::missColor(const RenderContext &ctx, const glm::vec3 &dir) {
+	if (!ctx.scene->environment)
+		return ctx.scene->background;
+	glm::vec3 c = ctx.scene->environment->lookup(normalize(dir)) * (ctx.scene->environmentIntensity * 255);
+	return ofColor(min(255.0f, c.x), min(255.0f, c.y), min(255.0f, c.z));
+}
+
 //Phong shading function
-ofColor ofApp::phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse, const ofColor specular, float power) {
+ofColor ofApp::phong(const RenderContext &ctx, const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse, const ofColor specular, float power) {
+	const vector<PointLight *> &pointLights = ctx.scene->pointLights;
+	const vector<SpotLight *> &spotLights = ctx.scene->spotLights;
 	//Set ambient 
-	ofColor color = diffuse * 0.25;
+	ofColor color = ambient(ctx, p, norm, diffuse) + environment(ctx, p, norm, diffuse);
 	//Point light shading
 	for (int i = 0; i < pointLights.size(); i++)
 	{
@@ -161,19 +1003,19 @@ ofColor ofApp::phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor di
 		float lightSource = (intensity / (radius * radius));
 		glm::vec3 n = normalize(norm);
 		glm::vec3 l = normalize(pointLights[i]->position - p);
-		glm::vec3 v = normalize(renderCam.position - p);
+		glm::vec3 v = normalize(ctx.eye - p);
 		glm::vec3 h = normalize(v + l);
-		Ray shadowRay = Ray(p + (n * 0.1), l);
+		float visibility = lightVisibility(ctx, p, n, pointLights[i]);
 		//Accumulate color
-		if (insideShadow(shadowRay))
+		if (visibility == 0)
 		{
 			//Ambient shading
 		}
 		else
 		{
-			color += diffuse * lightSource * max(float(0), dot(n, l))
+			color += (diffuse * lightSource * max(float(0), dot(n, l))
 				+ specular * lightSource
-				* pow(max(float(0), dot(n, h)), power);
+				* pow(max(float(0), dot(n, h)), power)) * visibility;
 		}
 	}
 	//Spot light shading
@@ -185,31 +1027,32 @@ ofColor ofApp::phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor di
 		float lightSource = (intensity / (radius * radius));
 		glm::vec3 n = normalize(norm);
 		glm::vec3 l = normalize(spotLights[i]->position - p);
-		glm::vec3 v = normalize(renderCam.position - p);
+		glm::vec3 v = normalize(ctx.eye - p);
 		glm::vec3 h = normalize(v + l);
-		Ray shadowRay = Ray(p + (n * 0.1), l);
 		//Calculate spot light direction
 		glm::vec3 dir = normalize(spotLights[i]->position - spotLights[i]->aim);
 		float angle = glm::dot(l, dir);
-		angle = glm::acos(angle);
+		angle = fastAcos(angle);
 		//Accumulate color
-		if (insideShadow(shadowRay))
+		if (angle >= ctx.scene->spotSize)
 		{
 			//Ambient shading
 		}
-		else if (angle < spotSize)
+		else
 		{
-			color += diffuse * lightSource * max(float(0), dot(n, l))
+			float visibility = lightVisibility(ctx, p, n, spotLights[i]);
+			color += (diffuse * lightSource * max(float(0), dot(n, l))
 				+ specular * lightSource
-				* pow(max(float(0), dot(n, h)), power);
+				* pow(max(float(0), dot(n, h)), power)) * visibility;
 		}
 	}
 	return color;
 }
 
 //Check if inside shadow function
-bool ofApp::insideShadow(const Ray shadowRay) {
+bool ofApp::insideShadow(const RenderContext &ctx, const Ray shadowRay) {
 	glm::vec3 intersectPoint, normal;
+	const vector<SceneObject *> &scene = ctx.scene->scene;
 	for (int i = 0; i < scene.size(); i++)
 	{
 		if (scene[i]->intersect(shadowRay, intersectPoint, normal))
@@ -220,17 +1063,391 @@ bool ofApp::insideShadow(const Ray shadowRay) {
 	return false;
 }
 
+//Check if inside shadow, only counting occluders closer than maxDist
+bool ofApp::insideShadow(const RenderContext &ctx, const Ray shadowRay, float maxDist) {
+	glm::vec3 intersectPoint, normal;
+	const vector<SceneObject *> &scene = ctx.scene->scene;
+	for (int i = 0; i < scene.size(); i++)
+	{
+		if (scene[i]->intersect(shadowRay, intersectPoint, normal) &&
+			glm::length(intersectPoint - shadowRay.p) < maxDist)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+//Fraction of a light visible from p. Hard shadows use a single ray to the light
+//center, soft shadows treat the light as an area light and sample it adaptively.
+float ofApp::lightVisibility(const RenderContext &ctx, const glm::vec3 &p, const glm::vec3 &norm, SceneObject *light) {
+	glm::vec3 n = normalize(norm);
+	//Shadow map mode looks the light up instead of tracing
+	if (ctx.shadowMaps)
+	{
+		const ShadowMap *map = ctx.shadowMaps->find(light);
+		if (map)
+			return map->visibility(p + (n * 0.1), ctx.settings->shadowBias);
+	}
+	if (!ctx.settings->softShadows)
+	{
+		Ray shadowRay = Ray(p + (n * 0.1), normalize(light->position - p));
+		return insideShadow(ctx, shadowRay) ? 0 : 1;
+	}
+	int raysUsed;
+	return estimateVisibility(ctx, p, n, light, ctx.scene->samplerType, ctx.settings->shadowSamples, 4, raysUsed);
+}
+
+//Estimate light visibility with up to "samples" shadow rays. The first "firstPass"
+//samples decide whether p is in a penumbra; if they all agree p is fully lit or
+//fully shadowed and we stop early.
+float ofApp::estimateVisibility(const RenderContext &ctx, const glm::vec3 &p, const glm::vec3 &n, SceneObject *light, SamplerType type, int samples, int firstPass, int &raysUsed) {
+	glm::vec3 origin = p + (n * 0.1);
+	Sampler sampler(type, samples, hashPoint(p));
+	int visible = 0;
+	firstPass = min(firstPass, samples);
+	for (raysUsed = 0; raysUsed < samples; raysUsed++)
+	{
+		//Stop if not in a penumbra
+		if (raysUsed == firstPass && (visible == 0 || visible == firstPass))
+			break;
+		glm::vec3 target = light->sampleLight(p, sampler.get(raysUsed));
+		glm::vec3 toLight = target - origin;
+		float dist = glm::length(toLight);
+		if (!insideShadow(ctx, Ray(origin, toLight / dist), dist))
+			visible++;
+	}
+	return float(visible) / raysUsed;
+}
+
+//Measure shadow noise vs time for each sampler. Shading points come from a
+//quarter resolution primary pass; the reference is a 1024 sample stratified estimate.
+//Results are printed and written to shadow_convergence.csv.
+void ofApp::shadowConvergenceTest() {
+	vector<glm::vec3> points, normals;
+	publishScene();
+	RCUPointer<SceneSnapshot>::ReadGuard snapshot = sceneStore.read();
+	RenderSettings settings = guiSettings();
+	RenderContext ctx = { snapshot.get(), &settings, renderCam.position };
+	vector<SceneObject *> lights;
+	lights.insert(lights.end(), snapshot->pointLights.begin(), snapshot->pointLights.end());
+	lights.insert(lights.end(), snapshot->spotLights.begin(), snapshot->spotLights.end());
+	int w = imageWidth / 4;
+	int h = imageHeight / 4;
+	for (int j = 0; j < h; j++)
+	{
+		for (int i = 0; i < w; i++)
+		{
+			glm::vec3 point, normal;
+			SceneObject *object;
+			if (closestHit(ctx, renderCam.getRay((i + 0.5) / w, (j + 0.5) / h), point, normal, object))
+			{
+				points.push_back(point);
+				normals.push_back(normalize(normal));
+			}
+		}
+	}
+	if (points.empty() || lights.empty())
+	{
+		cout << "Shadow test: nothing to measure" << endl;
+		return;
+	}
+	cout << "Shadow test: " << points.size() << " points, " << lights.size() << " lights" << endl;
+	//Reference estimate
+	int rays;
+	vector<float> reference;
+	for (int k = 0; k < points.size(); k++)
+		for (int l = 0; l < lights.size(); l++)
+			reference.push_back(estimateVisibility(ctx, points[k], normals[k], lights[l], SAMPLER_STRATIFIED, 1024, 1024, rays));
+	ofstream csv(ofToDataPath("shadow_convergence.csv"));
+	csv << "sampler,adaptive,samples,rays,ms,rmse" << endl;
+	const int counts[] = { 1, 4, 16, 64, 256 };
+	for (int adaptive = 0; adaptive < 2; adaptive++)
+	{
+		for (int t = 0; t < SAMPLER_COUNT; t++)
+		{
+			for (int c = 0; c < 5; c++)
+			{
+				int samples = counts[c];
+				long totalRays = 0;
+				double error = 0;
+				uint64_t start = ofGetElapsedTimeMicros();
+				for (int k = 0; k < points.size(); k++)
+				{
+					for (int l = 0; l < lights.size(); l++)
+					{
+						float vis = estimateVisibility(ctx, points[k], normals[k], lights[l], SamplerType(t), samples, adaptive ? 4 : samples, rays);
+						float diff = vis - reference[k * lights.size() + l];
+						error += diff * diff;
+						totalRays += rays;
+					}
+				}
+				float ms = (ofGetElapsedTimeMicros() - start) / 1000.0;
+				float rmse = sqrt(error / reference.size());
+				cout << samplerName(SamplerType(t)) << (adaptive ? " (adaptive)" : "") << " " << samples << " spp: "
+					<< totalRays << " rays, " << ms << " ms, rmse " << rmse << endl;
+				csv << samplerName(SamplerType(t)) << "," << adaptive << "," << samples << "," << totalRays << "," << ms << "," << rmse << endl;
+			}
+		}
+	}
+	cout << "Shadow test written to shadow_convergence.csv" << endl << endl;
+}
+
+//Measure environment light noise vs rays for alias table importance sampling
+//and uniform hemisphere sampling. Shading points come from a quarter resolution
+//primary pass; the reference is a 4096 sample importance sampled estimate.
+//Results are printed and written to environment_convergence.csv.
+void ofApp::environmentConvergenceTest() {
+	vector<glm::vec3> points, normals;
+	publishScene();
+	RCUPointer<SceneSnapshot>::ReadGuard snapshot = sceneStore.read();
+	RenderSettings settings = guiSettings();
+	RenderContext ctx = { snapshot.get(), &settings, renderCam.position };
+	int w = imageWidth / 4;
+	int h = imageHeight / 4;
+	for (int j = 0; j < h && snapshot->environment; j++)
+	{
+		for (int i = 0; i < w; i++)
+		{
+			glm::vec3 point, normal;
+			SceneObject *object;
+			if (closestHit(ctx, renderCam.getRay((i + 0.5) / w, (j + 0.5) / h), point, normal, object))
+			{
+				points.push_back(point);
+				normals.push_back(normalize(normal));
+			}
+		}
+	}
+	if (points.empty())
+	{
+		cout << "Environment test: needs an environment map and visible objects" << endl;
+		return;
+	}
+	cout << "Environment test: " << points.size() << " points" << endl;
+	int rays;
+	vector<glm::vec3> reference;
+	for (int k = 0; k < points.size(); k++)
+		reference.push_back(environmentLight(ctx, points[k], normals[k], 4096, true, rays));
+	ofstream csv(ofToDataPath("environment_convergence.csv"));
+	csv << "sampling,samples,rays,ms,rmse" << endl;
+	const int counts[] = { 1, 4, 16, 64, 256 };
+	float rmses[2][5];
+	for (int importance = 0; importance < 2; importance++)
+	{
+		for (int c = 0; c < 5; c++)
+		{
+			long totalRays = 0;
+			double error = 0;
+			uint64_t start = ofGetElapsedTimeMicros();
+			for (int k = 0; k < points.size(); k++)
+			{
+				glm::vec3 diff = environmentLight(ctx, points[k], normals[k], counts[c], importance, rays) - reference[k];
+				error += glm::dot(diff, diff) / 3;
+				totalRays += rays;
+			}
+			float ms = (ofGetElapsedTimeMicros() - start) / 1000.0;
+			rmses[importance][c] = sqrt(error / points.size());
+			const char *name = importance ? "importance" : "uniform";
+			cout << name << " " << counts[c] << " spp: " << totalRays << " rays, " << ms << " ms, rmse " << rmses[importance][c] << endl;
+			csv << name << "," << counts[c] << "," << totalRays << "," << ms << "," << rmses[importance][c] << endl;
+		}
+	}
+	//Error falls as 1 / sqrt(samples), so uniform sampling needs (ratio of errors)^2 times the samples
+	for (int c = 0; c < 5; c++)
+		if (rmses[1][c] > 0)
+			cout << counts[c] << " spp: uniform sampling needs " << ofToString(pow(rmses[0][c] / rmses[1][c], 2), 1) <<
+				"x the rays for the same error" << endl;
+	cout << "Environment test written to environment_convergence.csv" << endl << endl;
+}
+
+//Use an HDR latitude / longitude image as background and light
+void ofApp::loadEnvironment(const string &path) {
+	shared_ptr<EnvironmentMap> map = make_shared<EnvironmentMap>();
+	if (!map->load(path))
+	{
+		cout << "Could not load environment " << path << endl;
+		return;
+	}
+	environmentMap = map;
+	cout << "Environment " << path << ": " << map->width << "x" << map->height << ", alias tables built in " << map->buildMs << " ms" << endl;
+}
+
+//Compare shadow map lookups against shadow rays, hard shadows from the light
+//centers at quarter resolution shading points, for a range of map sizes.
+//Results are printed and written to shadow_maps.csv.
+void ofApp::shadowMapTest() {
+	vector<glm::vec3> points, normals;
+	publishScene();
+	RCUPointer<SceneSnapshot>::ReadGuard snapshot = sceneStore.read();
+	RenderSettings settings = guiSettings();
+	settings.softShadows = false;
+	settings.verbose = false;
+	RenderContext ctx = { snapshot.get(), &settings, renderCam.position };
+	vector<SceneObject *> lights;
+	lights.insert(lights.end(), snapshot->pointLights.begin(), snapshot->pointLights.end());
+	lights.insert(lights.end(), snapshot->spotLights.begin(), snapshot->spotLights.end());
+	int w = imageWidth / 4;
+	int h = imageHeight / 4;
+	for (int j = 0; j < h; j++)
+	{
+		for (int i = 0; i < w; i++)
+		{
+			glm::vec3 point, normal;
+			SceneObject *object;
+			if (closestHit(ctx, renderCam.getRay((i + 0.5) / w, (j + 0.5) / h), point, normal, object))
+			{
+				points.push_back(point);
+				normals.push_back(normalize(normal));
+			}
+		}
+	}
+	if (points.empty() || lights.empty())
+	{
+		cout << "Shadow map test: nothing to measure" << endl;
+		return;
+	}
+	//Ray traced reference
+	vector<float> reference;
+	uint64_t start = ofGetElapsedTimeMicros();
+	for (int k = 0; k < points.size(); k++)
+		for (int l = 0; l < lights.size(); l++)
+			reference.push_back(lightVisibility(ctx, points[k], normals[k], lights[l]));
+	float rayMs = (ofGetElapsedTimeMicros() - start) / 1000.0;
+	cout << "Shadow map test: " << points.size() << " points, " << lights.size() << " lights, rays " << rayMs << " ms" << endl;
+	ofstream csv(ofToDataPath("shadow_maps.csv"));
+	csv << "size,build_ms,lookup_ms,ray_ms,rmse,mismatch" << endl;
+	const int sizes[] = { 128, 256, 512, 1024, 2048 };
+	for (int c = 0; c < 5; c++)
+	{
+		settings.shadowMapSize = sizes[c];
+		shared_ptr<const ShadowMapSet> maps = buildShadowMaps(*snapshot, settings);
+		float buildMs = shadowMapCache.buildMs;
+		ctx.shadowMaps = maps.get();
+		double error = 0;
+		long mismatch = 0;
+		start = ofGetElapsedTimeMicros();
+		for (int k = 0; k < points.size(); k++)
+		{
+			for (int l = 0; l < lights.size(); l++)
+			{
+				float diff = lightVisibility(ctx, points[k], normals[k], lights[l]) - reference[k * lights.size() + l];
+				error += diff * diff;
+				if (fabs(diff) > 0.5) mismatch++;
+			}
+		}
+		float lookupMs = (ofGetElapsedTimeMicros() - start) / 1000.0;
+		float rmse = sqrt(error / reference.size());
+		cout << "Shadow map " << sizes[c] << ": build " << buildMs << " ms, lookups " << lookupMs << " ms, rmse " << rmse
+			<< ", " << 100.0 * mismatch / reference.size() << "% flipped" << endl;
+		csv << sizes[c] << "," << buildMs << "," << lookupMs << "," << rayMs << "," << rmse << "," << float(mismatch) / reference.size() << endl;
+	}
+	cout << "Shadow map test written to shadow_maps.csv" << endl << endl;
+}
+
+//Fill the scene for the viewport benchmark and let frames run unthrottled
+void ofApp::startViewportBenchmark()
+{
+	ofSeedRandom(1);
+	for (int k = 0; k < viewportBenchObjects; k++)
+	{
+		glm::vec3 p(ofRandom(-30, 30), ofRandom(-1, 10), ofRandom(-30, 30));
+		if (k % 20 == 19)
+			scene.push_back(new Plane(p, glm::vec3(0, 1, 0), 2, 2, ofColor::darkSlateGray));
+		else
+			scene.push_back(new Sphere(p, ofRandom(0.1, 0.6), ofColor(ofRandom(64, 255), ofRandom(64, 255), ofRandom(64, 255))));
+	}
+	sceneChanged = true;
+	ofSetVerticalSync(false);
+	ofSetFrameRate(0);
+	viewportBenchFrame = 0;
+}
+
+//Time frames while orbiting the scene, batched first and then per object, write
+//viewport_bench.csv and quit. ofGetLastFrameTime is the whole previous frame,
+//swap included, so on a software GL stack it covers the rasterization too.
+void ofApp::updateViewportBenchmark()
+{
+	const int warmup = 30, frames = 300;
+	int phase = viewportBenchFrame / (warmup + frames);
+	int frame = viewportBenchFrame % (warmup + frames);
+	if (phase == 0 && !viewport.isSupported())
+	{
+		cout << "Instanced viewport unavailable, timing per object drawing only" << endl;
+		viewportBenchFrame = warmup + frames;
+		phase = 1;
+		frame = 0;
+	}
+	//The previous frame belongs to the same phase unless this is a phase's first
+	if (phase < 2 && frame > warmup)
+		viewportBenchTimes[phase].push_back(ofGetLastFrameTime() * 1000);
+	if (phase == 2)
+	{
+		ofstream csv(ofToDataPath("viewport_bench.csv"));
+		csv << "mode,objects,frames,mean_ms,median_ms,p95_ms,fps,renderer" << endl;
+		const char *renderer = (const char *)glGetString(GL_RENDERER);
+		for (int m = 0; m < 2; m++)
+		{
+			vector<float> &times = viewportBenchTimes[m];
+			if (times.empty()) continue;
+			float sum = 0;
+			for (int k = 0; k < times.size(); k++)
+				sum += times[k];
+			sort(times.begin(), times.end());
+			float mean = sum / times.size();
+			string mode = m == 0 ? "batched" : "per_object";
+			csv << mode << "," << scene.size() << "," << times.size() << "," << mean << "," << times[times.size() / 2] << "," <<
+				times[times.size() * 95 / 100] << "," << 1000 / mean << "," << (renderer ? renderer : "unknown") << endl;
+			cout << "Viewport " << mode << ": " << scene.size() << " objects, " << mean << " ms mean, " << times[times.size() / 2] << " ms median" << endl;
+		}
+		cout << "Viewport benchmark written to viewport_bench.csv" << endl;
+		ofExit();
+		return;
+	}
+	batchedViewport = phase == 0 && viewport.isSupported();
+	mainCam.orbitDeg(360.0 * frame / (warmup + frames), -25, 60);
+	viewportBenchFrame++;
+}
+
 //--------------------------------------------------------------
 void ofApp::setup(){
-	//Set GUI
-	gui.setup();
+	//Set GUI, without a window there is no GL context for the panel
+	if (!daemonMode)
+		gui.setup();
 	gui.add(power.setup("Power", 100, 1, 100));
 	gui.add(pointIntensity.setup("Point Intensity", 1, 0.1, 5));
 	gui.add(spotIntensity.setup("Spot Intensity", 1, 0.1, 5));
 	gui.add(spotSize.setup("Spot Size ", 0.3, 0.1, 0.9));
 	gui.add(spotAim.setup("Spot Aim", glm::vec3(0, 0, 0), glm::vec3(-10, -10, -10), glm::vec3(10, 10, 10)));
+	gui.add(softShadows.setup("Soft Shadows", false));
+	gui.add(shadowSamples.setup("Shadow Samples", 16, 1, 64));
+	gui.add(pixelSamples.setup("Pixel Samples", 1, 1, 64));
+	gui.add(denoise.setup("Denoise", false));
+	gui.add(shadowMaps.setup("Shadow Maps", false));
+	gui.add(shadowMapSize.setup("Shadow Map Size", 512, 64, 2048));
+	gui.add(shadowBias.setup("Shadow Bias", 0.05, 0, 0.5));
+	gui.add(textureBudget.setup("Texture Budget MB", 512, 16, 4096));
+	gui.add(geometryBudget.setup("Geometry Budget MB", 256, 16, 4096));
+	gui.add(wavefront.setup("Wavefront", false));
+	gui.add(batchedViewport.setup("Batched Viewport", true));
+	gui.add(reprojectFrames.setup("Reprojection", false));
+	gui.add(indirectLight.setup("Indirect Light", false));
+	gui.add(irradianceAccuracy.setup("Irradiance Accuracy", 0.25, 0.05, 1));
+	gui.add(environmentIntensity.setup("Environment Intensity", 1, 0, 10));
+	gui.add(environmentSamples.setup("Environment Samples", 16, 1, 256));
+	gui.add(environmentImportance.setup("Environment Importance", true));
+	//0 fp32, 1 fp16, 2 sRGB8, 3 RGB9E5
+	gui.add(beautyFormat.setup("Beauty Format", FRAME_FLOAT32, 0, FRAME_FORMAT_COUNT - 1));
+	gui.add(frameBudget.setup("Frame Budget MB", 0, 0, 1024));
+	gui.add(previewBudget.setup("Preview Budget ms", 33, 5, 200));
+	gui.add(cropRegion.setup("Crop", glm::vec4(0, 0, 1, 1), glm::vec4(0, 0, 0, 0), glm::vec4(1, 1, 1, 1)));
+	gui.add(aovDepth.setup("AOV Depth", false));
+	gui.add(aovNormal.setup("AOV Normal", false));
+	gui.add(aovObjectId.setup("AOV Object ID", false));
+	gui.add(aovAlbedo.setup("AOV Albedo", false));
 	
 	//Allocate image
+	if (daemonMode)
+		image.setUseTexture(false);
 	image.allocate(imageWidth, imageHeight, ofImageType::OF_IMAGE_COLOR);
     //Set background
 	ofSetBackgroundColor(ofColor::black);
@@ -240,7 +1457,8 @@ void ofApp::setup(){
     sideCam.setPosition(15, 0, -1);
     sideCam.lookAt(glm::vec3(0, 0, 0));
 	previewCam.setPosition(renderCam.position);
-    previewCam.setFov(45);
+	previewCam.lookAt(renderCam.position + renderCam.aim, renderCam.up);
+    previewCam.setFov(renderCam.fov);
     //Initialize scene objects
     scene.push_back(new Sphere(glm::vec3(0, 0, 0), 1.5, ofColor::darkSeaGreen));
 	scene.push_back(new Plane(glm::vec3(0, -1.5, 0), glm::vec3(0, 1, 0), 20, 20, ofColor::darkSlateGray));
@@ -251,36 +1469,71 @@ void ofApp::setup(){
 	SpotLight* spotLight = new SpotLight(glm::vec3(-0.01, 6, 0), spotIntensity, ofColor::darkBlue);
 	spotLights.push_back(spotLight);
 	scene.push_back(spotLight);
+	//Start the render workers, one per core. A job finishing while others still
+	//run denoises on its own worker instead of starting more threads.
+	scheduler.start(max(1, (int)std::thread::hardware_concurrency()),
+		[this](RenderTarget &target, int x0, int x1, int y0, int y1) { renderRegion(target, x0, x1, y0, y1); },
+		[this](RenderTarget &target) {
+			Denoiser jobDenoiser;
+			finishRender(target, jobDenoiser, scheduler.activeJobs().empty() ? 0 : 1);
+		});
+	//Instanced viewport drawing, needs the GL 3.2 renderer main() asks for
+	if (!daemonMode && !viewport.setup())
+		cout << "Instanced viewport unavailable, drawing objects one by one" << endl;
+	if (viewportBenchObjects > 0)
+		startViewportBenchmark();
+	//Headless render daemon, driven through the socket only. Commands are applied
+	//in update, so run it often without spinning.
+	if (daemonMode)
+	{
+		ofSetFrameRate(500);
+		startServer();
+	}
 }
 
 //--------------------------------------------------------------
 void ofApp::update(){
+	if (viewportBenchObjects > 0)
+		updateViewportBenchmark();
+	updateLights();
+	textureCache.setBudget(size_t(int(textureBudget)) << 20);
+	for (int k = 0; k < scene.size(); k++)
+		if (SphereCloud *cloud = dynamic_cast<SphereCloud *>(scene[k]))
+			cloud->store->setBudget(size_t(int(geometryBudget)) << 20);
+	//Publish edits to the renderer
+	publishScene();
+	//Interactive preview render
+	if (previewMode)
+		updatePreview();
+	//Collect finished render jobs
+	updateJobs();
+	//Edits and renders from render server clients
+	updateServer();
+}
+
+//Apply the light sliders to the selected (or only) lights
+void ofApp::updateLights(){
 	//Update each point light
 	for (int i = 0; i < pointLights.size(); i++)
 	{
 		//Update point light intensity
-		if (pointLights.size() == 1) 
-		{
-			pointLights[0]->intensity = pointIntensity;
-		}
-		else if (objSelected() && pointLights[i] == selected[0])
+		if ((pointLights.size() == 1 || (objSelected() && pointLights[i] == selected[0])) &&
+			pointLights[i]->intensity != pointIntensity)
 		{
 			pointLights[i]->intensity = pointIntensity;
+			markDirty(pointLights[i]);
 		}
 	}
 	//Update each spot light
 	for (int i = 0; i < spotLights.size(); i++)
 	{
 		//Update spot light intensity and aim
-		if (spotLights.size() == 1)
-		{
-			spotLights[0]->intensity = spotIntensity;
-			spotLights[0]->aim = spotAim;
-		}
-		else if (objSelected() && spotLights[i] == selected[0])
+		if ((spotLights.size() == 1 || (objSelected() && spotLights[i] == selected[0])) &&
+			(spotLights[i]->intensity != spotIntensity || spotLights[i]->aim != glm::vec3(spotAim)))
 		{
 			spotLights[i]->intensity = spotIntensity;
 			spotLights[i]->aim = spotAim;
+			markDirty(spotLights[i]);
 		}
 	}
 }
@@ -289,12 +1542,20 @@ void ofApp::update(){
 void ofApp::draw(){
 	ofEnableDepthTest();
 	theCam->begin();
-	//Draw each scene object
-	for (int i = 0; i < scene.size(); i++) {
-		if (objSelected() && scene[i] == selected[0])
-			ofSetColor(ofColor::white);
-		else ofSetColor(scene[i]->diffuseColor);
-		scene[i]->draw();
+	//Draw the published scene one instanced call per shape, or each scene object
+	const SceneSnapshot *snapshot = sceneStore.latest();
+	if (batchedViewport && viewport.isSupported() && snapshot) {
+		int index = objSelected() ? find(scene.begin(), scene.end(), selected[0]) - scene.begin() : -1;
+		viewport.update(*snapshot, index);
+		viewport.draw(*theCam, ofGetViewportWidth(), ofGetViewportHeight());
+	}
+	else {
+		for (int i = 0; i < scene.size(); i++) {
+			if (objSelected() && scene[i] == selected[0])
+				ofSetColor(ofColor::white);
+			else ofSetColor(scene[i]->diffuseColor);
+			scene[i]->draw();
+		}
 	}
     //Draw view plane
 	renderCam.view.draw();
@@ -311,9 +1572,32 @@ void ofApp::draw(){
 		ofDrawBitmapString("Shading: Phong", ofGetWindowWidth() - 150, 45);
 	else
 		ofDrawBitmapString("Shading: Lambert", ofGetWindowWidth() - 150, 45);
+	//Inform shadow sampler
+	ofDrawBitmapString("Sampler: " + string(samplerName(samplerType)), ofGetWindowWidth() - 150, 65);
+	//Inform viewport draw cost
+	if (batchedViewport && viewport.isSupported())
+		ofDrawBitmapString(viewport.status() + ", " + ofToString(int(ofGetFrameRate())) + " fps", 10, ofGetWindowHeight() - 55);
+	else
+		ofDrawBitmapString("Viewport: " + ofToString((int)scene.size()) + " objects, " + ofToString(int(ofGetFrameRate())) + " fps", 10, ofGetWindowHeight() - 55);
 	//If rendering complete draw rendered image
 	if (renderFinish == true)
 		image.draw(0, 0);
+	//Draw preview scaled up to the window
+	if (previewMode && previewImage.isAllocated())
+	{
+		previewImage.draw(0, 0, ofGetWindowWidth(), ofGetWindowHeight());
+		string status = preview.status();
+		if (preview.stage == PreviewController::INTERACTIVE && previewTarget.settings.reproject)
+			status += ", " + ofToString(int(100.0 * previewTarget.reusedPixels / max(1, previewTarget.settings.width * previewTarget.settings.height))) + "% reprojected";
+		ofDrawBitmapString(status, 10, ofGetWindowHeight() - 15);
+	}
+	//Render server status
+	if (server.isRunning())
+		ofDrawBitmapString("Server: " + server.getPath() + " (" + ofToString(server.numClients()) + " clients)", 10, ofGetWindowHeight() - 35);
+	//Progress of background render jobs
+	for (int k = 0; k < jobs.size(); k++)
+		ofDrawBitmapString("Job " + ofToString(jobs[k]->id) + " " + jobs[k]->name + " p" + ofToString(jobs[k]->getPriority()) + ": " +
+			ofToString(int(jobs[k]->progress() * 100)) + "%", ofGetWindowWidth() - 250, ofGetWindowHeight() - 15 - 20 * k);
 	//Draw GUI
 	gui.draw();
 }
@@ -347,6 +1631,67 @@ void ofApp::keyPressed(int key) {
 	case 'k':
 		createSpotLight();
 		break;
+		//Create rectangular area light
+	case 'l':
+		createRectLight();
+		break;
+		//Cycle shadow sampler
+	case 'm':
+		samplerType = SamplerType((samplerType + 1) % SAMPLER_COUNT);
+		break;
+		//Measure shadow noise vs time
+	case 'n':
+		shadowConvergenceTest();
+		break;
+		//Render main and side views as background jobs
+	case 'b':
+		submitCameraJobs();
+		break;
+		//Cancel background jobs
+	case 'e':
+		for (int k = 0; k < jobs.size(); k++)
+			jobs[k]->cancel();
+		break;
+		//Move the newest background job to the front
+	case 'g':
+		if (!jobs.empty())
+		{
+			int top = 0;
+			for (int k = 0; k < jobs.size(); k++)
+				top = max(top, jobs[k]->getPriority());
+			jobs.back()->setPriority(top + 1);
+		}
+		break;
+		//Compare shadow maps against shadow rays
+	case 'h':
+		shadowMapTest();
+		break;
+		//Benchmark the SIMD math layer
+	case 'u':
+		runMathBenchmark(ofToDataPath("math_bench.csv"));
+		break;
+		//Start or stop the render server
+	case 'o':
+		if (server.isRunning())
+			server.stop();
+		else
+			startServer();
+		break;
+		//Add a cloud of millions of spheres paged from disk
+	case 'a':
+	{
+		RandomSphereSource particles(8000000, glm::vec3(-10, -1.4, -12), glm::vec3(10, 4, -2), 0.01, 0.04);
+		createSphereCloud(ofToDataPath("particles.rtgc"), &particles);
+		break;
+	}
+		//Compare environment light sampling strategies
+	case 'w':
+		environmentConvergenceTest();
+		break;
+		//Create an implicit surface
+	case 't':
+		createImplicitSurface();
+		break;
 		//Create plane 
 	case 'p':
 		createPlane();
@@ -363,6 +1708,15 @@ void ofApp::keyPressed(int key) {
 	case 's':
 		createSphere();
 		break;
+		//Toggle interactive preview
+	case 'i':
+		previewMode = !previewMode;
+		lastViewSignature = 0;
+		break;
+		//Render from the current main camera view
+	case 'v':
+		setPreviewFromMainCam();
+		break;
 		//Switch cameras
 	case OF_KEY_F1:
 		theCam = &mainCam;
@@ -386,6 +1740,14 @@ void ofApp::keyPressed(int key) {
 	}
 }
 
+//Move the preview (and so the render) camera to the main camera's view
+void ofApp::setPreviewFromMainCam()
+{
+	previewCam.setPosition(mainCam.getGlobalPosition());
+	previewCam.setOrientation(mainCam.getGlobalOrientation());
+	renderCam.setFromCamera(previewCam, float(imageWidth) / imageHeight);
+}
+
 //Create sphere scene object
 void ofApp::createSphere()
 {
@@ -396,6 +1758,49 @@ void ofApp::createSphere()
 		//Add new sphere 
 		Sphere *temp = new Sphere(pointRtn, 1.5, ofColor::darkSeaGreen);
 		scene.push_back(temp);
+		sceneChanged = true;
+	}
+}
+
+//Add out of core spheres from a chunk file, building it from source first if
+//given and the file does not exist yet
+void ofApp::createSphereCloud(const string &chunkPath, SphereSource *source)
+{
+	if (source && !ofFile::doesFileExist(chunkPath, false))
+	{
+		string error;
+		if (!GeometryStore::build(chunkPath, *source, 64, error))
+		{
+			cout << "Could not build " << chunkPath << ": " << error << endl;
+			return;
+		}
+	}
+	shared_ptr<GeometryStore> store = make_shared<GeometryStore>();
+	if (!store->open(chunkPath))
+	{
+		cout << "Could not open geometry " << chunkPath << endl;
+		return;
+	}
+	store->setBudget(size_t(int(geometryBudget)) << 20);
+	scene.push_back(new SphereCloud(store, ofColor::lightSteelBlue));
+	sceneChanged = true;
+	cout << "Loaded " << store->numSpheres() << " spheres in " << store->numChunks() << " chunks from " << chunkPath << endl;
+}
+
+//Create an implicit surface scene object, three blended spheres with a
+//square tunnel cut through them
+void ofApp::createImplicitSurface()
+{
+	glm::vec3 pointRtn = glm::vec3(0, 0, 0);
+	if (mouseToDragPlane(ofGetMouseX(), ofGetMouseY(), pointRtn) == true) {
+		shared_ptr<const SdfNode> blob = make_shared<SdfSmoothUnion>(make_shared<SdfSphere>(glm::vec3(-0.8, 0, 0), 0.9),
+			make_shared<SdfSphere>(glm::vec3(0.8, 0, 0), 0.9), 0.6);
+		blob = make_shared<SdfSmoothUnion>(blob, make_shared<SdfSphere>(glm::vec3(0, 0.9, 0), 0.7), 0.6);
+		shared_ptr<const SdfNode> tunnel = make_shared<SdfTransform>(make_shared<SdfBox>(glm::vec3(0), glm::vec3(0.35, 0.35, 2)), glm::vec3(0, 0.2, 0), glm::vec3(0, 0, 45));
+		ImplicitSurface *temp = new ImplicitSurface(make_shared<SdfSubtraction>(blob, tunnel), pointRtn, ofColor::darkOrange);
+		temp->name = "blob " + ofToString(scene.size());
+		scene.push_back(temp);
+		sceneChanged = true;
 	}
 }
 
@@ -409,6 +1814,7 @@ void ofApp::createPlane()
 		//Add new plane 
 		Plane *temp = new Plane(pointRtn, glm::vec3(0, 1, 0), 20, 20, ofColor::darkSlateGray);
 		scene.push_back(temp);
+		sceneChanged = true;
 	}
 }
 
@@ -422,6 +1828,7 @@ void ofApp::createPointLight()
 		//Add new point light 
 		PointLight *temp = new PointLight(pointRtn, pointIntensity, ofColor::darkRed);
 		scene.push_back(temp);
+		sceneChanged = true;
 		pointLights.push_back(temp);
 	}
 }
@@ -436,10 +1843,26 @@ void ofApp::createSpotLight()
 		//Add new point light 
 		SpotLight *temp = new SpotLight(pointRtn, spotIntensity, ofColor::darkBlue);
 		scene.push_back(temp);
+		sceneChanged = true;
 		spotLights.push_back(temp);
 	}
 }
 
+//Create rectangular area light object
+void ofApp::createRectLight()
+{
+	//Declare return point variable
+	glm::vec3 pointRtn = glm::vec3(0, 0, 0);
+	//Project mouse point onto 3D point normal to the view axis 
+	if (mouseToDragPlane(ofGetMouseX(), ofGetMouseY(), pointRtn) == true) {
+		//Add new rectangular light 
+		RectLight *temp = new RectLight(pointRtn, pointIntensity, 2, 2, ofColor::darkRed);
+		scene.push_back(temp);
+		sceneChanged = true;
+		pointLights.push_back(temp);
+	}
+}
+
 //Delete object
 void ofApp::deleteObject()
 {
@@ -459,6 +1882,7 @@ void ofApp::deleteObject()
 			if (spotLights[i] == selected[0])
 				spotLights.erase(spotLights.begin() + i);
 		}
+		sceneChanged = true;
 	}
 }
 
@@ -500,6 +1924,7 @@ void ofApp::mouseDragged(int x, int y, int button) {
 		else {
 			selected[0]->position += (point - lastPoint);
 		}
+		markDirty(selected[0]);
 		lastPoint = point;
 	}
 
@@ -615,6 +2040,36 @@ void ofApp::gotMessage(ofMessage msg){
 }
 
 //--------------------------------------------------------------
+//Drop an image on the window to texture the selected object, or geometry to
+//add it: a chunk file (.rtgc) or a float32 x y z radius particle dump (.xyzr)
 void ofApp::dragEvent(ofDragInfo dragInfo){ 
-
+	if (dragInfo.files.empty())
+		return;
+	string extension = ofToLower(ofFilePath::getFileExt(dragInfo.files[0]));
+	if (extension == "rtgc")
+	{
+		createSphereCloud(dragInfo.files[0]);
+		return;
+	}
+	if (extension == "hdr" || extension == "exr")
+	{
+		loadEnvironment(dragInfo.files[0]);
+		return;
+	}
+	if (extension == "xyzr")
+	{
+		SphereDumpSource dump(dragInfo.files[0]);
+		createSphereCloud(ofFilePath::removeExt(dragInfo.files[0]) + ".rtgc", &dump);
+		return;
+	}
+	if (!objSelected())
+		return;
+	int texture = textureCache.addTexture(dragInfo.files[0]);
+	if (texture < 0)
+	{
+		cout << "Could not load texture " << dragInfo.files[0] << endl;
+		return;
+	}
+	selected[0]->texture = texture;
+	markDirty(selected[0]);
 }
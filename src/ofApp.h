@@ -4,7 +4,23 @@
 
 #include "ofMain.h"
 #include "ofxGui.h"
-#include "box.h"
+#include "simd.h"
+#include "mathbench.h"
+#include "sampler.h"
+#include "aov.h"
+#include "denoise.h"
+#include "frustum.h"
+#include "render.h"
+#include "preview.h"
+#include "rcu.h"
+#include "jobs.h"
+#include "texcache.h"
+#include "geostore.h"
+#include "sdf.h"
+#include "envmap.h"
+#include "server.h"
+#include "viewport.h"
+#include "reproject.h"
 #include "glm/gtx/intersect.hpp"
 #include "glm/gtx/euler_angles.hpp"
 
@@ -25,9 +41,18 @@ public:
 //
 class SceneObject {
 public:
+	virtual ~SceneObject() {}
 	virtual void draw() = 0;   
+	virtual SceneObject *clone() const = 0;   // copy for scene snapshots
 	virtual bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) { return false; }
 	virtual bool lightIntersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) { return false; }
+	virtual glm::vec3 sampleLight(const glm::vec3 &p, const glm::vec2 &uv) { return position; }
+	//World space bounds, false if the object is unbounded
+	virtual bool getBounds(glm::vec3 &min, glm::vec3 &max) { return false; }
+	//Texture coordinates of a surface point and the world length of one unit of uv
+	virtual bool getUV(const glm::vec3 &point, glm::vec2 &uv, float &uvScale) { return false; }
+	//Unit primitive and transform that draw() is equivalent to, for instanced viewport drawing
+	virtual ViewportShape getViewportShape(glm::mat4 &transform) { return VIEWPORT_NONE; }
 	glm::mat4 getRotateMatrix() {
 		return (glm::eulerAngleYXZ(glm::radians(rotation.y), glm::radians(rotation.x), glm::radians(rotation.z)));  
 	}
@@ -49,6 +74,7 @@ public:
 	glm::vec3 rotation = glm::vec3(0, 0, 0);  
 	ofColor diffuseColor = ofColor::grey;    
 	ofColor specularColor = ofColor::lightGray;
+	int texture = -1;                          // TextureCache id replacing diffuseColor, -1 for none
 	bool isSelectable = true;
 };
 
@@ -62,12 +88,27 @@ public:
 		diffuseColor = diffuse; 
 	}
 	Sphere() {}
+	//Rotation leaves a sphere unchanged, so test in world space without inverting the matrix
 	bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) {
-		glm::mat4 mInv = glm::inverse(getMatrix());
-		glm::vec4 p = mInv * glm::vec4(ray.p.x, ray.p.y, ray.p.z, 1.0);
-		glm::vec4 p1 = mInv * glm::vec4(ray.p + ray.d, 1.0);
-		glm::vec3 d = glm::normalize(p1 - p);
-		return (glm::intersectRaySphere(glm::vec3(p), d, glm::vec3(0, 0, 0), radius, point, normal));
+		return glm::intersectRaySphere(ray.p, glm::normalize(ray.d), position, radius, point, normal);
+	}
+	bool getBounds(glm::vec3 &min, glm::vec3 &max) {
+		min = position - glm::vec3(radius);
+		max = position + glm::vec3(radius);
+		return true;
+	}
+	//Longitude / latitude of the local space point
+	bool getUV(const glm::vec3 &point, glm::vec2 &uv, float &uvScale) {
+		glm::vec3 p = glm::inverse(getMatrix()) * glm::vec4(point, 1.0);
+		uv.x = atan2(p.z, p.x) / (2 * PI) + 0.5;
+		uv.y = acos(ofClamp(p.y / radius, -1, 1)) / PI;
+		uvScale = sqrt(2 * PI * radius * PI * radius);
+		return true;
+	}
+	SceneObject *clone() const { return new Sphere(*this); }
+	ViewportShape getViewportShape(glm::mat4 &transform) {
+		transform = getMatrix() * glm::scale(glm::mat4(1.0), glm::vec3(radius));
+		return VIEWPORT_SPHERE;
 	}
 	void draw() {
 		glm::mat4 m = getMatrix();
@@ -79,6 +120,97 @@ public:
 	float radius = 1.0;
 };
 
+//  Many spheres paged in from a GeometryStore chunk file. position moves the
+//  whole cloud, which starts at origin; rotation is ignored. Snapshots share
+//  the store.
+//
+class SphereCloud : public SceneObject {
+public:
+	SphereCloud(shared_ptr<GeometryStore> store, ofColor diffuse = ofColor::lightGray) : store(store) {
+		glm::vec3 min, max;
+		store->getBounds(min, max);
+		origin = position = (min + max) / 2;
+		diffuseColor = diffuse;
+	}
+	bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) {
+		glm::vec3 offset = position - origin, d = glm::normalize(ray.d);
+		float t = std::numeric_limits<float>::max();
+		glm::vec4 sphere;
+		if (!store->intersect(ray.p - offset, d, t, sphere))
+			return false;
+		point = ray.p + d * t;
+		normal = (point - (glm::vec3(sphere) + offset)) / sphere.w;
+		return true;
+	}
+	bool getBounds(glm::vec3 &min, glm::vec3 &max) {
+		if (!store->getBounds(min, max)) return false;
+		min += position - origin;
+		max += position - origin;
+		return true;
+	}
+	SceneObject *clone() const { return new SphereCloud(*this); }
+	void draw() {
+		glm::vec3 min, max;
+		if (!getBounds(min, max)) return;
+		ofNoFill();
+		ofDrawBox((min + max) / 2, max.x - min.x, max.y - min.y, max.z - min.z);
+		ofFill();
+	}
+	shared_ptr<GeometryStore> store;
+	glm::vec3 origin;
+};
+
+//  Surface of a signed distance function tree (sdf.h) in the local space of
+//  position and rotation, found by sphere tracing within limits. Snapshots
+//  share the tree and the stats.
+//
+class ImplicitSurface : public SceneObject {
+public:
+	ImplicitSurface(shared_ptr<const SdfNode> root, glm::vec3 p, ofColor diffuse = ofColor::lightGray) : root(root), stats(make_shared<SdfStats>()) {
+		position = p;
+		diffuseColor = diffuse;
+	}
+	//Rigid transform, so local distances are world distances
+	bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) {
+		glm::mat3 rotate = glm::mat3(getRotateMatrix());
+		glm::mat3 toLocal = glm::transpose(rotate);
+		glm::vec3 d = glm::normalize(ray.d);
+		glm::vec3 o = toLocal * (ray.p - position), dl = toLocal * d;
+		float t;
+		if (!sphereTrace(*root, o, dl, std::numeric_limits<float>::max(), limits, t, *stats))
+			return false;
+		point = ray.p + d * t;
+		normal = rotate * sdfNormal(*root, o + dl * t, limits.epsilon, *stats);
+		return true;
+	}
+	bool getBounds(glm::vec3 &min, glm::vec3 &max) {
+		glm::mat4 m = getMatrix();
+		min = glm::vec3(std::numeric_limits<float>::max());
+		max = -min;
+		for (int c = 0; c < 8; c++) {
+			glm::vec3 corner((c & 1) ? root->boundsMax.x : root->boundsMin.x, (c & 2) ? root->boundsMax.y : root->boundsMin.y,
+				(c & 4) ? root->boundsMax.z : root->boundsMin.z);
+			glm::vec3 q = m * glm::vec4(corner, 1.0);
+			min = glm::min(min, q);
+			max = glm::max(max, q);
+		}
+		return true;
+	}
+	SceneObject *clone() const { return new ImplicitSurface(*this); }
+	//The primitives of the tree, subtracted ones left out
+	void draw() {
+		glm::mat4 m = getMatrix();
+		ofPushMatrix();
+		ofMultMatrix(m);
+		root->draw();
+		ofPopMatrix();
+	}
+	shared_ptr<const SdfNode> root;
+	shared_ptr<SdfStats> stats;
+	SdfLimits limits;
+	string name = "blob";
+};
+
 //  General purpose plane 
 //
 class Plane : public SceneObject {
@@ -103,6 +235,20 @@ public:
 	glm::vec3 getNormal(const glm::vec3 &p) {
 		return this->normal;
 	}
+	//Only horizontal planes are bounded, intersect() only limits x and z
+	bool getBounds(glm::vec3 &min, glm::vec3 &max) {
+		if (normal != glm::vec3(0, 1, 0)) return false;
+		min = position - glm::vec3(width / 2, 0, height / 2);
+		max = position + glm::vec3(width / 2, 0, height / 2);
+		return true;
+	}
+	//One copy of the texture across the plane
+	bool getUV(const glm::vec3 &point, glm::vec2 &uv, float &uvScale) {
+		uv = glm::vec2((point.x - position.x) / width + 0.5, (point.z - position.z) / height + 0.5);
+		uvScale = sqrt(width * height);
+		return true;
+	}
+	SceneObject *clone() const { return new Plane(*this); }
 	void draw() {
 		glm::mat4 m = getMatrix();
 		ofPushMatrix();
@@ -110,6 +256,10 @@ public:
 		plane.drawFaces();
 		ofPopMatrix();
 	}
+	ViewportShape getViewportShape(glm::mat4 &transform) {
+		transform = getMatrix() * plane.getLocalTransformMatrix() * glm::scale(glm::mat4(1.0), glm::vec3(plane.getWidth(), plane.getHeight(), 1));
+		return VIEWPORT_PLANE;
+	}
 	ofPlanePrimitive plane;
 	glm::vec3 normal;
 	float width = 20;
@@ -125,15 +275,21 @@ public:
 		min = glm::vec2(-3, -2);
 		max = glm::vec2(3, 2);
 		position = glm::vec3(0, 0, 5);
-		normal = glm::vec3(0, 0, 1);      // viewplane currently limited to Z axis orientation
+		normal = glm::vec3(0, 0, 1);      // orientation is set by the RenderCam basis
 		isSelectable = false;
 	}
 	void setSize(glm::vec2 min, glm::vec2 max) { this->min = min; this->max = max; }
 	float getAspect() { return width() / height(); }
 	glm::vec3 toWorld(float u, float v);   //   (u, v) --> (x, y, z) [ world space ]
+	SceneObject *clone() const { return new ViewPlane(*this); }
+	ViewportShape getViewportShape(glm::mat4 &transform) { return VIEWPORT_NONE; }
 	void draw() {
+		glm::mat4 m = glm::mat4(glm::vec4(right, 0), glm::vec4(up, 0), glm::vec4(normal, 0), glm::vec4(position, 1));
 		ofSetColor(diffuseColor);
-		ofDrawRectangle(glm::vec3(min.x, min.y, position.z), width(), height());
+		ofPushMatrix();
+		ofMultMatrix(m);
+		ofDrawRectangle(glm::vec3(min.x, min.y, 0), width(), height());
+		ofPopMatrix();
 	}
 	float width() {
 		return (max.x - min.x);
@@ -146,9 +302,11 @@ public:
 	glm::vec2 bottomLeft() { return min; }
 	glm::vec2 bottomRight() { return glm::vec2(max.x, min.y); }
 	glm::vec2 min, max;
+	glm::vec3 right = glm::vec3(1, 0, 0);   // plane axes in world space, (u, v) run along these
+	glm::vec3 up = glm::vec3(0, 1, 0);
 };
 
-//  render camera  - currently must be z axis aligned (we will improve this in project 4)
+//  render camera  - any position and orientation, given by aim (view direction) and up
 //
 class RenderCam : public SceneObject {
 public:
@@ -156,11 +314,25 @@ public:
 		position = glm::vec3(0, 0, 10);
 		aim = glm::vec3(0, 0, -1);
 		isSelectable = false;
+		update();
 	}
 	Ray getRay(float u, float v);
+	void update();
+	void setFromCamera(const ofCamera &cam, float aspect);
+	void beginRaster(int width, int height);
+	SceneObject *clone() const { return new RenderCam(*this); }
 	void draw() { ofDrawBox(position, 1.0); };
 	glm::vec3 aim;
+	glm::vec3 up = glm::vec3(0, 1, 0);
+	float fov = 43.6028;     // vertical field of view in degrees (matches the default 6x4 view at distance 5)
+	float aspect = 1.5;
+	float viewDistance = 5;
+	glm::vec4 crop = glm::vec4(0, 0, 1, 1);   // render region (x0, y0, x1, y1), normalized, y down from the top
 	ViewPlane view;          // The camera viewplane, this is the view that we will render 
+
+	//Raster stepping set by beginRaster(), the unnormalized direction through raster
+	//position (x, y) is rasterOrigin + rasterStepX * x + rasterStepY * y (y = 0 at the bottom)
+	glm::vec3 rasterOrigin, rasterStepX, rasterStepY;
 };
 
 //General purpose point light
@@ -173,6 +345,11 @@ public:
 		intensity = i;
 		diffuseColor = color;
 	}
+	SceneObject *clone() const { return new PointLight(*this); }
+	ViewportShape getViewportShape(glm::mat4 &transform) {
+		transform = getMatrix() * glm::scale(glm::mat4(1.0), glm::vec3(radius));
+		return VIEWPORT_SPHERE;
+	}
 	void draw() {
 		glm::mat4 m = getMatrix();
 		ofPushMatrix();
@@ -183,6 +360,66 @@ public:
 	bool lightIntersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) {
 		return (glm::intersectRaySphere(ray.p, ray.d, position, radius, point, normal));
 	}
+	bool getBounds(glm::vec3 &min, glm::vec3 &max) {
+		min = position - glm::vec3(radius);
+		max = position + glm::vec3(radius);
+		return true;
+	}
+	//Sample the spherical light as seen from p. The sphere is replaced by the disk
+	//facing p, which covers the same solid angle.
+	glm::vec3 sampleLight(const glm::vec3 &p, const glm::vec2 &uv) {
+		glm::vec3 u, v;
+		orthonormalBasis(glm::normalize(p - position), u, v);
+		glm::vec2 d = squareToDisk(uv) * radius;
+		return position + u * d.x + v * d.y;
+	}
+};
+
+//Rectangular area light, lies in its local XZ plane
+class RectLight : public PointLight {
+public:
+	float width = 2, height = 2;
+	RectLight(glm::vec3 p, float i, float w = 2, float h = 2, ofColor color = ofColor::darkRed) {
+		position = p;
+		intensity = i;
+		width = w;
+		height = h;
+		diffuseColor = color;
+	}
+	SceneObject *clone() const { return new RectLight(*this); }
+	ViewportShape getViewportShape(glm::mat4 &transform) {
+		transform = getMatrix() * glm::rotate(glm::mat4(1.0), glm::radians(90.0f), glm::vec3(1, 0, 0)) * glm::scale(glm::mat4(1.0), glm::vec3(width, height, 1));
+		return VIEWPORT_PLANE;
+	}
+	void draw() {
+		glm::mat4 m = getMatrix();
+		ofPushMatrix();
+		ofMultMatrix(m);
+		ofRotate(90, 1, 0, 0);
+		ofDrawRectangle(glm::vec3(-width / 2, -height / 2, 0), width, height);
+		ofPopMatrix();
+	}
+	bool lightIntersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) {
+		glm::mat4 mInv = glm::inverse(getMatrix());
+		glm::vec3 p = mInv * glm::vec4(ray.p, 1.0);
+		glm::vec3 d = mInv * glm::vec4(ray.d, 0.0);
+		if (d.y == 0) return false;
+		float t = -p.y / d.y;
+		glm::vec3 hit = p + d * t;
+		if (t < 0 || fabs(hit.x) > width / 2 || fabs(hit.z) > height / 2) return false;
+		point = ray.p + ray.d * t;
+		normal = glm::normalize(glm::vec3(getRotateMatrix() * glm::vec4(0, 1, 0, 0)));
+		return true;
+	}
+	glm::vec3 sampleLight(const glm::vec3 &p, const glm::vec2 &uv) {
+		return getMatrix() * glm::vec4((uv.x - 0.5) * width, 0, (uv.y - 0.5) * height, 1.0);
+	}
+	bool getBounds(glm::vec3 &min, glm::vec3 &max) {
+		float extent = glm::length(glm::vec2(width, height)) / 2;
+		min = position - glm::vec3(extent);
+		max = position + glm::vec3(extent);
+		return true;
+	}
 };
 
 class SpotLight : public SceneObject {
@@ -194,6 +431,7 @@ public:
 		intensity = i;
 		diffuseColor = color;
 	}
+	SceneObject *clone() const { return new SpotLight(*this); }
 	void draw() {
 		glm::mat4 m = lookAtMatrix(position, aim, glm::vec3(0, 1, 0));
 		ofPushMatrix();
@@ -202,6 +440,11 @@ public:
 		ofDrawCone(radius, height);
 		ofPopMatrix();
 	}
+	ViewportShape getViewportShape(glm::mat4 &transform) {
+		transform = lookAtMatrix(position, aim, glm::vec3(0, 1, 0)) * glm::rotate(glm::mat4(1.0), glm::radians(-90.0f), glm::vec3(1, 0, 0)) *
+			glm::scale(glm::mat4(1.0), glm::vec3(radius, height, radius));
+		return VIEWPORT_CONE;
+	}
 	glm::mat4 lookAtMatrix(const glm::vec3 &pos, const glm::vec3 &aimPos, glm::vec3 upVector) {
 		glm::mat4 m;
 		glm::vec3 dir = glm::normalize(pos - aimPos);
@@ -230,10 +473,58 @@ public:
 		glm::vec4 p = mInv * glm::vec4(ray.p.x, ray.p.y, ray.p.z, 1.0);
 		glm::vec4 p1 = mInv * glm::vec4(ray.p + ray.d, 1.0);
 		glm::vec3 d = glm::normalize(p1 - p);
-		_Ray boxRay = _Ray(Vector3(p.x, p.y, p.z), Vector3(d.x, d.y, d.z));
-		Box box = Box(Vector3(-radius, -radius, 0), Vector3(radius, radius, height));
-		return (box.intersect(boxRay, -1000, 1000));
+		return rayBoxIntersect(glm::vec3(p), Vec4f(1.0f / d.x, 1.0f / d.y, 1.0f / d.z),
+			Vec4f(-radius, -radius, 0), Vec4f(radius, radius, height), -1000, 1000);
+	}
+	bool getBounds(glm::vec3 &min, glm::vec3 &max) {
+		float extent = glm::length(glm::vec2(radius, height));
+		min = position - glm::vec3(extent);
+		max = position + glm::vec3(extent);
+		return true;
 	}
+	//Sample the disk of the cone opening, facing the aim point
+	glm::vec3 sampleLight(const glm::vec3 &p, const glm::vec2 &uv) {
+		glm::vec3 u, v;
+		orthonormalBasis(glm::normalize(aim - position), u, v);
+		glm::vec2 d = squareToDisk(uv) * radius;
+		return position + u * d.x + v * d.y;
+	}
+};
+
+//  Immutable copy of everything the renderer reads from the editor. The editor
+//  publishes a new version with an atomic pointer swap after each change; objects
+//  that did not change are shared with the previous version, edited ones are cloned.
+//
+struct SceneSnapshot {
+	uint64_t version = 0;
+	uint64_t geometryVersion = 0;      // changes only when occluders change
+	map<SceneObject *, shared_ptr<SceneObject>> copies;   // editor object -> its copy, owns the copies
+	vector<SceneObject *> scene;
+	vector<PointLight *> pointLights;
+	vector<SpotLight *> spotLights;
+	bool phong = false;
+	float power = 100;
+	float spotSize = 0.3;
+	SamplerType samplerType = SAMPLER_HALTON;
+	ofColor background;
+	shared_ptr<const EnvironmentMap> environment;   // replaces background and lights the scene when set
+	float environmentIntensity = 1;
+	//Object bounds gathered once per version, shared by every pass that renders it
+	vector<SceneObject *> bounded, unbounded;
+	vector<glm::vec3> boundsMin, boundsMax;
+};
+
+//  What the shading functions need for one render pass
+//
+struct RenderContext {
+	const SceneSnapshot *scene;
+	const RenderSettings *settings;
+	glm::vec3 eye;
+	const ShadowMapSet *shadowMaps = NULL;
+	TextureCache *textures = NULL;
+	IrradianceCache *irradiance = NULL;    // indirect light, flat ambient without it
+	float pixelAngle = 0;                  // angle covered by one pixel
+	bool bounce = false;                   // shading a hemisphere sample: direct light only
 };
 
 class ofApp : public ofBaseApp {
@@ -241,6 +532,7 @@ class ofApp : public ofBaseApp {
 public:
 	void setup();
 	void update();
+	void updateLights();
 	void draw();
 	void keyPressed(int key);
 	void keyReleased(int key);
@@ -255,11 +547,36 @@ public:
 	void gotMessage(ofMessage msg);
 
 	void rayTrace();
+	RenderSettings guiSettings();
+	bool beginRender(RenderTarget &target, const RenderSettings &settings, RenderCam &camera, ReprojectionCache *reprojection = NULL);
+	void renderRows(RenderTarget &target, int endRow);
+	void renderRegion(RenderTarget &target, int x0, int x1, int y0, int y1);
+	void finishRender(RenderTarget &target, Denoiser &denoiser, int denoiseThreads);
+	shared_ptr<RenderJob> submitJob(const ofCamera &cam, const RenderSettings &settings, int priority, const string &name, RenderJob::TileCallback onTile = nullptr,
+		ReprojectionCache *reprojection = NULL);
+	void submitCameraJobs();
+	void updateJobs();
+	void startServer();
+	void updateServer();
+	void serverCommand(int client, const string &line);
+	void updatePreview();
+	uint64_t viewSignature();
 	void createSphere();
 	void createPlane();
 	void createPointLight();
 	void createSpotLight();
+	void createRectLight();
+	void createSphereCloud(const string &chunkPath, SphereSource *source = NULL);
+	void createImplicitSurface();
+	void setPreviewFromMainCam();
 	void deleteObject();
+	void shadowConvergenceTest();
+	void shadowMapTest();
+	void environmentConvergenceTest();
+	void loadEnvironment(const string &path);
+	void startViewportBenchmark();
+	void updateViewportBenchmark();
+	shared_ptr<const ShadowMapSet> buildShadowMaps(const SceneSnapshot &snapshot, const RenderSettings &settings);
 
 	glm::vec3 lastPoint;
 	bool bRotateX = false;
@@ -272,10 +589,29 @@ public:
 	bool bHide = true;
 	bool bShowImage = false;
 	bool renderFinish = false;
-	bool insideShadow(const Ray shadowRay);
+	bool insideShadow(const RenderContext &ctx, const Ray shadowRay);
+	bool insideShadow(const RenderContext &ctx, const Ray shadowRay, float maxDist);
+	bool closestHit(const RenderContext &ctx, const Ray &ray, glm::vec3 &point, glm::vec3 &normal, SceneObject *&object);
+	bool closestHit(const Ray &ray, const vector<SceneObject *> &objects, glm::vec3 &point, glm::vec3 &normal, SceneObject *&object);
+	void buildTileLists(const SceneSnapshot &snapshot, RenderCam &camera, int width, int height, int tileSize, vector<vector<SceneObject *>> &lists, bool verbose);
+	float lightVisibility(const RenderContext &ctx, const glm::vec3 &p, const glm::vec3 &norm, SceneObject *light);
+	float estimateVisibility(const RenderContext &ctx, const glm::vec3 &p, const glm::vec3 &n, SceneObject *light, SamplerType type, int samples, int firstPass, int &raysUsed);
+	SamplerType samplerType = SAMPLER_HALTON;
 
-	ofColor lambert(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse);
-	ofColor phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse, const ofColor specular, float power);
+	ofColor lambert(const RenderContext &ctx, const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse);
+	ofColor ambient(const RenderContext &ctx, const glm::vec3 &p, const glm::vec3 &norm, const ofColor &diffuse);
+	ofColor environment(const RenderContext &ctx, const glm::vec3 &p, const glm::vec3 &norm, const ofColor &diffuse);
+	glm::vec3 environmentLight(const RenderContext &ctx, const glm::vec3 &p, const glm::vec3 &n, int samples, bool importance, int &rays);
+	ofColor missColor(const RenderContext &ctx, const glm::vec3 &dir);
+	shared_ptr<IrradianceCache> getIrradianceCache(const SceneSnapshot &snapshot, const RenderSettings &settings);
+	ofColor surfaceColor(const RenderContext &ctx, SceneObject *object, const glm::vec3 &p, const glm::vec3 &n, const Ray &ray, float pixelAngle);
+	ofColor phong(const RenderContext &ctx, const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse, const ofColor specular, float power);
+
+	void markDirty(SceneObject *object) { dirtyObjects.insert(object); }
+	void publishScene();
+	RCUPointer<SceneSnapshot> sceneStore;
+	set<SceneObject *> dirtyObjects;
+	bool sceneChanged = true;
 
 	ofEasyCam  mainCam;
 	ofCamera sideCam;
@@ -283,6 +619,44 @@ public:
 	ofCamera  *theCam;    
 	RenderCam renderCam;
 	ofImage image;
+	Denoiser denoiser;
+	ShadowMapCache shadowMapCache;
+	shared_ptr<IrradianceCache> irradianceCache;   // of the last scene version rendered with indirect light
+	uint64_t irradianceVersion = 0;
+	TextureCache textureCache;
+	ReprojectionCache reprojection;            // final and server frames
+	shared_ptr<const EnvironmentMap> environmentMap;
+	ReprojectionCache previewReprojection;     // interactive preview frames
+	ViewportBatches viewport;
+
+	//--viewport-bench: frame times of batched vs per object drawing for a generated scene
+	int viewportBenchObjects = 0;
+	int viewportBenchFrame = 0;
+	vector<float> viewportBenchTimes[2];
+
+	bool previewMode = false;
+	PreviewController preview;
+	RenderTarget previewTarget;
+	RenderTarget refineTarget;
+	ofImage previewImage;
+	uint64_t lastViewSignature = 0;
+
+	//Render server for scripted edits, declared before the scheduler so it outlives the tile callbacks
+	bool daemonMode = false;
+	string serverPath = "/tmp/raytracer.sock";
+	static const int maxServerImageSize = 8192;   // pixels per side of a client's render
+	RenderServer server;
+	ofCamera serverCam;
+	struct ServerJob {
+		int client;
+		shared_ptr<RenderJob> job;
+	};
+	vector<ServerJob> serverJobs;
+
+	//Background render jobs share one worker pool, declared after sceneStore so it stops first
+	RenderScheduler scheduler;
+	vector<shared_ptr<RenderJob>> jobs;
+	int nextJobId = 1;
 
 	vector<SceneObject *> scene;
 	vector<PointLight *> pointLights;
@@ -297,5 +671,30 @@ public:
 	ofxFloatSlider spotIntensity;
 	ofxFloatSlider spotSize;
 	ofxVec3Slider spotAim;
+	ofxToggle softShadows;
+	ofxIntSlider shadowSamples;
+	ofxIntSlider pixelSamples;
+	ofxFloatSlider previewBudget;
+	ofxToggle denoise;
+	ofxToggle shadowMaps;
+	ofxIntSlider shadowMapSize;
+	ofxFloatSlider shadowBias;
+	ofxIntSlider textureBudget;
+	ofxIntSlider geometryBudget;
+	ofxToggle wavefront;
+	ofxToggle batchedViewport;
+	ofxToggle reprojectFrames;
+	ofxToggle indirectLight;
+	ofxFloatSlider irradianceAccuracy;
+	ofxFloatSlider environmentIntensity;
+	ofxIntSlider environmentSamples;
+	ofxToggle environmentImportance;
+	ofxIntSlider beautyFormat;
+	ofxIntSlider frameBudget;
+	ofxVec4Slider cropRegion;
+	ofxToggle aovDepth;
+	ofxToggle aovNormal;
+	ofxToggle aovObjectId;
+	ofxToggle aovAlbedo;
 	ofxPanel gui;
 };
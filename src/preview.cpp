@@ -0,0 +1,72 @@
+#include "preview.h"
+
+//  Relative cost of a pass: pixels times pixel samples, times a factor for soft
+//  shadows (the adaptive estimator takes about four rays outside penumbrae)
+//
+float PreviewController::cost(const RenderSettings &settings, float pixels) const {
+	return pixels * settings.samples * (settings.softShadows ? 4 : 1);
+}
+
+RenderSettings PreviewController::plan(int windowWidth, int windowHeight) {
+	//Quality ladder, best first: full quality, 1 spp, hard shadows
+	RenderSettings ladder[3] = { full, full, full };
+	ladder[1].samples = 1;
+	ladder[2].samples = 1;
+	ladder[2].softShadows = false;
+	float pixels = float(windowWidth) * windowHeight;
+	RenderSettings settings = ladder[2];
+	float scale = 1;
+	int k = 0;
+	for (; k < 3; k++)
+		if (cost(ladder[k], pixels) * msPerUnit <= targetMs) break;
+	if (k < 3)
+		settings = ladder[k];
+	else
+		scale = ofClamp(sqrt(targetMs / (cost(ladder[2], pixels) * msPerUnit)), minScale, 1);
+	//Smooth resolution changes between consecutive frames
+	if (!history.empty() && history.back().stage == INTERACTIVE)
+		scale = min(1.0f, 0.5f * scale + 0.5f * history.back().scale);
+	settings.width = max(1, int(windowWidth * scale));
+	settings.height = max(1, int(windowHeight * scale));
+	settings.denoise = false;
+	settings.aovMask = 0;
+	settings.crop = glm::vec4(0, 0, 1, 1);
+	settings.verbose = false;
+	current.stage = INTERACTIVE;
+	current.scale = scale;
+	current.samples = settings.samples;
+	current.softShadows = settings.softShadows;
+	current.predictedMs = cost(settings, float(settings.width) * settings.height) * msPerUnit;
+	return settings;
+}
+
+void PreviewController::report(float ms, const RenderSettings &settings, float pixelsTraced) {
+	//Exponential moving average of the cost per unit
+	float units = cost(settings, pixelsTraced);
+	if (units > 0)
+		msPerUnit = 0.7f * msPerUnit + 0.3f * (ms / units);
+	current.ms = ms;
+	if (stage != INTERACTIVE) {
+		current.stage = stage;
+		current.scale = 1;
+		current.samples = settings.samples;
+		current.softShadows = settings.softShadows;
+		current.predictedMs = targetMs;
+	}
+	history.push_back(current);
+	if (history.size() > 120)
+		history.pop_front();
+}
+
+string PreviewController::status() const {
+	static const char *stages[] = { "interactive", "refining", "converged" };
+	if (history.empty()) return "Preview: waiting";
+	const Frame &f = history.back();
+	float average = 0;
+	for (int k = 0; k < history.size(); k++)
+		average += history[k].ms;
+	average /= history.size();
+	return "Preview: " + string(stages[f.stage]) + "  scale " + ofToString(f.scale, 2) +
+		"  spp " + ofToString(f.samples) + (f.softShadows ? "  soft" : "  hard") +
+		"  frame " + ofToString(f.ms, 1) + "/" + ofToString(targetMs, 0) + " ms  avg " + ofToString(average, 1) + " ms";
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "ofMain.h"
+#include "render.h"
+
+//  Chooses render settings for the interactive preview so each frame fits a
+//  time budget. While the view is changing it steps down pixel samples, then
+//  soft shadows, then resolution (scaled continuously) from a cost model fitted
+//  to the measured frame times. Once the view is still it renders the full
+//  quality image progressively, a budget's worth of rows per frame.
+//
+class PreviewController {
+public:
+	enum Stage { INTERACTIVE, REFINING, CONVERGED };
+
+	//  One frame's decision and its measured cost
+	//
+	struct Frame {
+		Stage stage;
+		float scale;
+		int samples;
+		bool softShadows;
+		float predictedMs;
+		float ms;
+	};
+
+	void setQuality(const RenderSettings &full) { this->full = full; }
+	void viewChanged() { stage = INTERACTIVE; }
+
+	//  Settings for an interactive frame of the given window size
+	//
+	RenderSettings plan(int windowWidth, int windowHeight);
+	//  Measured time for the frame planned last, or for a slice of a refinement pass
+	//
+	void report(float ms, const RenderSettings &settings, float pixelsTraced);
+	//  Called when the view has not changed this frame
+	//
+	void viewStill() { if (stage == INTERACTIVE) stage = REFINING; }
+	void refineComplete() { stage = CONVERGED; }
+
+	float cost(const RenderSettings &settings, float pixels) const;
+	string status() const;
+
+	float targetMs = 33;
+	float minScale = 0.1;
+	Stage stage = INTERACTIVE;
+	RenderSettings full;
+	float msPerUnit = 1e-4;                // fitted cost model, ms per cost unit
+	deque<Frame> history;                  // most recent frames, newest last
+	Frame current;
+};
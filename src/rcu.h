@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+//  Read-copy-update pointer with epoch based reclamation.
+//
+//  One writer publishes immutable versions of T with an atomic pointer swap.
+//  Readers pin the version that is current when they call read() and keep it
+//  until their guard is released; they never take a lock. Replaced versions
+//  are freed by the writer once no reader that could have seen them is active.
+//
+//  Reader:  e = epoch; slot = e; p = current     (all seq_cst)
+//  Writer:  old = exchange(current, next); retire old with tag = epoch; epoch++
+//
+//  A reader holding old loaded current before the exchange, so it stored its
+//  slot before it and read e <= tag. Old is only freed when every active slot
+//  is greater than its tag.
+//
+template <class T>
+class RCUPointer {
+public:
+	static const int maxReaders = 64;
+
+	class ReadGuard {
+	public:
+		ReadGuard() {}
+		ReadGuard(std::atomic<uint64_t> *slot, const T *value) : slot(slot), value(value) {}
+		ReadGuard(ReadGuard &&other) : slot(other.slot), value(other.value) { other.slot = NULL; other.value = NULL; }
+		ReadGuard &operator=(ReadGuard &&other) {
+			if (this != &other) {
+				release();
+				slot = other.slot;
+				value = other.value;
+				other.slot = NULL;
+				other.value = NULL;
+			}
+			return *this;
+		}
+		ReadGuard(const ReadGuard &) = delete;
+		ReadGuard &operator=(const ReadGuard &) = delete;
+		~ReadGuard() { release(); }
+		void release() {
+			if (slot) slot->store(0);
+			slot = NULL;
+			value = NULL;
+		}
+		const T *get() const { return value; }
+		const T *operator->() const { return value; }
+		const T &operator*() const { return *value; }
+		explicit operator bool() const { return value != NULL; }
+	private:
+		std::atomic<uint64_t> *slot = NULL;
+		const T *value = NULL;
+	};
+
+	RCUPointer() {
+		epoch.store(1);
+		current.store(NULL);
+		for (int k = 0; k < maxReaders; k++) slots[k].store(0);
+	}
+	~RCUPointer() {
+		delete current.load();
+		for (size_t k = 0; k < retired.size(); k++) delete retired[k].value;
+	}
+
+	//  Pin the current version. Returns an empty guard if all reader slots are taken.
+	//
+	ReadGuard read() {
+		uint64_t e = epoch.load();
+		for (int k = 0; k < maxReaders; k++) {
+			uint64_t expected = 0;
+			if (slots[k].load() == 0 && slots[k].compare_exchange_strong(expected, e))
+				return ReadGuard(&slots[k], current.load());
+		}
+		return ReadGuard();
+	}
+
+	//  Writer only: the version most recently published, valid until the next publish
+	//
+	const T *latest() const { return current.load(); }
+
+	//  Writer only: make next the current version and retire the previous one
+	//
+	void publish(const T *next) {
+		const T *old = current.exchange(next);
+		if (old) retired.push_back(Retired{ old, epoch.load() });
+		epoch.fetch_add(1);
+		reclaim();
+	}
+
+	//  Writer only: free retired versions no active reader can still hold
+	//
+	void reclaim() {
+		uint64_t oldest = UINT64_MAX;
+		for (int k = 0; k < maxReaders; k++) {
+			uint64_t e = slots[k].load();
+			if (e != 0 && e < oldest) oldest = e;
+		}
+		size_t kept = 0;
+		for (size_t k = 0; k < retired.size(); k++) {
+			if (retired[k].tag < oldest) delete retired[k].value;
+			else retired[kept++] = retired[k];
+		}
+		retired.resize(kept);
+	}
+
+	size_t retiredCount() const { return retired.size(); }
+
+private:
+	struct Retired {
+		const T *value;
+		uint64_t tag;
+	};
+	std::atomic<const T *> current;
+	std::atomic<uint64_t> epoch;
+	std::atomic<uint64_t> slots[maxReaders];
+	std::vector<Retired> retired;
+};
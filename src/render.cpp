@@ -0,0 +1,59 @@
+#include "render.h"
+#include "reproject.h"
+
+void RenderTarget::allocate(const RenderSettings &settings, const ofColor &background) {
+	this->settings = settings;
+	int width = settings.width, height = settings.height;
+	//The denoiser needs depth, normal and albedo as guides
+	unsigned int aovMask = settings.aovMask;
+	if (settings.denoise)
+		aovMask |= (1 << AOV_DEPTH) | (1 << AOV_NORMAL) | (1 << AOV_ALBEDO);
+	//Reprojection rebuilds the hits from these
+	if (settings.reproject)
+		aovMask |= ReprojectionCache::aovMask;
+	aovs.allocate(width, height, aovMask);
+	//Crop is given top down, rows are bottom up
+	colBegin = ofClamp(settings.crop.x, 0, 1) * width;
+	colEnd = ofClamp(settings.crop.z, 0, 1) * width;
+	rowBegin = height - ofClamp(settings.crop.w, 0, 1) * height;
+	rowEnd = height - ofClamp(settings.crop.y, 0, 1) * height;
+	//Pixels are only stored once traced, the rest read as the background
+	frame.allocate(width, height, settings.frameBudget, colBegin, colEnd, rowBegin, rowEnd);
+	beauty = frame.addChannel("beauty", 3, settings.beautyFormat, glm::vec3(background.r, background.g, background.b) / 255.0f);
+	nextRow = rowBegin;
+	tilesX = (width + tileSize - 1) / tileSize;
+	regionWidth = regionHeight = tileSize;
+	traceMask.clear();
+	reusedPixels = 0;
+}
+
+void RenderTarget::toImage(ofImage &image) const {
+	int width = settings.width, height = settings.height;
+	if (image.getWidth() != width || image.getHeight() != height || image.getPixels().getNumChannels() != 3)
+		image.allocate(width, height, OF_IMAGE_COLOR);
+	toRGB(0, width, 0, height, image.getPixels().getData());
+	image.update();
+}
+
+void RenderTarget::toRGB(int x0, int x1, int y0, int y1, vector<unsigned char> &rgb) const {
+	rgb.resize(max(0, (x1 - x0) * (y1 - y0) * 3));
+	toRGB(x0, x1, y0, y1, rgb.data());
+}
+
+void RenderTarget::toRGB(int x0, int x1, int y0, int y1, unsigned char *rgb) const {
+	//A band of tile rows at a time, round back to 8 bit
+	int w = x1 - x0;
+	vector<glm::vec3> band;
+	for (int b0 = y0; b0 < y1; b0 = (b0 / FrameBuffer::tileSize + 1) * FrameBuffer::tileSize)
+	{
+		int b1 = min(y1, (b0 / FrameBuffer::tileSize + 1) * FrameBuffer::tileSize);
+		frame.read(beauty, x0, x1, b0, b1, band);
+		for (int j = b0; j < b1; j++)
+		{
+			unsigned char *out = rgb + (y1 - 1 - j) * w * 3;
+			for (int i = 0; i < w; i++)
+				for (int c = 0; c < 3; c++)
+					out[i * 3 + c] = ofClamp(band[(j - b0) * w + i][c], 0, 1) * 255 + 0.5;
+		}
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "ofMain.h"
+#include "aov.h"
+#include "framebuffer.h"
+#include "rcu.h"
+#include "shadowmap.h"
+#include "irradiance.h"
+#include "wavefront.h"
+
+class SceneObject;
+class ReprojectionCache;
+struct SceneSnapshot;
+
+//  Quality settings for one render pass
+//
+struct RenderSettings {
+	int width = 1200;
+	int height = 800;
+	int samples = 1;                       // pixel samples
+	bool softShadows = false;
+	int shadowSamples = 16;
+	bool denoise = false;
+	unsigned int aovMask = 0;              // bit (1 << AOVType) per AOV
+	glm::vec4 crop = glm::vec4(0, 0, 1, 1);
+	bool shadowMaps = false;               // shadow map lookups instead of shadow rays
+	int shadowMapSize = 512;
+	float shadowBias = 0.05;               // world units
+	bool wavefront = false;                // batched stage by stage renderer
+	bool reproject = false;                // reuse the previous frame where still valid
+	bool indirect = false;                 // diffuse interreflection from an irradiance cache instead of flat ambient
+	IrradianceSettings irradiance;
+	int environmentSamples = 16;           // environment light shadow rays per shading point
+	bool environmentImportance = true;     // from the map's alias tables, uniform over the hemisphere if off
+	FrameFormat beautyFormat = FRAME_FLOAT32;
+	size_t frameBudget = 0;                // bytes of frame buffer tiles kept in memory, 0 for no limit
+	bool verbose = true;                   // print timings
+};
+
+//  Output and per pass state of a render. Rows are in render order (row 0 is the
+//  bottom of the image) so a pass can be traced a few rows at a time.
+//
+class RenderTarget {
+public:
+	void allocate(const RenderSettings &settings, const ofColor &background);
+	bool done() const { return nextRow >= rowEnd; }
+	//  Copy to an 8 bit image, flipped right side up
+	//
+	void toImage(ofImage &image) const;
+	//  8 bit RGB of the pixels [x0, x1) x [y0, y1), rows top down like toImage
+	//
+	void toRGB(int x0, int x1, int y0, int y1, vector<unsigned char> &rgb) const;
+	void toRGB(int x0, int x1, int y0, int y1, unsigned char *rgb) const;
+	//  Render threads, pixel (i, j) of the beauty channel
+	//
+	void setPixel(int i, int j, const glm::vec3 &color) { frame.set(beauty, i, j, color); }
+
+	RenderSettings settings;
+	RCUPointer<SceneSnapshot>::ReadGuard snapshot;   // scene version this pass renders
+	FrameBuffer frame;
+	int beauty = 0;                        // frame channel of the pixel colors in [0, 1]
+	AOVBuffers aovs;
+	int tileSize = 16;
+	int regionWidth = 16, regionHeight = 16;   // pixels per scheduler work unit
+	int tilesX = 0;
+	vector<vector<SceneObject *>> tileLists;
+	map<SceneObject *, int> objectIds;
+	shared_ptr<const ShadowMapSet> shadowMaps;
+	shared_ptr<IrradianceCache> irradiance;
+	shared_ptr<WavefrontStats> wavefrontStats;
+	shared_ptr<const WavefrontGeometry> occluders;   // whole scene for wavefront shadow rays
+	int colBegin = 0, colEnd = 0;          // crop region in pixels
+	int rowBegin = 0, rowEnd = 0;
+	int nextRow = 0;
+	uint64_t startTime = 0;
+	glm::vec3 origin;                      // camera raster captured when the pass began
+	glm::vec3 rasterOrigin, rasterStepX, rasterStepY;
+	vector<unsigned char> traceMask;       // per pixel, 0 if reprojection filled it; empty traces all
+	int reusedPixels = 0;
+	ReprojectionCache *reprojection = NULL;   // keeps this pass once finished
+};
@@ -0,0 +1,166 @@
+#include "reproject.h"
+#include "render.h"
+#include "ofApp.h"
+
+static const float infinity = std::numeric_limits<float>::infinity();
+
+bool ReprojectionCache::compatible(const RenderTarget &target) const {
+	const RenderSettings &s = target.settings;
+	return valid && target.snapshot && target.snapshot->version == version && s.samples == samples &&
+		s.softShadows == softShadows && s.shadowSamples == shadowSamples && s.shadowMaps == shadowMaps &&
+		s.shadowMapSize == shadowMapSize && s.shadowBias == shadowBias && s.crop == crop &&
+		s.indirect == indirect && (!indirect || s.irradiance == irradiance) &&
+		s.environmentSamples == environmentSamples && s.environmentImportance == environmentImportance;
+}
+
+void ReprojectionCache::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	valid = false;
+	points.clear();
+	normals.clear();
+	ids.clear();
+	albedo.clear();
+	for (int c = 0; c < 3; c++)
+		colors[c].clear();
+}
+
+void ReprojectionCache::store(const RenderTarget &target) {
+	const AOVBuffers &aovs = target.aovs;
+	if ((aovs.mask & aovMask) != aovMask || !target.snapshot)
+		return;
+	std::lock_guard<std::mutex> lock(mutex);
+	const RenderSettings &s = target.settings;
+	version = target.snapshot->version;
+	phong = target.snapshot->phong;
+	samples = s.samples;
+	softShadows = s.softShadows;
+	shadowSamples = s.shadowSamples;
+	shadowMaps = s.shadowMaps;
+	shadowMapSize = s.shadowMapSize;
+	shadowBias = s.shadowBias;
+	indirect = s.indirect;
+	irradiance = s.irradiance;
+	environmentSamples = s.environmentSamples;
+	environmentImportance = s.environmentImportance;
+	crop = s.crop;
+	eye = target.origin;
+	points.clear();
+	normals.clear();
+	ids.clear();
+	albedo.clear();
+	for (int c = 0; c < 3; c++)
+		colors[c].clear();
+	const float *depth = aovs.plane(AOV_DEPTH), *id = aovs.plane(AOV_OBJECT_ID);
+	const float *normal[3] = { aovs.plane(AOV_NORMAL, 0), aovs.plane(AOV_NORMAL, 1), aovs.plane(AOV_NORMAL, 2) };
+	bool hasAlbedo = aovs.enabled(AOV_ALBEDO);
+	//The AOVs hold the first sample's hit, rebuilt along the pixel center.
+	//Colors come a band of frame buffer tiles at a time.
+	vector<glm::vec3> band;
+	int bandBegin = target.rowBegin, cropWidth = target.colEnd - target.colBegin;
+	for (int j = target.rowBegin; j < target.rowEnd; j++) {
+		if (j == target.rowBegin || j % FrameBuffer::tileSize == 0) {
+			bandBegin = j;
+			target.frame.read(target.beauty, target.colBegin, target.colEnd, j, min(target.rowEnd, (j / FrameBuffer::tileSize + 1) * FrameBuffer::tileSize), band);
+		}
+		for (int i = target.colBegin; i < target.colEnd; i++) {
+			int p = j * s.width + i;
+			if (id[p] == 0) continue;
+			glm::vec3 d = glm::normalize(target.rasterOrigin + target.rasterStepX * (i + 0.5f) + target.rasterStepY * (j + 0.5f));
+			points.push_back(target.origin + d * depth[p]);
+			normals.push_back(glm::vec3(normal[0][p], normal[1][p], normal[2][p]));
+			ids.push_back(id[p]);
+			const glm::vec3 &color = band[(j - bandBegin) * cropWidth + i - target.colBegin];
+			for (int c = 0; c < 3; c++)
+				colors[c].push_back(color[c]);
+			if (hasAlbedo)
+				albedo.push_back(glm::vec3(aovs.plane(AOV_ALBEDO, 0)[p], aovs.plane(AOV_ALBEDO, 1)[p], aovs.plane(AOV_ALBEDO, 2)[p]));
+		}
+	}
+	frame++;
+	valid = true;
+}
+
+int ReprojectionCache::reproject(RenderTarget &target) {
+	const RenderSettings &s = target.settings;
+	int width = s.width, height = s.height;
+	target.traceMask.assign(width * height, 1);
+	target.reusedPixels = 0;
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!compatible(target))
+		return 0;
+	//Raster position of a point: p - eye = a (rasterOrigin + x stepX + y stepY)
+	glm::mat3 toRaster = glm::inverse(glm::mat3(target.rasterOrigin, target.rasterStepX, target.rasterStepY));
+	float cosView = cos(glm::radians(maxViewAngle));
+	//Nearest stored hit in each pixel
+	vector<float> depth(width * height, infinity);
+	vector<int> source(width * height, -1);
+	for (int k = 0; k < points.size(); k++) {
+		glm::vec3 v = points[k] - target.origin;
+		if (glm::dot(normals[k], v) >= 0) continue;
+		glm::vec3 r = toRaster * v;
+		if (r.x <= 0) continue;
+		int i = floor(r.y / r.x), j = floor(r.z / r.x);
+		if (i < target.colBegin || i >= target.colEnd || j < target.rowBegin || j >= target.rowEnd) continue;
+		float d = glm::length(v);
+		if (phong && glm::dot(v / d, glm::normalize(points[k] - eye)) < cosView) continue;
+		int p = j * width + i;
+		if (d < depth[p]) {
+			depth[p] = d;
+			source[p] = k;
+		}
+	}
+	//An empty pixel mostly surrounded by splats is a gap, not background or a disocclusion
+	auto isGap = [&](int i, int j) {
+		int covered = 0;
+		for (int dj = -1; dj <= 1; dj++)
+			for (int di = -1; di <= 1; di++)
+				if (i + di >= target.colBegin && i + di < target.colEnd && j + dj >= target.rowBegin && j + dj < target.rowEnd)
+					covered += source[(j + dj) * width + i + di] >= 0;
+		return covered >= 5;
+	};
+	int period = max(1, int(round(1 / refreshFraction)));
+	int reused = 0;
+	for (int j = target.rowBegin; j < target.rowEnd; j++) {
+		for (int i = target.colBegin; i < target.colEnd; i++) {
+			int p = j * width + i;
+			int k = source[p];
+			if (k < 0) continue;
+			if ((((uint32_t)p * 2654435761u) >> 16) % period == frame % period) continue;
+			//A nearer neighbour off this hit's tangent plane means the hit shows through
+			//a gap. Splats are up to half a pixel off, so silhouettes and sharp color
+			//edges are traced again too.
+			bool reject = false;
+			for (int dj = -1; dj <= 1 && !reject; dj++) {
+				for (int di = -1; di <= 1 && !reject; di++) {
+					int ni = i + di, nj = j + dj;
+					if (ni < target.colBegin || ni >= target.colEnd || nj < target.rowBegin || nj >= target.rowEnd) continue;
+					int q = source[nj * width + ni];
+					if (q == k) continue;
+					if (q < 0) {
+						//Gaps between splats inside a surface are traced but do not count as edges
+						reject = !isGap(ni, nj);
+						continue;
+					}
+					if (ids[q] != ids[k]) {
+						reject = true;
+						break;
+					}
+					reject = depth[nj * width + ni] < depth[p] * (1 - depthTolerance) &&
+						fabs(glm::dot(normals[k], points[q] - points[k])) > depthTolerance * depth[p];
+					for (int c = 0; c < 3 && !reject; c++)
+						reject = fabs(colors[c][q] - colors[c][k]) > colorTolerance;
+				}
+			}
+			if (reject) continue;
+			target.setPixel(i, j, glm::vec3(colors[0][k], colors[1][k], colors[2][k]));
+			if (!target.aovs.empty()) {
+				glm::vec3 a = albedo.empty() ? glm::vec3(0) : albedo[k] * 255.0f;
+				target.aovs.write(i, j, depth[p], normals[k], ids[k], ofColor(a.x, a.y, a.z));
+			}
+			target.traceMask[p] = 0;
+			reused++;
+		}
+	}
+	target.reusedPixels = reused;
+	return reused;
+}
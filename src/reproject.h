@@ -0,0 +1,66 @@
+#pragma once
+
+#include "ofMain.h"
+#include "aov.h"
+#include "irradiance.h"
+#include <mutex>
+
+class RenderTarget;
+
+//  Reuse of the previous frame when only the camera moved. store() keeps the
+//  primary hit of every pixel of a finished pass (world position, normal,
+//  object) with its color. reproject() splats those hits into the new view
+//  with a depth test and keeps a pixel's old color when
+//
+//  - the hit faces the new eye
+//  - no nearer neighbour lies off the hit's tangent plane (else the hit was
+//    seen through a gap of the new foreground, a disocclusion)
+//  - all neighbours hit the same object with similar colors, as splats land
+//    up to half a pixel off and would move silhouettes and shadow edges
+//  - with Phong, the view direction turned less than maxViewAngle
+//
+//  Everything else is marked in RenderTarget::traceMask for the renderer, as is
+//  a rotating refreshFraction of the reused pixels so errors do not persist.
+//  Any scene or shading edit publishes a new scene version, which invalidates
+//  the stored frame, as does any change of sampling or shadow settings.
+//  Resolution may change between frames, so the preview can rescale.
+//
+class ReprojectionCache {
+public:
+	static const unsigned int aovMask = (1 << AOV_DEPTH) | (1 << AOV_NORMAL) | (1 << AOV_OBJECT_ID);
+
+	//  Fill target's reusable pixels, beauty and AOVs, and its trace mask.
+	//  Call after the pass's raster and snapshot are set. Returns pixels reused.
+	//
+	int reproject(RenderTarget &target);
+	//  Keep a finished pass, before denoising. Safe from any thread.
+	//
+	void store(const RenderTarget &target);
+	void clear();
+
+	float refreshFraction = 1.0f / 16;
+	float depthTolerance = 0.02;           // relative to the distance
+	float colorTolerance = 0.05;           // largest neighbour difference per channel
+	float maxViewAngle = 2;                // degrees, Phong only
+
+private:
+	bool compatible(const RenderTarget &target) const;
+
+	std::mutex mutex;
+	bool valid = false;
+	uint64_t version = 0;                  // scene version of the stored frame
+	int samples = 0, shadowSamples = 0, shadowMapSize = 0;
+	bool softShadows = false, shadowMaps = false, phong = false, indirect = false;
+	IrradianceSettings irradiance;
+	int environmentSamples = 0;
+	bool environmentImportance = false;
+	float shadowBias = 0;
+	glm::vec4 crop;
+	glm::vec3 eye;
+	int frame = 0;                         // stored frames, rotates the refresh pattern
+	//Hits of the stored frame
+	vector<glm::vec3> points, normals;
+	vector<float> ids;
+	vector<float> colors[3];
+	vector<glm::vec3> albedo;              // empty unless the pass had the albedo AOV
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include "glm/glm.hpp"
+
+//  2D sample patterns used for area light (and later pixel) sampling
+//
+//  SAMPLER_RANDOM      - independent uniform random samples
+//  SAMPLER_STRATIFIED  - jittered grid, one sample per cell
+//  SAMPLER_HALTON      - Halton (2, 3) low-discrepancy sequence
+//
+enum SamplerType {
+	SAMPLER_RANDOM,
+	SAMPLER_STRATIFIED,
+	SAMPLER_HALTON,
+	SAMPLER_COUNT
+};
+
+inline const char *samplerName(SamplerType type) {
+	switch (type) {
+	case SAMPLER_RANDOM: return "Random";
+	case SAMPLER_STRATIFIED: return "Stratified";
+	case SAMPLER_HALTON: return "Halton";
+	default: return "Unknown";
+	}
+}
+
+//  Hash used to decorrelate sample patterns between shading points
+//
+inline uint32_t hashUInt(uint32_t x) {
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+inline uint32_t hashPoint(const glm::vec3 &p) {
+	union { float f; uint32_t u; } x, y, z;
+	x.f = p.x; y.f = p.y; z.f = p.z;
+	return hashUInt(x.u ^ hashUInt(y.u ^ hashUInt(z.u)));
+}
+
+//  Radical inverse of i in the given prime base, in [0, 1)
+//
+inline float radicalInverse(uint32_t i, uint32_t base) {
+	float inv = 1.0f / base;
+	float f = inv;
+	float result = 0;
+	while (i > 0) {
+		result += f * (i % base);
+		i /= base;
+		f *= inv;
+	}
+	return result;
+}
+
+//  Generates "count" 2D samples in [0, 1)^2.  Each sampler is seeded per shading
+//  point, so neighbouring pixels get different (rotated/jittered) patterns and
+//  the remaining error shows up as noise rather than banding.
+//
+class Sampler {
+public:
+	Sampler(SamplerType type, int count, uint32_t seed) {
+		this->type = type;
+		this->count = count > 0 ? count : 1;
+		state = hashUInt(seed) | 1;
+		offset = glm::vec2(nextFloat(), nextFloat());
+		cellsX = (int)floor(sqrt((float)this->count));
+		cellsY = (this->count + cellsX - 1) / cellsX;
+		stride = strideFor(cellsX * cellsY);
+	}
+
+	//  Sample i of count.  Any prefix of the sequence is well spread, which lets
+	//  the adaptive shadow estimator stop after the first few samples.
+	//
+	glm::vec2 get(int i) {
+		switch (type) {
+		case SAMPLER_STRATIFIED: {
+			int cell = (int)(((int64_t)i * stride) % (cellsX * cellsY));
+			return glm::vec2(((cell % cellsX) + nextFloat()) / cellsX, ((cell / cellsX) + nextFloat()) / cellsY);
+		}
+		case SAMPLER_HALTON:
+			return glm::vec2(wrap(radicalInverse(i + 1, 2) + offset.x), wrap(radicalInverse(i + 1, 3) + offset.y));
+		default:
+			return glm::vec2(nextFloat(), nextFloat());
+		}
+	}
+
+	float nextFloat() {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return (state >> 8) * (1.0f / 16777216.0f);
+	}
+
+	SamplerType type;
+	int count;
+
+private:
+	static float wrap(float x) { return x >= 1.0f ? x - 1.0f : x; }
+
+	//  Visit grid cells in a golden ratio order so early samples cover the grid
+	//
+	static int strideFor(int n) {
+		int s = (int)(n * 0.618034f);
+		if (s < 1) s = 1;
+		while (gcd(s, n) != 1) s++;
+		return s;
+	}
+	static int gcd(int a, int b) { return b == 0 ? a : gcd(b, a % b); }
+
+	uint32_t state;
+	glm::vec2 offset;
+	int cellsX, cellsY, stride;
+};
+
+//  Map a square sample to a uniformly distributed point on the unit disk
+//
+inline glm::vec2 squareToDisk(const glm::vec2 &uv) {
+	float r = sqrt(uv.x);
+	float phi = 2.0f * 3.14159265f * uv.y;
+	return glm::vec2(r * cos(phi), r * sin(phi));
+}
+
+//  Build two unit vectors perpendicular to n (n must be normalized)
+//
+inline void orthonormalBasis(const glm::vec3 &n, glm::vec3 &u, glm::vec3 &v) {
+	glm::vec3 a = fabs(n.x) > 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+	u = glm::normalize(glm::cross(a, n));
+	v = glm::cross(n, u);
+}
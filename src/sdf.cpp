@@ -0,0 +1,193 @@
+#include "sdf.h"
+#include "glm/gtx/euler_angles.hpp"
+
+string SdfStats::report(const string &name) {
+	uint64_t n = rays.load(), marched = n - culled.load();
+	string text = "Implicit " + name + ": " + ofToString((int)n) + " rays, " + ofToString(100.0 * culled.load() / max(n, uint64_t(1)), 1) +
+		"% outside bounds; marched rays average " + ofToString(double(steps.load()) / max(marched, uint64_t(1)), 1) + " steps and " +
+		ofToString(double(evaluations.load()) / max(marched, uint64_t(1)), 1) + " primitive evaluations, " +
+		ofToString((int)hits.load()) + " hits, " + ofToString((int)exhausted.load()) + " out of budget";
+	rays = 0;
+	culled = 0;
+	hits = 0;
+	exhausted = 0;
+	steps = 0;
+	evaluations = 0;
+	return text;
+}
+
+SdfSphere::SdfSphere(const glm::vec3 &center, float radius) : center(center), radius(radius) {
+	boundsMin = center - glm::vec3(radius);
+	boundsMax = center + glm::vec3(radius);
+}
+
+float SdfSphere::distance(const glm::vec3 &p, int &evaluations) const {
+	evaluations++;
+	return glm::length(p - center) - radius;
+}
+
+void SdfSphere::draw() const {
+	ofDrawSphere(center, radius);
+}
+
+SdfBox::SdfBox(const glm::vec3 &center, const glm::vec3 &halfSize) : center(center), halfSize(halfSize) {
+	boundsMin = center - halfSize;
+	boundsMax = center + halfSize;
+}
+
+float SdfBox::distance(const glm::vec3 &p, int &evaluations) const {
+	evaluations++;
+	glm::vec3 q = glm::abs(p - center) - halfSize;
+	return glm::length(glm::max(q, glm::vec3(0))) + min(max(q.x, max(q.y, q.z)), 0.0f);
+}
+
+void SdfBox::draw() const {
+	ofDrawBox(center, halfSize.x * 2, halfSize.y * 2, halfSize.z * 2);
+}
+
+//  The distance to a child's bounds is only a lower bound on its distance
+//  outside the bounds, so children are skipped only when p is outside
+//
+SdfUnion::SdfUnion(shared_ptr<const SdfNode> a, shared_ptr<const SdfNode> b) : a(a), b(b) {
+	boundsMin = glm::min(a->boundsMin, b->boundsMin);
+	boundsMax = glm::max(a->boundsMax, b->boundsMax);
+}
+
+float SdfUnion::distance(const glm::vec3 &p, int &evaluations) const {
+	//Nearer box first, the other is skipped if its box is no closer than the answer
+	float boundsA = a->boundsDistance(p), boundsB = b->boundsDistance(p);
+	const SdfNode *first = a.get(), *second = b.get();
+	if (boundsB < boundsA) {
+		swap(first, second);
+		swap(boundsA, boundsB);
+	}
+	float d = first->distance(p, evaluations);
+	if (boundsB > 0 && boundsB >= d)
+		return d;
+	return min(d, second->distance(p, evaluations));
+}
+
+void SdfUnion::draw() const {
+	a->draw();
+	b->draw();
+}
+
+SdfSmoothUnion::SdfSmoothUnion(shared_ptr<const SdfNode> a, shared_ptr<const SdfNode> b, float k) : a(a), b(b), k(k) {
+	boundsMin = glm::min(a->boundsMin, b->boundsMin) - glm::vec3(k / 4);
+	boundsMax = glm::max(a->boundsMax, b->boundsMax) + glm::vec3(k / 4);
+}
+
+float SdfSmoothUnion::distance(const glm::vec3 &p, int &evaluations) const {
+	float boundsA = a->boundsDistance(p), boundsB = b->boundsDistance(p);
+	const SdfNode *first = a.get(), *second = b.get();
+	if (boundsB < boundsA) {
+		swap(first, second);
+		swap(boundsA, boundsB);
+	}
+	float d1 = first->distance(p, evaluations);
+	//No blending once the other child is k farther away
+	if (boundsB > 0 && boundsB - d1 >= k)
+		return d1;
+	float d2 = second->distance(p, evaluations);
+	float h = max(k - fabs(d1 - d2), 0.0f) / k;
+	return min(d1, d2) - h * h * k / 4;
+}
+
+void SdfSmoothUnion::draw() const {
+	a->draw();
+	b->draw();
+}
+
+SdfSubtraction::SdfSubtraction(shared_ptr<const SdfNode> a, shared_ptr<const SdfNode> b) : a(a), b(b) {
+	boundsMin = a->boundsMin;
+	boundsMax = a->boundsMax;
+}
+
+float SdfSubtraction::distance(const glm::vec3 &p, int &evaluations) const {
+	float d = a->distance(p, evaluations);
+	float boundsB = b->boundsDistance(p);
+	//Outside b's box, -b is below -boundsB and cannot exceed d
+	if (boundsB > 0 && boundsB >= -d)
+		return d;
+	return max(d, -b->distance(p, evaluations));
+}
+
+void SdfSubtraction::draw() const {
+	a->draw();
+}
+
+SdfTransform::SdfTransform(shared_ptr<const SdfNode> child, const glm::vec3 &translate, const glm::vec3 &rotate, float scale) : child(child), scale(scale) {
+	toParent = glm::translate(glm::mat4(1.0), translate) *
+		glm::eulerAngleYXZ(glm::radians(rotate.y), glm::radians(rotate.x), glm::radians(rotate.z)) *
+		glm::scale(glm::mat4(1.0), glm::vec3(scale));
+	toChild = glm::inverse(toParent);
+	//Box around the child's transformed box
+	boundsMin = glm::vec3(std::numeric_limits<float>::max());
+	boundsMax = -boundsMin;
+	for (int c = 0; c < 8; c++) {
+		glm::vec3 corner((c & 1) ? child->boundsMax.x : child->boundsMin.x, (c & 2) ? child->boundsMax.y : child->boundsMin.y,
+			(c & 4) ? child->boundsMax.z : child->boundsMin.z);
+		glm::vec3 q = toParent * glm::vec4(corner, 1.0);
+		boundsMin = glm::min(boundsMin, q);
+		boundsMax = glm::max(boundsMax, q);
+	}
+}
+
+float SdfTransform::distance(const glm::vec3 &p, int &evaluations) const {
+	return child->distance(toChild * glm::vec4(p, 1.0), evaluations) * scale;
+}
+
+void SdfTransform::draw() const {
+	ofPushMatrix();
+	ofMultMatrix(toParent);
+	child->draw();
+	ofPopMatrix();
+}
+
+bool sphereTrace(const SdfNode &root, const glm::vec3 &o, const glm::vec3 &d, float tMax, const SdfLimits &limits, float &t, SdfStats &stats) {
+	stats.rays++;
+	//Clip the ray to the root bounds (slab test), nothing to march outside them
+	float tNear = 0, tFar = tMax;
+	for (int a = 0; a < 3; a++) {
+		float inv = 1 / d[a];
+		float t0 = (root.boundsMin[a] - o[a]) * inv, t1 = (root.boundsMax[a] - o[a]) * inv;
+		if (t0 > t1) swap(t0, t1);
+		tNear = max(tNear, t0);
+		tFar = min(tFar, t1);
+	}
+	if (tNear > tFar) {
+		stats.culled++;
+		return false;
+	}
+	int steps = 0, evaluations = 0;
+	bool hit = false;
+	t = tNear;
+	while (t <= tFar) {
+		if (steps == limits.maxSteps || evaluations >= limits.maxEvaluations) {
+			stats.exhausted++;
+			break;
+		}
+		steps++;
+		float dist = root.distance(o + d * t, evaluations);
+		if (dist < limits.epsilon) {
+			hit = true;
+			break;
+		}
+		t += dist;
+	}
+	stats.steps += steps;
+	stats.evaluations += evaluations;
+	if (hit) stats.hits++;
+	return hit;
+}
+
+glm::vec3 sdfNormal(const SdfNode &root, const glm::vec3 &p, float h, SdfStats &stats) {
+	//Tetrahedral differences, four evaluations instead of six
+	const glm::vec3 k0(1, -1, -1), k1(-1, -1, 1), k2(-1, 1, -1), k3(1, 1, 1);
+	int evaluations = 0;
+	glm::vec3 g = k0 * root.distance(p + k0 * h, evaluations) + k1 * root.distance(p + k1 * h, evaluations) +
+		k2 * root.distance(p + k2 * h, evaluations) + k3 * root.distance(p + k3 * h, evaluations);
+	stats.evaluations += evaluations;
+	float length = glm::length(g);
+	return length > 0 ? g / length : glm::vec3(0, 1, 0);
+}
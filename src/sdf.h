@@ -0,0 +1,112 @@
+#pragma once
+
+#include "ofMain.h"
+#include <atomic>
+
+//  Marching work of one implicit surface since the last report, summed over
+//  all threads
+//
+struct SdfStats {
+	std::atomic<uint64_t> rays{ 0 }, culled{ 0 }, hits{ 0 }, exhausted{ 0 };
+	std::atomic<uint64_t> steps{ 0 }, evaluations{ 0 };
+	string report(const string &name);
+};
+
+//  Node of a signed distance function tree, negative inside. distance() must
+//  never exceed the distance to the surface, so sphere tracing cannot step
+//  through it. Every node has a box in its own space that contains its
+//  surface; combining nodes skip a child whose box is farther than the answer
+//  could change. evaluations counts the primitives evaluated.
+//
+class SdfNode {
+public:
+	virtual ~SdfNode() {}
+	virtual float distance(const glm::vec3 &p, int &evaluations) const = 0;
+	virtual void draw() const = 0;
+
+	//  Distance from p to the bounds, 0 inside them
+	//
+	float boundsDistance(const glm::vec3 &p) const {
+		glm::vec3 q = glm::max(glm::max(boundsMin - p, p - boundsMax), glm::vec3(0));
+		return glm::length(q);
+	}
+	glm::vec3 boundsMin, boundsMax;
+};
+
+class SdfSphere : public SdfNode {
+public:
+	SdfSphere(const glm::vec3 &center, float radius);
+	float distance(const glm::vec3 &p, int &evaluations) const;
+	void draw() const;
+	glm::vec3 center;
+	float radius;
+};
+
+class SdfBox : public SdfNode {
+public:
+	SdfBox(const glm::vec3 &center, const glm::vec3 &halfSize);
+	float distance(const glm::vec3 &p, int &evaluations) const;
+	void draw() const;
+	glm::vec3 center, halfSize;
+};
+
+class SdfUnion : public SdfNode {
+public:
+	SdfUnion(shared_ptr<const SdfNode> a, shared_ptr<const SdfNode> b);
+	float distance(const glm::vec3 &p, int &evaluations) const;
+	void draw() const;
+	shared_ptr<const SdfNode> a, b;
+};
+
+//  Union blended over distance k (polynomial smooth minimum), the surface
+//  grows by at most k / 4 where the two meet
+//
+class SdfSmoothUnion : public SdfNode {
+public:
+	SdfSmoothUnion(shared_ptr<const SdfNode> a, shared_ptr<const SdfNode> b, float k);
+	float distance(const glm::vec3 &p, int &evaluations) const;
+	void draw() const;
+	shared_ptr<const SdfNode> a, b;
+	float k;
+};
+
+//  a with b cut away
+//
+class SdfSubtraction : public SdfNode {
+public:
+	SdfSubtraction(shared_ptr<const SdfNode> a, shared_ptr<const SdfNode> b);
+	float distance(const glm::vec3 &p, int &evaluations) const;
+	void draw() const;
+	shared_ptr<const SdfNode> a, b;
+};
+
+//  child moved, rotated (degrees, the same Euler order as SceneObject) and
+//  scaled uniformly; non uniform scale would break the distance bound
+//
+class SdfTransform : public SdfNode {
+public:
+	SdfTransform(shared_ptr<const SdfNode> child, const glm::vec3 &translate, const glm::vec3 &rotate = glm::vec3(0), float scale = 1);
+	float distance(const glm::vec3 &p, int &evaluations) const;
+	void draw() const;
+	shared_ptr<const SdfNode> child;
+	glm::mat4 toParent, toChild;
+	float scale;
+};
+
+//  Budget of one sphere traced ray. A ray that runs out of steps or primitive
+//  evaluations before reaching the surface counts as a miss.
+//
+struct SdfLimits {
+	int maxSteps = 128;
+	int maxEvaluations = 2048;
+	float epsilon = 0.001;     // hit distance, also the normal's difference step
+};
+
+//  March o + t d (d unit, local space of root) from where it enters root's
+//  bounds until the distance falls below epsilon, for t below tMax. Sets t.
+//
+bool sphereTrace(const SdfNode &root, const glm::vec3 &o, const glm::vec3 &d, float tMax, const SdfLimits &limits, float &t, SdfStats &stats);
+
+//  Unit normal from the distance gradient (four evaluations)
+//
+glm::vec3 sdfNormal(const SdfNode &root, const glm::vec3 &p, float h, SdfStats &stats);
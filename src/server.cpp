@@ -0,0 +1,221 @@
+#include "server.h"
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#if defined(MSG_NOSIGNAL)
+static const int sendFlags = MSG_NOSIGNAL;
+#else
+static const int sendFlags = 0;
+#endif
+
+static void setNonBlocking(int fd) {
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+bool RenderServer::start(const string &path) {
+	if (running.load()) return true;
+	sockaddr_un address;
+	if (path.size() >= sizeof(address.sun_path)) {
+		cout << "Render server: socket path too long: " << path << endl;
+		return false;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+	//A stale socket from a previous run would make bind fail
+	unlink(path.c_str());
+	listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenFd < 0 || bind(listenFd, (sockaddr *)&address, sizeof(address)) != 0 || listen(listenFd, 8) != 0) {
+		cout << "Render server: cannot listen on " << path << ": " << strerror(errno) << endl;
+		if (listenFd >= 0) close(listenFd);
+		listenFd = -1;
+		return false;
+	}
+	if (pipe(wakeFds) != 0) {
+		close(listenFd);
+		listenFd = -1;
+		return false;
+	}
+	setNonBlocking(listenFd);
+	setNonBlocking(wakeFds[0]);
+	setNonBlocking(wakeFds[1]);
+#if !defined(MSG_NOSIGNAL)
+	//Writing to a client that went away must not kill the app
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	this->path = path;
+	running.store(true);
+	thread = std::thread(&RenderServer::serve, this);
+	cout << "Render server listening on " << path << endl;
+	return true;
+}
+
+void RenderServer::stop() {
+	if (!running.load()) return;
+	running.store(false);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		wake();
+	}
+	thread.join();
+	//Render threads may still send, they find no clients and no pipe
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto it = clients.begin(); it != clients.end(); it++)
+		close(it->second.fd);
+	clients.clear();
+	commands.clear();
+	close(listenFd);
+	close(wakeFds[0]);
+	close(wakeFds[1]);
+	listenFd = wakeFds[0] = wakeFds[1] = -1;
+	unlink(path.c_str());
+}
+
+void RenderServer::wake() {
+	char byte = 0;
+	if (wakeFds[1] >= 0 && write(wakeFds[1], &byte, 1) < 0) {
+		//Pipe full, the server thread is already due to wake up
+	}
+}
+
+void RenderServer::send(int client, const string &line) {
+	send(client, line, vector<unsigned char>());
+}
+
+void RenderServer::send(int client, const string &line, const vector<unsigned char> &payload) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto found = clients.find(client);
+	if (found == clients.end()) return;
+	string &out = found->second.out;
+	out += line;
+	out += '\n';
+	out.append((const char *)payload.data(), payload.size());
+	wake();
+}
+
+int RenderServer::numClients() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return clients.size();
+}
+
+void RenderServer::poll(CommandFunction handler) {
+	deque<pair<int, string>> pending;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.swap(commands);
+	}
+	for (int k = 0; k < pending.size(); k++)
+		handler(pending[k].first, pending[k].second);
+}
+
+//  Socket thread: accept clients, split their input into lines, flush output
+//
+void RenderServer::serve() {
+	vector<pollfd> fds;
+	vector<int> ids;
+	char buffer[65536];
+	while (running.load()) {
+		fds.clear();
+		ids.clear();
+		fds.push_back(pollfd{ listenFd, POLLIN, 0 });
+		fds.push_back(pollfd{ wakeFds[0], POLLIN, 0 });
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto it = clients.begin(); it != clients.end(); it++) {
+				fds.push_back(pollfd{ it->second.fd, short(POLLIN | (it->second.sent < it->second.out.size() ? POLLOUT : 0)), 0 });
+				ids.push_back(it->first);
+			}
+		}
+		if (::poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR)
+			break;
+		if (fds[1].revents & POLLIN)
+			while (read(wakeFds[0], buffer, sizeof(buffer)) > 0) {}
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(listenFd, NULL, NULL);
+			if (fd >= 0) {
+				setNonBlocking(fd);
+#if defined(SO_NOSIGPIPE)
+				int one = 1;
+				setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+				std::lock_guard<std::mutex> lock(mutex);
+				clients[nextClient++].fd = fd;
+			}
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int k = 0; k < ids.size(); k++) {
+			auto found = clients.find(ids[k]);
+			if (found == clients.end()) continue;
+			Client &client = found->second;
+			short events = fds[k + 2].revents;
+			bool closed = (events & (POLLERR | POLLNVAL)) != 0;
+			if (events & (POLLIN | POLLHUP)) {
+				ssize_t n = recv(client.fd, buffer, sizeof(buffer), 0);
+				if (n > 0) {
+					client.in.append(buffer, n);
+					size_t end;
+					while ((end = client.in.find('\n')) != string::npos) {
+						string line = client.in.substr(0, end);
+						if (!line.empty() && line.back() == '\r') line.pop_back();
+						if (!line.empty()) commands.push_back(make_pair(ids[k], line));
+						client.in.erase(0, end + 1);
+					}
+				}
+				else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+					closed = true;
+			}
+			while (!closed && client.sent < client.out.size()) {
+				ssize_t n = ::send(client.fd, client.out.data() + client.sent, client.out.size() - client.sent, sendFlags);
+				if (n > 0)
+					client.sent += n;
+				else {
+					closed = n < 0 && errno != EAGAIN && errno != EWOULDBLOCK;
+					break;
+				}
+			}
+			//Drop written bytes once drained, or once they are most of the buffer so it can't grow unbounded
+			if (client.sent == client.out.size()) {
+				client.out.clear();
+				client.sent = 0;
+			}
+			else if (client.sent > client.out.size() / 2) {
+				client.out.erase(0, client.sent);
+				client.sent = 0;
+			}
+			if (client.out.size() - client.sent > maxPending) {
+				cout << "Render server: client " << ids[k] << " is not reading, dropped" << endl;
+				closed = true;
+			}
+			if (closed) {
+				close(client.fd);
+				clients.erase(found);
+			}
+		}
+	}
+}
+
+#else
+
+//  No Unix domain sockets, the server reports itself unavailable
+//
+bool RenderServer::start(const string &path) {
+	cout << "Render server: not supported on this platform" << endl;
+	return false;
+}
+void RenderServer::stop() {}
+void RenderServer::wake() {}
+void RenderServer::send(int client, const string &line) {}
+void RenderServer::send(int client, const string &line, const vector<unsigned char> &payload) {}
+int RenderServer::numClients() { return 0; }
+void RenderServer::poll(CommandFunction handler) {}
+void RenderServer::serve() {}
+
+#endif
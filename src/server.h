@@ -0,0 +1,72 @@
+#pragma once
+
+#include "ofMain.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+//  Local render server on a Unix domain socket. Clients send one command per
+//  line; replies and streamed tiles go back as text lines, some followed by a
+//  binary payload whose size the line gives. The socket thread only moves
+//  bytes: commands are queued for the main thread (poll), which owns the scene,
+//  and any thread may queue output for a client (send).
+//
+//  Protocol, client to server:
+//  scene                                   list objects, one "object" line each
+//  move <object> <x> <y> <z>               set an object's position
+//  intensity <light> <value>               set a light's intensity
+//  camera <px> <py> <pz> <tx> <ty> <tz>    place the server camera, looking at t
+//  render <width> <height> [samples]       render, replacing this client's last job; at most 8192 per side
+//  reproject <on|off>                      reuse the previous frame's pixels
+//  cancel                                  cancel this client's job
+//  stats                                   scene version, jobs and cache counters
+//  shutdown                                quit the application
+//
+//  Server to client:
+//  ok <details> | error <message>
+//  job <id>
+//  tile <id> <x> <y> <w> <h>               then w * h * 3 bytes RGB, rows top down
+//  image <id> <w> <h>                      then the finished (denoised) image
+//  done <id> <ms> <reused> | cancelled <id>   reused: fraction of pixels reprojected
+//
+class RenderServer {
+public:
+	typedef std::function<void(int client, const string &line)> CommandFunction;
+
+	~RenderServer() { stop(); }
+	bool start(const string &path);
+	void stop();
+	bool isRunning() const { return running.load(); }
+	const string &getPath() const { return path; }
+
+	//  Main thread: run handler for every command received since the last call
+	//
+	void poll(CommandFunction handler);
+
+	//  Any thread: queue bytes for a client, dropped once it has disconnected
+	//
+	void send(int client, const string &line);
+	void send(int client, const string &line, const vector<unsigned char> &payload);
+	int numClients();
+
+	static const size_t maxPending = size_t(256) << 20;   // output bytes before a client is dropped
+
+private:
+	struct Client {
+		int fd = -1;
+		string in, out;
+		size_t sent = 0;                         // bytes of out already written
+	};
+	void serve();
+	void wake();                                 // with mutex held, stop closes the pipe under it
+
+	std::mutex mutex;
+	map<int, Client> clients;                    // by client id, guarded by mutex
+	deque<pair<int, string>> commands;
+	std::thread thread;
+	std::atomic<bool> running{ false };
+	int listenFd = -1;
+	int wakeFds[2] = { -1, -1 };
+	int nextClient = 1;
+	string path;
+};
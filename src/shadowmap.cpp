@@ -0,0 +1,131 @@
+#include "shadowmap.h"
+#include <atomic>
+#include <thread>
+
+void ShadowMap::buildSpot(const glm::vec3 &position, const glm::vec3 &direction, float cone, int size, RayCast cast) {
+	this->position = position;
+	this->size = size;
+	Face face;
+	face.forward = glm::length(direction) > 1e-6f ? glm::normalize(direction) : glm::vec3(0, -1, 0);
+	glm::vec3 a = fabs(face.forward.y) > 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+	face.right = glm::normalize(glm::cross(face.forward, a));
+	face.up = glm::cross(face.right, face.forward);
+	//A little wider than the cone so the PCF kernel stays on the map at its edge
+	face.tanHalf = tan(ofClamp(cone * 1.05f + 0.02f, 0.01f, 1.5f));
+	faces.assign(1, face);
+	build(cast);
+}
+
+void ShadowMap::buildCube(const glm::vec3 &position, int size, RayCast cast) {
+	this->position = position;
+	this->size = size;
+	//+X, -X, +Y, -Y, +Z, -Z, each spanning the other two axes
+	const glm::vec3 axes[6][3] = {
+		{ glm::vec3(1, 0, 0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0) },
+		{ glm::vec3(-1, 0, 0), glm::vec3(0, 0, 1), glm::vec3(0, 1, 0) },
+		{ glm::vec3(0, 1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, -1) },
+		{ glm::vec3(0, -1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, 1) },
+		{ glm::vec3(0, 0, 1), glm::vec3(1, 0, 0), glm::vec3(0, 1, 0) },
+		{ glm::vec3(0, 0, -1), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0) } };
+	faces.resize(6);
+	for (int f = 0; f < 6; f++) {
+		faces[f].forward = axes[f][0];
+		faces[f].right = axes[f][1];
+		faces[f].up = axes[f][2];
+		faces[f].tanHalf = 1;
+	}
+	build(cast);
+}
+
+//  Cast one ray through each texel center, rows shared out across threads
+//
+void ShadowMap::build(RayCast cast) {
+	uint64_t start = ofGetElapsedTimeMicros();
+	for (int f = 0; f < faces.size(); f++)
+		faces[f].depth.assign(size * size, std::numeric_limits<float>::infinity());
+	std::atomic<int> nextRow(0);
+	int rows = faces.size() * size;
+	auto work = [&]() {
+		for (int r = nextRow++; r < rows; r = nextRow++) {
+			Face &face = faces[r / size];
+			int y = r % size;
+			float t = ((y + 0.5f) / size * 2 - 1) * face.tanHalf;
+			for (int x = 0; x < size; x++) {
+				float s = ((x + 0.5f) / size * 2 - 1) * face.tanHalf;
+				face.depth[y * size + x] = cast(position, glm::normalize(face.forward + face.right * s + face.up * t));
+			}
+		}
+	};
+	int threads = max(1, (int)std::thread::hardware_concurrency());
+	vector<std::thread> workers;
+	for (int k = 1; k < threads; k++)
+		workers.push_back(std::thread(work));
+	work();
+	for (int k = 0; k < workers.size(); k++)
+		workers[k].join();
+	buildMs = (ofGetElapsedTimeMicros() - start) / 1000.0f;
+}
+
+float ShadowMap::visibility(const glm::vec3 &p, float bias) const {
+	glm::vec3 d = p - position;
+	float dist = glm::length(d);
+	const Face *face = NULL;
+	if (faces.size() == 1)
+		face = &faces[0];
+	else {
+		//Cube face of the major axis
+		glm::vec3 a = glm::abs(d);
+		int f = (a.x >= a.y && a.x >= a.z) ? (d.x >= 0 ? 0 : 1) : (a.y >= a.z ? (d.y >= 0 ? 2 : 3) : (d.z >= 0 ? 4 : 5));
+		face = &faces[f];
+	}
+	float z = glm::dot(d, face->forward);
+	if (z <= 0) return 1;
+	float s = glm::dot(d, face->right) / (z * face->tanHalf);
+	float t = glm::dot(d, face->up) / (z * face->tanHalf);
+	//Outside a spot map is outside the cone, the cone test leaves it unlit anyway
+	if (fabs(s) > 1 || fabs(t) > 1) return 1;
+	//Slope bias grows with the world size of a texel at this distance
+	float texel = 2 * face->tanHalf * dist / size;
+	return filtered(*face, (s * 0.5f + 0.5f) * size - 0.5f, (t * 0.5f + 0.5f) * size - 0.5f, dist - bias - 2 * texel);
+}
+
+//  3x3 PCF, each tap a bilinear blend of four depth comparisons
+//
+float ShadowMap::filtered(const Face &face, float x, float y, float dist) const {
+	float sum = 0;
+	for (int dy = -1; dy <= 1; dy++) {
+		for (int dx = -1; dx <= 1; dx++) {
+			float fx = x + dx, fy = y + dy;
+			int x0 = (int)floor(fx), y0 = (int)floor(fy);
+			float wx = fx - x0, wy = fy - y0;
+			float bottom = lit(face, x0, y0, dist) * (1 - wx) + lit(face, x0 + 1, y0, dist) * wx;
+			float top = lit(face, x0, y0 + 1, dist) * (1 - wx) + lit(face, x0 + 1, y0 + 1, dist) * wx;
+			sum += bottom * (1 - wy) + top * wy;
+		}
+	}
+	return sum / 9;
+}
+
+shared_ptr<const ShadowMap> ShadowMapCache::get(const ShadowMapKey &key, ShadowMap::RayCast cast) {
+	for (int k = 0; k < entries.size(); k++) {
+		if (entries[k].first == key) {
+			used.push_back(entries[k]);
+			reuses++;
+			return entries[k].second;
+		}
+	}
+	shared_ptr<ShadowMap> map = make_shared<ShadowMap>();
+	if (key.cube)
+		map->buildCube(key.position, key.size, cast);
+	else
+		map->buildSpot(key.position, key.aim - key.position, key.cone, key.size, cast);
+	builds++;
+	buildMs += map->buildMs;
+	used.push_back(make_pair(key, shared_ptr<const ShadowMap>(map)));
+	return map;
+}
+
+void ShadowMapCache::endPass() {
+	entries.swap(used);
+	used.clear();
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "ofMain.h"
+#include <functional>
+
+class SceneObject;
+
+//  Depth map of the nearest occluder distance seen from a light, built by ray
+//  casting from the light center. Spot lights get one perspective face covering
+//  their cone, point lights a six face cube map. Lookups compare the distance
+//  to the light against the map with a 3x3 bilinear PCF filter.
+//
+class ShadowMap {
+public:
+	//  Distance to the nearest hit along the ray from origin in direction dir,
+	//  or infinity. Called from several threads while building.
+	//
+	typedef std::function<float(const glm::vec3 &origin, const glm::vec3 &dir)> RayCast;
+
+	void buildSpot(const glm::vec3 &position, const glm::vec3 &direction, float cone, int size, RayCast cast);
+	void buildCube(const glm::vec3 &position, int size, RayCast cast);
+
+	//  Fraction of the light visible from p, in [0, 1]. p should already be
+	//  offset off the surface the same way shadow ray origins are.
+	//
+	float visibility(const glm::vec3 &p, float bias) const;
+
+	int size = 0;
+	glm::vec3 position;
+	float buildMs = 0;
+
+private:
+	struct Face {
+		glm::vec3 forward, right, up;
+		float tanHalf;
+		vector<float> depth;
+	};
+	void build(RayCast cast);
+	float filtered(const Face &face, float x, float y, float dist) const;
+	float lit(const Face &face, int x, int y, float dist) const {
+		x = x < 0 ? 0 : (x >= size ? size - 1 : x);
+		y = y < 0 ? 0 : (y >= size ? size - 1 : y);
+		return dist > face.depth[y * size + x] ? 0.0f : 1.0f;
+	}
+
+	vector<Face> faces;
+};
+
+//  Everything that decides what a light's map contains. Maps are rebuilt only
+//  when one of these changes; geometryVersion changes when occluders move.
+//
+struct ShadowMapKey {
+	bool cube = true;
+	glm::vec3 position, aim;
+	float cone = 0;
+	int size = 0;
+	uint64_t geometryVersion = 0;
+	bool operator==(const ShadowMapKey &other) const {
+		return cube == other.cube && position == other.position && aim == other.aim && cone == other.cone &&
+			size == other.size && geometryVersion == other.geometryVersion;
+	}
+};
+
+//  Shadow maps of one render pass, by the snapshot's light objects
+//
+class ShadowMapSet {
+public:
+	const ShadowMap *find(const SceneObject *light) const {
+		auto found = maps.find(light);
+		return found == maps.end() ? NULL : found->second.get();
+	}
+	map<const SceneObject *, shared_ptr<const ShadowMap>> maps;
+};
+
+//  Keeps the maps of the last pass and rebuilds only those whose key changed.
+//  Maps are immutable once built, so passes still using an old set keep it alive.
+//
+class ShadowMapCache {
+public:
+	//  Map for key, from the previous pass or built now. Request every light of a
+	//  pass between beginPass() and endPass(); maps not requested are dropped.
+	//
+	void beginPass() { builds = reuses = 0; buildMs = 0; }
+	shared_ptr<const ShadowMap> get(const ShadowMapKey &key, ShadowMap::RayCast cast);
+	void endPass();
+
+	int builds = 0, reuses = 0;      // counts for the last pass
+	float buildMs = 0;
+
+private:
+	vector<pair<ShadowMapKey, shared_ptr<const ShadowMap>>> entries, used;
+};
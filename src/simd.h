@@ -0,0 +1,260 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include "glm/glm.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+//  Math layer for the renderer hot paths. glm stays the scene and editor type
+//  (openFrameworks speaks glm); inner loops use these instead:
+//
+//  fastExp / fastAcos               - approximations with bounded error
+//  Vec4f                             - one xyz(w) vector in an SSE register
+//  Float4 / Float8, Vec3x4 / Vec3x8  - 4 or 8 lanes, structure of arrays
+//  rayBoxIntersect                   - slab test without a ray object
+//
+//  Only what measured faster than the glm / libm code it replaced is here
+//  (runMathBenchmark, key 'u'). Scalar pow and 1 / sqrt approximations lost to
+//  libm and to the compiler's own vectorization of 1 / sqrtf.
+//
+//  All types are trivially copyable. Without SSE2 (or AVX for Float8) the same
+//  interface falls back to plain loops.
+//
+
+//  e^x for |x| <= 80 via 2^x = 2^i * 2^f with a degree 5 polynomial for 2^f.
+//  Relative error below 1e-4.
+//
+inline float fastExp(float x) {
+	float t = fminf(fmaxf(x, -80.0f), 80.0f) * 1.44269504f;
+	float fi = floorf(t);
+	float f = t - fi;
+	float p = 1.0f + f * (0.693147f + f * (0.240227f + f * (0.0555041f + f * (0.00961813f + f * 0.00133336f))));
+	int32_t bits;
+	memcpy(&bits, &p, 4);
+	bits += int32_t(fi) << 23;
+	memcpy(&p, &bits, 4);
+	return p;
+}
+
+//  acos(x) for x in [-1, 1], Abramowitz & Stegun 4.4.46. Absolute error below 1e-6.
+//
+inline float fastAcos(float x) {
+	float a = fabsf(x);
+	float p = 1.5707963050f + a * (-0.2145988016f + a * (0.0889789874f + a * (-0.0501743046f +
+		a * (0.0308918810f + a * (-0.0170881256f + a * (0.0066700901f + a * -0.0012624911f))))));
+	float r = sqrtf(fmaxf(1 - a, 0.0f)) * p;
+	return x < 0 ? 3.14159265f - r : r;
+}
+
+//  One vector, xyz plus an unused w
+//
+struct Vec4f {
+#if defined(__SSE2__)
+	__m128 v;
+	Vec4f() {}
+	explicit Vec4f(__m128 v) : v(v) {}
+	explicit Vec4f(float s) : v(_mm_set1_ps(s)) {}
+	Vec4f(float x, float y, float z, float w = 0) : v(_mm_set_ps(w, z, y, x)) {}
+	Vec4f(const glm::vec3 &p) : v(_mm_set_ps(0, p.z, p.y, p.x)) {}
+	float operator[](int i) const { float f[4]; _mm_storeu_ps(f, v); return f[i]; }
+	Vec4f operator+(const Vec4f &o) const { return Vec4f(_mm_add_ps(v, o.v)); }
+	Vec4f operator-(const Vec4f &o) const { return Vec4f(_mm_sub_ps(v, o.v)); }
+	Vec4f operator*(const Vec4f &o) const { return Vec4f(_mm_mul_ps(v, o.v)); }
+	Vec4f operator/(const Vec4f &o) const { return Vec4f(_mm_div_ps(v, o.v)); }
+	Vec4f operator*(float s) const { return Vec4f(_mm_mul_ps(v, _mm_set1_ps(s))); }
+	friend Vec4f min(const Vec4f &a, const Vec4f &b) { return Vec4f(_mm_min_ps(a.v, b.v)); }
+	friend Vec4f max(const Vec4f &a, const Vec4f &b) { return Vec4f(_mm_max_ps(a.v, b.v)); }
+	float minComponent3() const { return fminf(fminf((*this)[0], (*this)[1]), (*this)[2]); }
+	float maxComponent3() const { return fmaxf(fmaxf((*this)[0], (*this)[1]), (*this)[2]); }
+#else
+	float v[4];
+	Vec4f() {}
+	explicit Vec4f(float s) { v[0] = v[1] = v[2] = v[3] = s; }
+	Vec4f(float x, float y, float z, float w = 0) { v[0] = x; v[1] = y; v[2] = z; v[3] = w; }
+	Vec4f(const glm::vec3 &p) { v[0] = p.x; v[1] = p.y; v[2] = p.z; v[3] = 0; }
+	float operator[](int i) const { return v[i]; }
+	Vec4f operator+(const Vec4f &o) const { return Vec4f(v[0] + o.v[0], v[1] + o.v[1], v[2] + o.v[2], v[3] + o.v[3]); }
+	Vec4f operator-(const Vec4f &o) const { return Vec4f(v[0] - o.v[0], v[1] - o.v[1], v[2] - o.v[2], v[3] - o.v[3]); }
+	Vec4f operator*(const Vec4f &o) const { return Vec4f(v[0] * o.v[0], v[1] * o.v[1], v[2] * o.v[2], v[3] * o.v[3]); }
+	Vec4f operator/(const Vec4f &o) const { return Vec4f(v[0] / o.v[0], v[1] / o.v[1], v[2] / o.v[2], v[3] / o.v[3]); }
+	Vec4f operator*(float s) const { return Vec4f(v[0] * s, v[1] * s, v[2] * s, v[3] * s); }
+	friend Vec4f min(const Vec4f &a, const Vec4f &b) { return Vec4f(fminf(a.v[0], b.v[0]), fminf(a.v[1], b.v[1]), fminf(a.v[2], b.v[2]), fminf(a.v[3], b.v[3])); }
+	friend Vec4f max(const Vec4f &a, const Vec4f &b) { return Vec4f(fmaxf(a.v[0], b.v[0]), fmaxf(a.v[1], b.v[1]), fmaxf(a.v[2], b.v[2]), fmaxf(a.v[3], b.v[3])); }
+	float minComponent3() const { return fminf(fminf(v[0], v[1]), v[2]); }
+	float maxComponent3() const { return fmaxf(fmaxf(v[0], v[1]), v[2]); }
+#endif
+	glm::vec3 toVec3() const { return glm::vec3((*this)[0], (*this)[1], (*this)[2]); }
+	float dot3(const Vec4f &o) const { Vec4f p = *this * o; return p[0] + p[1] + p[2]; }
+	Vec4f cross3(const Vec4f &o) const {
+		return Vec4f((*this)[1] * o[2] - (*this)[2] * o[1], (*this)[2] * o[0] - (*this)[0] * o[2], (*this)[0] * o[1] - (*this)[1] * o[0]);
+	}
+	Vec4f normalized3() const { return *this * (1 / sqrtf(dot3(*this))); }
+};
+
+//  Slab test of the ray o + t d against an axis aligned box, hits inside (t0, t1).
+//  invDir is 1 / d per component (infinite for zero components).
+//
+inline bool rayBoxIntersect(const Vec4f &origin, const Vec4f &invDir, const Vec4f &boxMin, const Vec4f &boxMax, float t0, float t1) {
+	Vec4f a = (boxMin - origin) * invDir;
+	Vec4f b = (boxMax - origin) * invDir;
+	float tNear = fmaxf(min(a, b).maxComponent3(), t0);
+	float tFar = fminf(max(a, b).minComponent3(), t1);
+	return tNear < tFar;
+}
+
+//  4 float lanes
+//
+struct Float4 {
+	static const int lanes = 4;
+#if defined(__SSE2__)
+	__m128 v;
+	Float4() {}
+	explicit Float4(__m128 v) : v(v) {}
+	Float4(float s) : v(_mm_set1_ps(s)) {}
+	static Float4 load(const float *p) { return Float4(_mm_loadu_ps(p)); }
+	void store(float *p) const { _mm_storeu_ps(p, v); }
+	Float4 operator+(const Float4 &o) const { return Float4(_mm_add_ps(v, o.v)); }
+	Float4 operator-(const Float4 &o) const { return Float4(_mm_sub_ps(v, o.v)); }
+	Float4 operator*(const Float4 &o) const { return Float4(_mm_mul_ps(v, o.v)); }
+	Float4 operator/(const Float4 &o) const { return Float4(_mm_div_ps(v, o.v)); }
+	//Comparisons give all-ones lanes where true
+	Float4 operator<(const Float4 &o) const { return Float4(_mm_cmplt_ps(v, o.v)); }
+	Float4 operator<=(const Float4 &o) const { return Float4(_mm_cmple_ps(v, o.v)); }
+	Float4 operator>(const Float4 &o) const { return Float4(_mm_cmpgt_ps(v, o.v)); }
+	Float4 operator&(const Float4 &o) const { return Float4(_mm_and_ps(v, o.v)); }
+	Float4 operator|(const Float4 &o) const { return Float4(_mm_or_ps(v, o.v)); }
+	friend Float4 sqrt(const Float4 &a) { return Float4(_mm_sqrt_ps(a.v)); }
+	friend Float4 min(const Float4 &a, const Float4 &b) { return Float4(_mm_min_ps(a.v, b.v)); }
+	friend Float4 max(const Float4 &a, const Float4 &b) { return Float4(_mm_max_ps(a.v, b.v)); }
+	friend Float4 abs(const Float4 &a) { return Float4(_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)); }
+	//mask ? a : b
+	friend Float4 select(const Float4 &mask, const Float4 &a, const Float4 &b) { return Float4(_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v))); }
+	//Hardware estimate plus one Newton step, relative error below 1e-6
+	friend Float4 rsqrt(const Float4 &a) {
+		__m128 y = _mm_rsqrt_ps(a.v);
+		return Float4(_mm_mul_ps(y, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), a.v), _mm_mul_ps(y, y)))));
+	}
+	int mask() const { return _mm_movemask_ps(v); }
+#else
+	float v[4];
+	Float4() {}
+	Float4(float s) { v[0] = v[1] = v[2] = v[3] = s; }
+	static Float4 load(const float *p) { Float4 r; memcpy(r.v, p, sizeof(r.v)); return r; }
+	void store(float *p) const { memcpy(p, v, sizeof(v)); }
+#define FLOAT4_OP(op) Float4 operator op(const Float4 &o) const { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = v[k] op o.v[k]; return r; }
+	FLOAT4_OP(+) FLOAT4_OP(-) FLOAT4_OP(*) FLOAT4_OP(/)
+#undef FLOAT4_OP
+#define FLOAT4_CMP(op) Float4 operator op(const Float4 &o) const { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = fromBits(v[k] op o.v[k] ? ~0u : 0u); return r; }
+	FLOAT4_CMP(<) FLOAT4_CMP(<=) FLOAT4_CMP(>)
+#undef FLOAT4_CMP
+	Float4 operator&(const Float4 &o) const { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = fromBits(bits(v[k]) & bits(o.v[k])); return r; }
+	Float4 operator|(const Float4 &o) const { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = fromBits(bits(v[k]) | bits(o.v[k])); return r; }
+	friend Float4 sqrt(const Float4 &a) { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = sqrtf(a.v[k]); return r; }
+	friend Float4 min(const Float4 &a, const Float4 &b) { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = a.v[k] < b.v[k] ? a.v[k] : b.v[k]; return r; }
+	friend Float4 max(const Float4 &a, const Float4 &b) { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = a.v[k] > b.v[k] ? a.v[k] : b.v[k]; return r; }
+	friend Float4 abs(const Float4 &a) { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = fabsf(a.v[k]); return r; }
+	friend Float4 select(const Float4 &mask, const Float4 &a, const Float4 &b) { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = bits(mask.v[k]) ? a.v[k] : b.v[k]; return r; }
+	friend Float4 rsqrt(const Float4 &a) { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = 1 / sqrtf(a.v[k]); return r; }
+	int mask() const { int m = 0; for (int k = 0; k < 4; k++) m |= (bits(v[k]) >> 31) << k; return m; }
+	static uint32_t bits(float f) { uint32_t u; memcpy(&u, &f, 4); return u; }
+	static float fromBits(uint32_t u) { float f; memcpy(&f, &u, 4); return f; }
+#endif
+};
+
+//  8 float lanes, one AVX register or two Float4
+//
+struct Float8 {
+	static const int lanes = 8;
+#if defined(__AVX__)
+	__m256 v;
+	Float8() {}
+	explicit Float8(__m256 v) : v(v) {}
+	Float8(float s) : v(_mm256_set1_ps(s)) {}
+	static Float8 load(const float *p) { return Float8(_mm256_loadu_ps(p)); }
+	void store(float *p) const { _mm256_storeu_ps(p, v); }
+	Float8 operator+(const Float8 &o) const { return Float8(_mm256_add_ps(v, o.v)); }
+	Float8 operator-(const Float8 &o) const { return Float8(_mm256_sub_ps(v, o.v)); }
+	Float8 operator*(const Float8 &o) const { return Float8(_mm256_mul_ps(v, o.v)); }
+	Float8 operator/(const Float8 &o) const { return Float8(_mm256_div_ps(v, o.v)); }
+	Float8 operator<(const Float8 &o) const { return Float8(_mm256_cmp_ps(v, o.v, _CMP_LT_OQ)); }
+	Float8 operator<=(const Float8 &o) const { return Float8(_mm256_cmp_ps(v, o.v, _CMP_LE_OQ)); }
+	Float8 operator>(const Float8 &o) const { return Float8(_mm256_cmp_ps(v, o.v, _CMP_GT_OQ)); }
+	Float8 operator&(const Float8 &o) const { return Float8(_mm256_and_ps(v, o.v)); }
+	Float8 operator|(const Float8 &o) const { return Float8(_mm256_or_ps(v, o.v)); }
+	friend Float8 sqrt(const Float8 &a) { return Float8(_mm256_sqrt_ps(a.v)); }
+	friend Float8 min(const Float8 &a, const Float8 &b) { return Float8(_mm256_min_ps(a.v, b.v)); }
+	friend Float8 max(const Float8 &a, const Float8 &b) { return Float8(_mm256_max_ps(a.v, b.v)); }
+	friend Float8 abs(const Float8 &a) { return Float8(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)); }
+	friend Float8 select(const Float8 &mask, const Float8 &a, const Float8 &b) { return Float8(_mm256_blendv_ps(b.v, a.v, mask.v)); }
+	friend Float8 rsqrt(const Float8 &a) {
+		__m256 y = _mm256_rsqrt_ps(a.v);
+		return Float8(_mm256_mul_ps(y, _mm256_sub_ps(_mm256_set1_ps(1.5f), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), a.v), _mm256_mul_ps(y, y)))));
+	}
+	int mask() const { return _mm256_movemask_ps(v); }
+#else
+	Float4 lo, hi;
+	Float8() {}
+	Float8(const Float4 &lo, const Float4 &hi) : lo(lo), hi(hi) {}
+	Float8(float s) : lo(s), hi(s) {}
+	static Float8 load(const float *p) { return Float8(Float4::load(p), Float4::load(p + 4)); }
+	void store(float *p) const { lo.store(p); hi.store(p + 4); }
+#define FLOAT8_OP(op) Float8 operator op(const Float8 &o) const { return Float8(lo op o.lo, hi op o.hi); }
+	FLOAT8_OP(+) FLOAT8_OP(-) FLOAT8_OP(*) FLOAT8_OP(/) FLOAT8_OP(<) FLOAT8_OP(<=) FLOAT8_OP(>) FLOAT8_OP(&) FLOAT8_OP(|)
+#undef FLOAT8_OP
+	friend Float8 sqrt(const Float8 &a) { return Float8(sqrt(a.lo), sqrt(a.hi)); }
+	friend Float8 min(const Float8 &a, const Float8 &b) { return Float8(min(a.lo, b.lo), min(a.hi, b.hi)); }
+	friend Float8 max(const Float8 &a, const Float8 &b) { return Float8(max(a.lo, b.lo), max(a.hi, b.hi)); }
+	friend Float8 abs(const Float8 &a) { return Float8(abs(a.lo), abs(a.hi)); }
+	friend Float8 select(const Float8 &mask, const Float8 &a, const Float8 &b) { return Float8(select(mask.lo, a.lo, b.lo), select(mask.hi, a.hi, b.hi)); }
+	friend Float8 rsqrt(const Float8 &a) { return Float8(rsqrt(a.lo), rsqrt(a.hi)); }
+	int mask() const { return lo.mask() | (hi.mask() << 4); }
+#endif
+};
+
+//  Structure of arrays vectors, one vector per lane
+//
+template <class F>
+struct Vec3xN {
+	F x, y, z;
+	Vec3xN() {}
+	Vec3xN(const F &x, const F &y, const F &z) : x(x), y(y), z(z) {}
+	Vec3xN(const glm::vec3 &v) : x(v.x), y(v.y), z(v.z) {}
+	static Vec3xN load(const float *px, const float *py, const float *pz) { return Vec3xN(F::load(px), F::load(py), F::load(pz)); }
+	Vec3xN operator+(const Vec3xN &o) const { return Vec3xN(x + o.x, y + o.y, z + o.z); }
+	Vec3xN operator-(const Vec3xN &o) const { return Vec3xN(x - o.x, y - o.y, z - o.z); }
+	Vec3xN operator*(const F &s) const { return Vec3xN(x * s, y * s, z * s); }
+	F dot(const Vec3xN &o) const { return x * o.x + y * o.y + z * o.z; }
+	Vec3xN cross(const Vec3xN &o) const { return Vec3xN(y * o.z - z * o.y, z * o.x - x * o.z, x * o.y - y * o.x); }
+	Vec3xN normalized() const { return *this * rsqrt(dot(*this)); }
+};
+typedef Vec3xN<Float4> Vec3x4;
+typedef Vec3xN<Float8> Vec3x8;
+
+#if defined(__SSE2__)
+//  fastExp on 4 lanes, same polynomial
+//
+inline __m128 fastExp4(__m128 x) {
+	__m128 t = _mm_mul_ps(_mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-80.0f)), _mm_set1_ps(80.0f)), _mm_set1_ps(1.44269504f));
+	__m128i ti = _mm_cvttps_epi32(t);
+	__m128 fi = _mm_cvtepi32_ps(ti);
+	//Truncation rounds toward zero, step down for negative fractions
+	__m128 adjust = _mm_and_ps(_mm_cmpgt_ps(fi, t), _mm_set1_ps(1.0f));
+	fi = _mm_sub_ps(fi, adjust);
+	ti = _mm_cvtps_epi32(fi);
+	__m128 f = _mm_sub_ps(t, fi);
+	__m128 p = _mm_set1_ps(0.00133336f);
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.00961813f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.0555041f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.240227f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.693147f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+	return _mm_castsi128_ps(_mm_add_epi32(_mm_castps_si128(p), _mm_slli_epi32(ti, 23)));
+}
+#endif
@@ -0,0 +1,215 @@
+#include "texcache.h"
+#include <cstring>
+#include <fstream>
+
+static const size_t tileBytes = TextureCache::tileSize * TextureCache::tileSize * 3;
+
+TextureCache::TextureCache() {
+	static std::atomic<uint64_t> instances(0);
+	id = ++instances;
+	textures.reserve(maxTextures);
+}
+
+int TextureCache::addTexture(const string &path) {
+	auto found = ids.find(path);
+	if (found != ids.end()) return found->second;
+	if (textures.size() >= maxTextures) return -1;
+	ofPixels pixels;
+	if (!ofLoadImage(pixels, path)) return -1;
+	pixels.setImageType(OF_IMAGE_COLOR);
+	uint64_t start = ofGetElapsedTimeMicros();
+	unique_ptr<Texture> texture(new Texture());
+	texture->path = path;
+	ofDirectory::createDirectory(directory, true, true);
+	texture->tileFile = ofToDataPath(directory + "/" + ofToString(textures.size()) + "_" + ofFilePath::getBaseName(path) + ".tiles");
+	std::ofstream out(texture->tileFile, std::ios::binary);
+	//Level 0 is the image, each further level a 2x2 box filter of the one above
+	int width = pixels.getWidth(), height = pixels.getHeight();
+	vector<unsigned char> level(pixels.getData(), pixels.getData() + width * height * 3);
+	pixels.clear();
+	int64_t offset = 0;
+	vector<unsigned char> tile(tileBytes);
+	while (true) {
+		Level info = { width, height, (width + tileSize - 1) / tileSize, (height + tileSize - 1) / tileSize, offset };
+		texture->levels.push_back(info);
+		//Edge tiles are padded by repeating the last row and column
+		for (int ty = 0; ty < info.tilesY; ty++) {
+			for (int tx = 0; tx < info.tilesX; tx++) {
+				for (int y = 0; y < tileSize; y++) {
+					int sy = min(ty * tileSize + y, height - 1);
+					for (int x = 0; x < tileSize; x++) {
+						int sx = min(tx * tileSize + x, width - 1);
+						memcpy(&tile[(y * tileSize + x) * 3], &level[(sy * width + sx) * 3], 3);
+					}
+				}
+				out.write((const char *)tile.data(), tileBytes);
+			}
+		}
+		offset += int64_t(info.tilesX) * info.tilesY * tileBytes;
+		if (width == 1 && height == 1) break;
+		int w = max(1, width / 2), h = max(1, height / 2);
+		vector<unsigned char> next(w * h * 3);
+		for (int y = 0; y < h; y++) {
+			int y0 = min(2 * y, height - 1), y1 = min(2 * y + 1, height - 1);
+			for (int x = 0; x < w; x++) {
+				int x0 = min(2 * x, width - 1), x1 = min(2 * x + 1, width - 1);
+				for (int c = 0; c < 3; c++)
+					next[(y * w + x) * 3 + c] = (level[(y0 * width + x0) * 3 + c] + level[(y0 * width + x1) * 3 + c] +
+						level[(y1 * width + x0) * 3 + c] + level[(y1 * width + x1) * 3 + c] + 2) / 4;
+			}
+		}
+		level.swap(next);
+		width = w;
+		height = h;
+	}
+	if (!out) return -1;
+	cout << "Texture " << path << ": " << texture->levels.size() << " levels, " << offset / (1 << 20) << " MB of tiles in "
+		<< (ofGetElapsedTimeMicros() - start) / 1000.0 << " ms" << endl;
+	textures.push_back(std::move(texture));
+	ids[path] = textures.size() - 1;
+	return textures.size() - 1;
+}
+
+void TextureCache::setBudget(size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+	budget = bytes;
+	evict();
+}
+
+//  Drop least recently used tiles until under budget (mutex held)
+//
+void TextureCache::evict() {
+	while (resident > budget && !lru.empty()) {
+		index.erase(lru.back().key);
+		lru.pop_back();
+		resident -= tileBytes;
+		evictions++;
+	}
+}
+
+shared_ptr<const TextureCache::Tile> TextureCache::getTile(int texture, int level, int tx, int ty, uint64_t key) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto found = index.find(key);
+		if (found != index.end()) {
+			lru.splice(lru.begin(), lru, found->second);
+			sharedHits++;
+			return found->second->tile;
+		}
+	}
+	//Read outside the cache lock, two threads may load the same tile and the first insert wins
+	Texture &tex = *textures[texture];
+	const Level &info = tex.levels[level];
+	shared_ptr<Tile> tile = make_shared<Tile>();
+	tile->texels.resize(tileBytes);
+	{
+		std::lock_guard<std::mutex> lock(tex.file);
+		std::ifstream in(tex.tileFile, std::ios::binary);
+		in.seekg(info.offset + (int64_t(ty) * info.tilesX + tx) * tileBytes);
+		in.read((char *)tile->texels.data(), tileBytes);
+	}
+	loads++;
+	std::lock_guard<std::mutex> lock(mutex);
+	auto found = index.find(key);
+	if (found != index.end())
+		return found->second->tile;
+	lru.push_front(LRUEntry{ key, tile });
+	index[key] = lru.begin();
+	resident += tileBytes;
+	peak = max(peak, resident);
+	evict();
+	return tile;
+}
+
+const unsigned char *TextureCache::texel(LocalCache &local, int texture, int level, int x, int y) {
+	int tx = x / tileSize, ty = y / tileSize;
+	uint64_t key = tileKey(texture, level, tx, ty);
+	int slot = (key ^ (key >> 20) ^ (key >> 40)) & (LocalCache::slots - 1);
+	if (local.keys[slot] != key || !local.tiles[slot]) {
+		local.tiles[slot] = getTile(texture, level, tx, ty, key);
+		local.keys[slot] = key;
+	}
+	else
+		local.localHits++;
+	local.lookups++;
+	return &local.tiles[slot]->texels[((y - ty * tileSize) * tileSize + (x - tx * tileSize)) * 3];
+}
+
+glm::vec3 TextureCache::bilinear(LocalCache &local, int texture, int level, float u, float v) {
+	const Level &info = textures[texture]->levels[level];
+	float x = (u - floor(u)) * info.width - 0.5f;
+	float y = (v - floor(v)) * info.height - 0.5f;
+	int x0 = (int)floor(x), y0 = (int)floor(y);
+	float wx = x - x0, wy = y - y0;
+	//Wrap around the edges
+	int x1 = (x0 + 1) % info.width, y1 = (y0 + 1) % info.height;
+	if (x0 < 0) x0 += info.width;
+	if (y0 < 0) y0 += info.height;
+	const unsigned char *a = texel(local, texture, level, x0, y0), *b = texel(local, texture, level, x1, y0);
+	const unsigned char *c = texel(local, texture, level, x0, y1), *d = texel(local, texture, level, x1, y1);
+	glm::vec3 result;
+	for (int k = 0; k < 3; k++)
+		result[k] = ((a[k] * (1 - wx) + b[k] * wx) * (1 - wy) + (c[k] * (1 - wx) + d[k] * wx) * wy) / 255.0f;
+	return result;
+}
+
+TextureCache::LocalCache &TextureCache::threadCache() {
+	static thread_local LocalCache local;
+	return local;
+}
+
+glm::vec3 TextureCache::sample(int texture, const glm::vec2 &uv, float footprint) {
+	LocalCache &local = threadCache();
+	if (local.owner != id) {
+		for (int k = 0; k < LocalCache::slots; k++) {
+			local.keys[k] = UINT64_MAX;
+			local.tiles[k].reset();
+		}
+		local.owner = id;
+		local.lookups = local.localHits = 0;
+	}
+	const Texture &tex = *textures[texture];
+	//Level where one texel covers the pixel footprint
+	float texels = footprint * max(tex.levels[0].width, tex.levels[0].height);
+	float lod = ofClamp(log2(max(texels, 1e-8f)), 0, tex.levels.size() - 1);
+	int level = (int)lod;
+	float blend = lod - level;
+	glm::vec3 color = bilinear(local, texture, level, uv.x, uv.y);
+	if (blend > 0 && level + 1 < tex.levels.size())
+		color = color * (1 - blend) + bilinear(local, texture, level + 1, uv.x, uv.y) * blend;
+	if (local.lookups >= 4096)
+		flushCounters(local);
+	return color;
+}
+
+//  Thread counters are added to the shared ones in batches
+//
+void TextureCache::flushCounters(LocalCache &local) {
+	lookups += local.lookups;
+	localHits += local.localHits;
+	local.lookups = local.localHits = 0;
+}
+
+void TextureCache::flushThread() {
+	LocalCache &local = threadCache();
+	if (local.owner == id)
+		flushCounters(local);
+}
+
+string TextureCache::report() {
+	uint64_t total = lookups.exchange(0), local = localHits.exchange(0);
+	uint64_t shared = sharedHits.exchange(0), loaded = loads.exchange(0), evicted = evictions.exchange(0);
+	size_t residentNow, peakNow, budgetNow;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		residentNow = resident;
+		peakNow = peak;
+		budgetNow = budget;
+		peak = resident;
+	}
+	float mb = 1 << 20;
+	return "Textures: " + ofToString(total) + " texel lookups, " + ofToString(total ? 100.0 * local / total : 0, 1) +
+		"% thread cache hits, " + ofToString(shared) + " shared hits, " + ofToString(loaded) + " tile loads, " +
+		ofToString(evicted) + " evictions, " + ofToString(residentNow / mb, 1) + " MB resident (peak " +
+		ofToString(peakNow / mb, 1) + " of " + ofToString(budgetNow / mb, 0) + " MB)";
+}
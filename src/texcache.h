@@ -0,0 +1,100 @@
+#pragma once
+
+#include "ofMain.h"
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+//  Image textures for materials, stored as 64x64 RGB8 tiles of a full mip
+//  pyramid in one tile file per texture. Tiles are read from disk only when a
+//  lookup needs them and kept in a cache bounded by a memory budget, least
+//  recently used tiles are evicted first.
+//
+//  Lookups come from many render threads. Each thread keeps a small direct
+//  mapped cache of the tiles it used last, so most lookups take no lock; only
+//  misses in it go to the shared cache. Tiles a thread still holds stay alive
+//  after eviction, so resident memory can exceed the budget by a few tiles per
+//  thread.
+//
+class TextureCache {
+public:
+	static const int tileSize = 64;
+	static const int maxTextures = 4096;
+
+	TextureCache();
+
+	//  Main thread only. Builds the tile file for the image at path (in the
+	//  directory set with setDirectory) and returns its id, or -1 if the image
+	//  could not be loaded. Adding the same path again returns the same id.
+	//
+	int addTexture(const string &path);
+	int numTextures() const { return textures.size(); }
+	void setDirectory(const string &directory) { this->directory = directory; }
+	void setBudget(size_t bytes);
+
+	//  Trilinear filtered color in [0, 1] at uv (wrapped). footprint is the size
+	//  of the pixel in uv units and picks the mip level.
+	//
+	glm::vec3 sample(int texture, const glm::vec2 &uv, float footprint);
+
+	//  Render threads: add the calling thread's batched counters to the shared
+	//  ones. Called at the end of every region, so a pass's report counts all
+	//  of its lookups.
+	//
+	void flushThread();
+
+	//  Hit rates and memory use since the last report
+	//
+	string report();
+
+private:
+	struct Level {
+		int width, height, tilesX, tilesY;
+		int64_t offset;                    // of the level's first tile in the tile file
+	};
+	struct Texture {
+		string path, tileFile;
+		vector<Level> levels;
+		std::mutex file;
+	};
+	struct Tile {
+		vector<unsigned char> texels;      // tileSize x tileSize RGB
+	};
+	struct LRUEntry {
+		uint64_t key;
+		shared_ptr<const Tile> tile;
+	};
+	//  Per thread tile cache and counters
+	//
+	struct LocalCache {
+		static const int slots = 64;
+		uint64_t owner = 0;
+		uint64_t keys[slots];
+		shared_ptr<const Tile> tiles[slots];
+		uint64_t localHits = 0, lookups = 0;
+	};
+
+	static uint64_t tileKey(int texture, int level, int tx, int ty) {
+		return (uint64_t(texture) << 44) | (uint64_t(level) << 40) | (uint64_t(ty) << 20) | uint64_t(tx);
+	}
+	static LocalCache &threadCache();
+	glm::vec3 bilinear(LocalCache &local, int texture, int level, float u, float v);
+	const unsigned char *texel(LocalCache &local, int texture, int level, int x, int y);
+	shared_ptr<const Tile> getTile(int texture, int level, int tx, int ty, uint64_t key);
+	void evict();
+	void flushCounters(LocalCache &local);
+
+	uint64_t id;                           // tells thread local caches of different instances apart
+	string directory = "texcache";
+	vector<unique_ptr<Texture>> textures;  // reserved up front, never reallocated while rendering
+	map<string, int> ids;
+
+	std::mutex mutex;                      // guards the shared cache below
+	std::unordered_map<uint64_t, std::list<LRUEntry>::iterator> index;
+	std::list<LRUEntry> lru;               // most recently used first
+	size_t budget = 512 << 20;
+	size_t resident = 0, peak = 0;
+
+	std::atomic<uint64_t> lookups{ 0 }, localHits{ 0 }, sharedHits{ 0 }, loads{ 0 }, evictions{ 0 };
+};
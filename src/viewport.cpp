@@ -0,0 +1,221 @@
+#include "viewport.h"
+#include "ofApp.h"
+#include "frustum.h"
+
+//Instance attributes after the ones ofShader::bindDefaults uses (0 - 3)
+static const int transformLocation = 4;         // mat4, locations 4 - 7
+static const int colorLocation = 8;
+static const int sphereResolutions[ViewportBatches::sphereLods] = { 20, 10, 5 };
+
+static const string vertexShader = R"(#version 150
+uniform mat4 modelViewProjectionMatrix;
+in vec4 position;
+in mat4 instanceTransform;
+in vec4 instanceColor;
+out vec4 color;
+void main() {
+	color = instanceColor;
+	gl_Position = modelViewProjectionMatrix * instanceTransform * position;
+}
+)";
+
+static const string fragmentShader = R"(#version 150
+in vec4 color;
+out vec4 fragColor;
+void main() {
+	fragColor = color;
+}
+)";
+
+void ViewportBatches::Batch::setup(const ofMesh &mesh) {
+	vbo.setMesh(mesh, GL_STATIC_DRAW);
+	mode = ofGetGLPrimitiveMode(mesh.getMode());
+	capacity = 64;
+	buffer.allocate(capacity * sizeof(Instance), GL_DYNAMIC_DRAW);
+	for (int c = 0; c < 4; c++) {
+		vbo.setAttributeBuffer(transformLocation + c, buffer, 4, sizeof(Instance), c * sizeof(glm::vec4));
+		vbo.setAttributeDivisor(transformLocation + c, 1);
+	}
+	vbo.setAttributeBuffer(colorLocation, buffer, 4, sizeof(Instance), offsetof(Instance, color));
+	vbo.setAttributeDivisor(colorLocation, 1);
+}
+
+void ViewportBatches::Batch::upload() {
+	if (!changed) return;
+	changed = false;
+	if (instances.empty()) return;
+	if (instances.size() > capacity) {
+		capacity = max(instances.size(), capacity * 2);
+		buffer.allocate(capacity * sizeof(Instance), instances.data(), GL_DYNAMIC_DRAW);
+	}
+	else
+		buffer.updateData(0, instances.size() * sizeof(Instance), instances.data());
+}
+
+void ViewportBatches::Batch::draw() const {
+	if (!instances.empty())
+		vbo.drawElementsInstanced(mode, vbo.getNumIndices(), instances.size());
+}
+
+bool ViewportBatches::setup() {
+	supported = false;
+	if (!ofIsGLProgrammableRenderer())
+		return false;
+	shader.setupShaderFromSource(GL_VERTEX_SHADER, vertexShader);
+	shader.setupShaderFromSource(GL_FRAGMENT_SHADER, fragmentShader);
+	shader.bindDefaults();
+	shader.bindAttribute(transformLocation, "instanceTransform");
+	shader.bindAttribute(colorLocation, "instanceColor");
+	if (!shader.linkProgram())
+		return false;
+	for (int k = 0; k < sphereLods; k++) {
+		ofSpherePrimitive sphere;
+		sphere.setRadius(1);
+		sphere.setResolution(sphereResolutions[k]);
+		lods[k].setup(sphere.getMesh());
+	}
+	ofPlanePrimitive plane;
+	plane.set(1, 1);
+	plane.setResolution(2, 2);
+	batches[VIEWPORT_PLANE].setup(plane.getMesh());
+	ofConePrimitive cone;
+	cone.set(1, 1, 20, 1, 2);
+	batches[VIEWPORT_CONE].setup(cone.getMesh());
+	copies.clear();
+	held.clear();
+	supported = true;
+	return true;
+}
+
+//Shape, transform and color of one object
+static ViewportShape instanceOf(SceneObject *object, bool selected, glm::mat4 &transform, ofFloatColor &color) {
+	color = selected ? ofColor::white : object->diffuseColor;
+	return object->getViewportShape(transform);
+}
+
+void ViewportBatches::rebuild(const SceneSnapshot &snapshot) {
+	for (int s = 0; s < VIEWPORT_SHAPES; s++) {
+		batches[s].instances.clear();
+		batches[s].changed = true;
+	}
+	copies = snapshot.scene;
+	hold(snapshot);
+	slots.resize(copies.size());
+	single.clear();
+	for (int a = 0; a < copies.size(); a++) {
+		Instance instance;
+		ViewportShape shape = instanceOf(copies[a], a == selected, instance.transform, instance.color);
+		slots[a] = Slot{ shape, (int)batches[shape].instances.size() };
+		if (shape == VIEWPORT_NONE)
+			single.push_back(a);
+		else
+			batches[shape].instances.push_back(instance);
+	}
+	spheresChanged = true;
+}
+
+void ViewportBatches::update(const SceneSnapshot &snapshot, int selected) {
+	if (!supported) return;
+	int previous = this->selected;
+	this->selected = selected;
+	if (snapshot.scene.size() != copies.size()) {
+		rebuild(snapshot);
+		return;
+	}
+	//Only edited objects were cloned, so unchanged pointers mean unchanged objects
+	for (int a = 0; a < copies.size(); a++) {
+		if (copies[a] == snapshot.scene[a] && (a == selected) == (a == previous)) continue;
+		Instance instance;
+		ViewportShape shape = instanceOf(snapshot.scene[a], a == selected, instance.transform, instance.color);
+		if (shape != slots[a].shape) {
+			rebuild(snapshot);
+			return;
+		}
+		copies[a] = snapshot.scene[a];
+		if (shape == VIEWPORT_NONE) continue;
+		batches[shape].instances[slots[a].index] = instance;
+		batches[shape].changed = true;
+		if (shape == VIEWPORT_SPHERE)
+			spheresChanged = true;
+	}
+	hold(snapshot);
+}
+
+void ViewportBatches::hold(const SceneSnapshot &snapshot) {
+	held.clear();
+	for (auto it = snapshot.copies.begin(); it != snapshot.copies.end(); it++)
+		held.push_back(it->second);
+}
+
+//Visible spheres into levels of detail by projected radius in pixels
+void ViewportBatches::splitSpheres(const ofCamera &camera, float viewportWidth, float viewportHeight) {
+	glm::mat4 view = camera.getModelViewMatrix();
+	glm::vec2 viewport(viewportWidth, viewportHeight);
+	if (!spheresChanged && view == lastView && viewport == lastViewport)
+		return;
+	spheresChanged = false;
+	lastView = view;
+	lastViewport = viewport;
+	glm::vec3 eye = camera.getGlobalPosition();
+	glm::vec3 corners[4] = {
+		camera.screenToWorld(glm::vec3(0, 0, 0)), camera.screenToWorld(glm::vec3(viewportWidth, 0, 0)),
+		camera.screenToWorld(glm::vec3(viewportWidth, viewportHeight, 0)), camera.screenToWorld(glm::vec3(0, viewportHeight, 0))
+	};
+	Frustum frustum(eye, corners);
+	float pixelsAtUnitDistance = viewportHeight / (2 * tan(glm::radians(camera.getFov()) / 2));
+	for (int k = 0; k < sphereLods; k++) {
+		lods[k].instances.clear();
+		lods[k].changed = true;
+	}
+	const vector<Instance> &spheres = batches[VIEWPORT_SPHERE].instances;
+	for (int s = 0; s < spheres.size(); s++) {
+		glm::vec3 center(spheres[s].transform[3]);
+		float radius = glm::length(glm::vec3(spheres[s].transform[0]));
+		if (!frustum.intersectsBox(center - radius, center + radius))
+			continue;
+		float distance = glm::length(center - eye);
+		float pixels = distance > radius ? radius * pixelsAtUnitDistance / distance : viewportHeight;
+		int level = 0;
+		while (level < sphereLods - 1 && pixels < lodPixels[level])
+			level++;
+		lods[level].instances.push_back(spheres[s]);
+	}
+}
+
+void ViewportBatches::draw(const ofCamera &camera, float viewportWidth, float viewportHeight) {
+	drawCalls = 0;
+	if (!supported) return;
+	splitSpheres(camera, viewportWidth, viewportHeight);
+	shader.begin();
+	for (int k = 0; k < sphereLods; k++) {
+		lods[k].upload();
+		lods[k].draw();
+		drawCalls += !lods[k].instances.empty();
+	}
+	for (int s = VIEWPORT_PLANE; s < VIEWPORT_SHAPES; s++) {
+		batches[s].upload();
+		batches[s].draw();
+		drawCalls += !batches[s].instances.empty();
+	}
+	shader.end();
+	//The rest as before, one by one
+	for (int k = 0; k < single.size(); k++) {
+		ofSetColor(single[k] == selected ? ofColor::white : copies[single[k]]->diffuseColor);
+		copies[single[k]]->draw();
+		drawCalls++;
+	}
+}
+
+int ViewportBatches::numInstances() const {
+	int count = 0;
+	for (int s = VIEWPORT_SPHERE; s < VIEWPORT_SHAPES; s++)
+		count += batches[s].instances.size();
+	return count;
+}
+
+string ViewportBatches::status() const {
+	string text = "Viewport: " + ofToString(numInstances()) + " instances, " + ofToString(drawCalls) + " draw calls, spheres";
+	for (int k = 0; k < sphereLods; k++)
+		text += " " + ofToString((int)lods[k].instances.size());
+	return text;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "ofMain.h"
+
+class SceneObject;
+struct SceneSnapshot;
+
+//  Unit primitives the viewport draws instanced, see SceneObject::getViewportShape
+//
+enum ViewportShape {
+	VIEWPORT_NONE,        // drawn one by one through SceneObject::draw
+	VIEWPORT_SPHERE,      // radius 1 at the origin
+	VIEWPORT_PLANE,       // 1 x 1 in the xy plane, centered
+	VIEWPORT_CONE,        // ofDrawCone(1, 1)
+	VIEWPORT_SHAPES
+};
+
+//  Instanced drawing of the editor scene. Every object that maps to a unit
+//  primitive becomes one instance (transform and color) in the buffer of its
+//  shape, and each shape is drawn with one instanced call instead of a draw
+//  call per object.
+//
+//  update() compares the snapshot's copies with the last ones it saw; the
+//  snapshot shares unchanged objects between versions, so only edited objects
+//  are rewritten and the buffers are uploaded only when something changed.
+//  The last copies are held, so a freed copy's address can't come back as an
+//  edited object that looks unchanged.
+//  Spheres are split into three levels of detail by their projected size, and
+//  spheres outside the view are skipped; that split is redone only when the
+//  camera or the spheres move.
+//
+//  Needs the programmable renderer (GL 3.2); isSupported() is false otherwise
+//  and the caller draws objects one by one.
+//
+class ViewportBatches {
+public:
+	static const int sphereLods = 3;
+
+	bool setup();
+	bool isSupported() const { return supported; }
+
+	//  selected is the index in snapshot.scene drawn in white, -1 for none
+	//
+	void update(const SceneSnapshot &snapshot, int selected);
+	void draw(const ofCamera &camera, float viewportWidth, float viewportHeight);
+
+	int numInstances() const;
+	int numDrawCalls() const { return drawCalls; }
+	string status() const;
+
+	float lodPixels[sphereLods - 1] = { 48, 12 };   // projected radius above which a level is used
+
+private:
+	struct Instance {
+		glm::mat4 transform;
+		ofFloatColor color;
+	};
+	//  One shape (or sphere level) with its own instance buffer
+	//
+	struct Batch {
+		ofVbo vbo;
+		ofBufferObject buffer;
+		int mode = 0;
+		size_t capacity = 0;
+		vector<Instance> instances;
+		bool changed = true;
+		void setup(const ofMesh &mesh);
+		void upload();
+		void draw() const;
+	};
+	struct Slot {
+		ViewportShape shape;
+		int index;                             // in the shape's instance list
+	};
+
+	void rebuild(const SceneSnapshot &snapshot);
+	void hold(const SceneSnapshot &snapshot);
+	void splitSpheres(const ofCamera &camera, float viewportWidth, float viewportHeight);
+
+	bool supported = false;
+	ofShader shader;
+	Batch batches[VIEWPORT_SHAPES];            // sphere batch is the source of the levels, never drawn
+	Batch lods[sphereLods];
+	vector<SceneObject *> copies;              // of the last snapshot, in scene order
+	vector<shared_ptr<SceneObject>> held;      // keeps the objects of copies alive
+	vector<Slot> slots;                        // per object
+	vector<int> single;                        // objects without a shape
+	int selected = -1;
+	bool spheresChanged = true;
+	glm::mat4 lastView;
+	glm::vec2 lastViewport;
+	int drawCalls = 0;
+};
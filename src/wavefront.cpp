@@ -0,0 +1,463 @@
+#include "wavefront.h"
+#include "ofApp.h"
+#include "simd.h"
+#include <unordered_map>
+
+static const float epsilon = std::numeric_limits<float>::epsilon();
+static const float infinity = std::numeric_limits<float>::infinity();
+
+string WavefrontStats::report() const {
+	return "Wavefront: " + ofToString((int)rays.load()) + " rays, " + ofToString((int)shadowRays.load()) + " shadow rays; generate " +
+		ofToString(generateUs.load() / 1000.0, 1) + " ms, intersect " + ofToString(intersectUs.load() / 1000.0, 1) + " ms, shade " +
+		ofToString(shadeUs.load() / 1000.0, 1) + " ms, shadow " + ofToString(shadowUs.load() / 1000.0, 1) + " ms (thread total)";
+}
+
+void WavefrontGeometry::build(const vector<SceneObject *> &objects) {
+	vector<int> all(objects.size());
+	for (int a = 0; a < objects.size(); a++)
+		all[a] = a;
+	build(objects, all);
+}
+
+void WavefrontGeometry::build(const vector<SceneObject *> &objects, const vector<int> &subset) {
+	this->objects = objects;
+	sx.clear(); sy.clear(); sz.clear(); sr.clear(); sphereIndex.clear();
+	py.clear(); pMinX.clear(); pMaxX.clear(); pMinZ.clear(); pMaxZ.clear(); planeIndex.clear();
+	clouds.clear();
+	other.clear();
+	for (int k = 0; k < subset.size(); k++) {
+		int a = subset[k];
+		Sphere *sphere = dynamic_cast<Sphere *>(objects[a]);
+		Plane *plane = dynamic_cast<Plane *>(objects[a]);
+		if (sphere) {
+			sx.push_back(sphere->position.x);
+			sy.push_back(sphere->position.y);
+			sz.push_back(sphere->position.z);
+			sr.push_back(sphere->radius);
+			sphereIndex.push_back(a);
+		}
+		else if (plane && plane->normal == glm::vec3(0, 1, 0)) {
+			py.push_back(plane->position.y);
+			pMinX.push_back(plane->position.x - plane->width / 2);
+			pMaxX.push_back(plane->position.x + plane->width / 2);
+			pMinZ.push_back(plane->position.z - plane->height / 2);
+			pMaxZ.push_back(plane->position.z + plane->height / 2);
+			planeIndex.push_back(a);
+		}
+		else if (dynamic_cast<SphereCloud *>(objects[a]))
+			clouds.push_back(a);
+		else
+			other.push_back(a);
+	}
+}
+
+void WavefrontRenderer::render(ofApp &app, const RenderContext &ctx, RenderTarget &target, int x0, int x1, int y0, int y1) {
+	if (x0 >= x1 || y0 >= y1) return;
+	stats = target.wavefrontStats.get();
+	//Primary rays of each tile only test the objects of its tile list, all
+	//indexed into the candidates of the region so hits sort by one object index
+	tileX0 = x0 / target.tileSize;
+	tileY0 = y0 / target.tileSize;
+	tilesWide = (x1 - 1) / target.tileSize - tileX0 + 1;
+	int tilesHigh = (y1 - 1) / target.tileSize - tileY0 + 1;
+	vector<SceneObject *> candidates;
+	std::unordered_map<SceneObject *, int> index;
+	tileGeometry.resize(tilesWide * tilesHigh);
+	vector<int> subset;
+	for (int t = 0; t < tilesWide * tilesHigh; t++) {
+		const vector<SceneObject *> &list = target.tileLists[(tileY0 + t / tilesWide) * target.tilesX + tileX0 + t % tilesWide];
+		subset.clear();
+		for (int a = 0; a < list.size(); a++) {
+			auto found = index.insert(std::make_pair(list[a], (int)candidates.size()));
+			if (found.second)
+				candidates.push_back(list[a]);
+			subset.push_back(found.first->second);
+		}
+		tileGeometry[t].build(candidates, subset);
+	}
+	primary.objects = candidates;
+	occluders = target.occluders.get();
+	int width = target.settings.width;
+	pixelWidth = width;
+	int samples = target.settings.samples;
+	glm::vec3 stepX = target.rasterStepX, stepY = target.rasterStepY;
+	float pixelAngle = glm::length(stepX) / glm::length(target.rasterOrigin + stepX * (width * 0.5f) + stepY * (target.settings.height * 0.5f));
+	int rowsPerBatch = max(1, batchRays / max(1, (x1 - x0) * samples));
+	for (int yb = y0; yb < y1; yb += rowsPerBatch) {
+		int ye = min(y1, yb + rowsPerBatch);
+		uint64_t start = ofGetElapsedTimeMicros();
+		generate(target, x0, x1, yb, ye);
+		sortByTile(rays, target.tileSize);
+		uint64_t generated = ofGetElapsedTimeMicros();
+		for (int t = 0; t < tileGeometry.size(); t++)
+			if (tileStart[t] < tileStart[t + 1])
+				intersect(rays, tileGeometry[t], false, tileStart[t], tileStart[t + 1]);
+		uint64_t intersected = ofGetElapsedTimeMicros();
+		shade(app, ctx, target, pixelAngle);
+		uint64_t shaded = ofGetElapsedTimeMicros();
+		//Soft shadows: first pass samples for every term, the rest only in penumbrae
+		queueShadowRays(true);
+		traceShadows();
+		queueShadowRays(false);
+		traceShadows();
+		//Resolve light terms and average the samples of each pixel
+		for (int k = 0; k < terms.size(); k++) {
+			const LightTerm &term = terms[k];
+			if (term.used)
+				terms[k].visibility = float(term.visible) / term.used;
+			if (terms[k].visibility != 0)
+				colors[rays.owner[hits[term.hit]]] += term.color * terms[k].visibility;
+		}
+		for (int g = 0; g < pixel.size(); g += samples) {
+			glm::vec3 sum = glm::vec3(0, 0, 0);
+			for (int s = 0; s < samples; s++)
+				sum += glm::vec3(colors[g + s].r, colors[g + s].g, colors[g + s].b);
+			sum /= 255.0 * samples;
+			target.setPixel(pixel[g] % width, pixel[g] / width, sum);
+		}
+		if (stats) {
+			stats->rays += rays.size();
+			stats->generateUs += generated - start;
+			stats->intersectUs += intersected - generated;
+			stats->shadeUs += shaded - intersected;
+			stats->shadowUs += ofGetElapsedTimeMicros() - shaded;
+		}
+	}
+}
+
+//  Camera rays in pixel order, samples of a pixel together. Directions are
+//  stepped along the scanline like the depth first path. Pixels the target's
+//  trace mask excludes are skipped.
+//
+void WavefrontRenderer::generate(const RenderTarget &target, int x0, int x1, int y0, int y1) {
+	int width = target.settings.width;
+	int samples = target.settings.samples;
+	glm::vec3 stepX = target.rasterStepX, stepY = target.rasterStepY;
+	int n = (x1 - x0) * (y1 - y0) * samples;
+	rays.resize(n);
+	pixel.resize(n);
+	sample.resize(n);
+	colors.resize(n);
+	int g = 0;
+	for (int j = y0; j < y1; j++) {
+		glm::vec3 pixelDir = target.rasterOrigin + stepX * float(x0) + stepY * float(j);
+		for (int i = x0; i < x1; i++, pixelDir += stepX) {
+			if (!target.traceMask.empty() && !target.traceMask[j * width + i]) continue;
+			Sampler sampler(target.snapshot->samplerType, samples, j * width + i);
+			for (int s = 0; s < samples; s++, g++) {
+				glm::vec2 offset = (samples == 1) ? glm::vec2(0.5, 0.5) : sampler.get(s);
+				glm::vec3 d = glm::normalize(pixelDir + stepX * offset.x + stepY * offset.y);
+				rays.ox[g] = target.origin.x;
+				rays.oy[g] = target.origin.y;
+				rays.oz[g] = target.origin.z;
+				rays.dx[g] = d.x;
+				rays.dy[g] = d.y;
+				rays.dz[g] = d.z;
+				rays.owner[g] = g;
+				pixel[g] = j * width + i;
+				sample[g] = s;
+			}
+		}
+	}
+	//Less when reprojection filled some pixels
+	rays.resize(g);
+	pixel.resize(g);
+	sample.resize(g);
+	colors.resize(g);
+}
+
+//  Counting sort of a camera ray batch by tile, then by the signs of the
+//  direction. tileStart gets the first ray of each tile.
+//
+void WavefrontRenderer::sortByTile(Rays &rays, int tileSize) {
+	int n = rays.size();
+	int width = pixelWidth, tiles = tileGeometry.size();
+	vector<int> counts(tiles * 8 + 1, 0);
+	vector<int> key(n);
+	for (int r = 0; r < n; r++) {
+		int p = pixel[rays.owner[r]];
+		int tile = (p / width / tileSize - tileY0) * tilesWide + p % width / tileSize - tileX0;
+		key[r] = tile * 8 + ((rays.dx[r] < 0) | ((rays.dy[r] < 0) << 1) | ((rays.dz[r] < 0) << 2));
+		counts[key[r] + 1]++;
+	}
+	for (int k = 1; k < counts.size(); k++)
+		counts[k] += counts[k - 1];
+	tileStart.resize(tiles + 1);
+	for (int t = 0; t <= tiles; t++)
+		tileStart[t] = counts[t * 8];
+	order.resize(n);
+	for (int r = 0; r < n; r++)
+		order[counts[key[r]]++] = r;
+	Rays &sorted = scratch;
+	sorted.resize(n);
+	for (int k = 0; k < n; k++) {
+		int r = order[k];
+		sorted.ox[k] = rays.ox[r]; sorted.oy[k] = rays.oy[r]; sorted.oz[k] = rays.oz[r];
+		sorted.dx[k] = rays.dx[r]; sorted.dy[k] = rays.dy[r]; sorted.dz[k] = rays.dz[r];
+		sorted.t[k] = rays.t[r]; sorted.object[k] = rays.object[r]; sorted.owner[k] = rays.owner[r];
+	}
+	std::swap(rays, sorted);
+}
+
+//  Closest hit of rays [begin, end), one object at a time over blocks of rays
+//  small enough to stay in cache. For any hit rays t holds the maximum distance
+//  on entry and object is set to 1 when the ray is blocked.
+//
+void WavefrontRenderer::intersect(Rays &rays, const WavefrontGeometry &geometry, bool anyHit, int begin, int end) {
+	if (end < 0) end = rays.size();
+	float *ox = rays.ox.data(), *oy = rays.oy.data(), *oz = rays.oz.data();
+	float *dx = rays.dx.data(), *dy = rays.dy.data(), *dz = rays.dz.data();
+	float *t = rays.t.data();
+	int *object = rays.object.data();
+	if (!anyHit) {
+		for (int r = begin; r < end; r++) {
+			t[r] = infinity;
+			object[r] = -1;
+		}
+	}
+	//Record hits of eight rays, usually none or a few lanes
+	auto record = [&](int mask, int r, const Float8 &dist, int index) {
+		float d[Float8::lanes];
+		dist.store(d);
+		for (int k = 0; k < Float8::lanes; k++) {
+			if (!((mask >> k) & 1)) continue;
+			if (anyHit)
+				object[r + k] = 1;
+			else {
+				t[r + k] = d[k];
+				object[r + k] = index;
+			}
+		}
+	};
+	Float8 eps(epsilon), zero(0.0f);
+	for (int blockBegin = begin; blockBegin < end; blockBegin += blockRays) {
+		int blockEnd = min(end, blockBegin + blockRays);
+		//Spheres, same math as glm::intersectRaySphere
+		for (int s = 0; s < geometry.sphereIndex.size(); s++) {
+			float cx = geometry.sx[s], cy = geometry.sy[s], cz = geometry.sz[s], r2 = geometry.sr[s] * geometry.sr[s];
+			int index = geometry.sphereIndex[s];
+			Vec3x8 c(glm::vec3(cx, cy, cz));
+			Float8 radius2(r2);
+			int r = blockBegin;
+			for (; r + Float8::lanes <= blockEnd; r += Float8::lanes) {
+				Vec3x8 e = c - Vec3x8::load(ox + r, oy + r, oz + r);
+				Float8 t0 = e.dot(Vec3x8::load(dx + r, dy + r, dz + r));
+				Float8 d2 = e.dot(e) - t0 * t0;
+				Float8 t1 = sqrt(max(radius2 - d2, zero));
+				Float8 dist = select(t0 > t1 + eps, t0 - t1, t0 + t1);
+				int hit = ((d2 <= radius2) & (dist > eps) & (dist < Float8::load(t + r))).mask();
+				if (hit)
+					record(hit, r, dist, index);
+			}
+			for (; r < blockEnd; r++) {
+				float ex = cx - ox[r], ey = cy - oy[r], ez = cz - oz[r];
+				float t0 = ex * dx[r] + ey * dy[r] + ez * dz[r];
+				float d2 = ex * ex + ey * ey + ez * ez - t0 * t0;
+				float t1 = sqrtf(fmaxf(r2 - d2, 0.0f));
+				float dist = t0 > t1 + epsilon ? t0 - t1 : t0 + t1;
+				if (d2 <= r2 && dist > epsilon && dist < t[r])
+					record(1, r, Float8(dist), index);
+			}
+		}
+		//Horizontal planes, glm::intersectRayPlane then the extent test of Plane::intersect
+		for (int p = 0; p < geometry.planeIndex.size(); p++) {
+			float y = geometry.py[p], minX = geometry.pMinX[p], maxX = geometry.pMaxX[p], minZ = geometry.pMinZ[p], maxZ = geometry.pMaxZ[p];
+			int index = geometry.planeIndex[p];
+			Float8 py(y), one(1.0f), x0(minX), x1(maxX), z0(minZ), z1(maxZ);
+			int r = blockBegin;
+			for (; r + Float8::lanes <= blockEnd; r += Float8::lanes) {
+				Float8 ry = Float8::load(dy + r);
+				Float8 slanted = abs(ry) > eps;
+				Float8 dist = (py - Float8::load(oy + r)) / select(slanted, ry, one);
+				Float8 hx = Float8::load(ox + r) + Float8::load(dx + r) * dist, hz = Float8::load(oz + r) + Float8::load(dz + r) * dist;
+				int hit = (slanted & (dist > zero) & (hx > x0) & (x1 > hx) & (hz > z0) & (z1 > hz) & (dist < Float8::load(t + r))).mask();
+				if (hit)
+					record(hit, r, dist, index);
+			}
+			for (; r < blockEnd; r++) {
+				float dist = (y - oy[r]) / (fabsf(dy[r]) > epsilon ? dy[r] : 1.0f);
+				float hx = ox[r] + dx[r] * dist, hz = oz[r] + dz[r] * dist;
+				if (fabsf(dy[r]) > epsilon && dist > 0 && hx > minX && hx < maxX && hz > minZ && hz < maxZ && dist < t[r])
+					record(1, r, Float8(dist), index);
+			}
+		}
+		//Everything else one ray at a time
+		for (int k = 0; k < geometry.other.size(); k++) {
+			SceneObject *obj = geometry.objects[geometry.other[k]];
+			for (int r = blockBegin; r < blockEnd; r++) {
+				if (anyHit && object[r]) continue;
+				glm::vec3 o(ox[r], oy[r], oz[r]), point, normal;
+				if (obj->intersect(Ray(o, glm::vec3(dx[r], dy[r], dz[r])), point, normal)) {
+					float dist = glm::length(point - o);
+					if (dist < t[r]) {
+						if (anyHit)
+							object[r] = 1;
+						else {
+							t[r] = dist;
+							object[r] = geometry.other[k];
+						}
+					}
+				}
+			}
+		}
+	}
+	//Out of core spheres, the whole batch at once so rays waiting for the same chunk share one read
+	for (int k = 0; k < geometry.clouds.size(); k++) {
+		SphereCloud *cloud = static_cast<SphereCloud *>(geometry.objects[geometry.clouds[k]]);
+		cloud->store->intersect(end - begin, ox + begin, oy + begin, oz + begin, dx + begin, dy + begin, dz + begin, t + begin, object + begin, geometry.clouds[k], anyHit, cloud->position - cloud->origin);
+	}
+}
+
+//  Color misses, then shade hits grouped by object and set up their light terms
+//
+void WavefrontRenderer::shade(ofApp &app, const RenderContext &ctx, RenderTarget &target, float pixelAngle) {
+	const SceneSnapshot &snapshot = *ctx.scene;
+	int width = target.settings.width;
+	int n = rays.size();
+	//Compact hits and sort them by object
+	vector<int> counts(primary.objects.size() + 1, 0);
+	for (int r = 0; r < n; r++) {
+		if (rays.object[r] >= 0)
+			counts[rays.object[r] + 1]++;
+		else {
+			int g = rays.owner[r];
+			colors[g] = app.missColor(ctx, glm::vec3(rays.dx[r], rays.dy[r], rays.dz[r]));
+			if (sample[g] == 0 && !target.aovs.empty())
+				target.aovs.writeMiss(pixel[g] % width, pixel[g] / width);
+		}
+	}
+	for (int k = 1; k < counts.size(); k++)
+		counts[k] += counts[k - 1];
+	hits.resize(counts.back());
+	for (int r = 0; r < n; r++)
+		if (rays.object[r] >= 0)
+			hits[counts[rays.object[r]]++] = r;
+	hitPoint.resize(hits.size());
+	terms.clear();
+	const RenderSettings &settings = *ctx.settings;
+	for (int k = 0; k < hits.size(); k++) {
+		int r = hits[k];
+		int g = rays.owner[r];
+		SceneObject *object = primary.objects[rays.object[r]];
+		Ray ray(glm::vec3(rays.ox[r], rays.oy[r], rays.oz[r]), glm::vec3(rays.dx[r], rays.dy[r], rays.dz[r]));
+		glm::vec3 p = ray.p + ray.d * rays.t[r], norm;
+		if (dynamic_cast<Sphere *>(object))
+			norm = (p - object->position) / static_cast<Sphere *>(object)->radius;
+		else if (dynamic_cast<Plane *>(object) && static_cast<Plane *>(object)->normal == glm::vec3(0, 1, 0))
+			norm = glm::vec3(0, 1, 0);
+		else
+			object->intersect(ray, p, norm);
+		ofColor diffuse = app.surfaceColor(ctx, object, p, norm, ray, pixelAngle);
+		hitPoint[k] = p;
+		colors[g] = app.ambient(ctx, p, norm, diffuse) + app.environment(ctx, p, norm, diffuse);
+		if (sample[g] == 0 && !target.aovs.empty())
+			target.aovs.write(pixel[g] % width, pixel[g] / width, rays.t[r], normalize(norm), target.objectIds.find(object)->second, diffuse);
+		//One term per light, the same expressions as lambert() and phong()
+		glm::vec3 n = normalize(norm);
+		glm::vec3 v = normalize(ctx.eye - p);
+		int lights = snapshot.pointLights.size() + snapshot.spotLights.size();
+		for (int i = 0; i < lights; i++) {
+			bool spot = i >= snapshot.pointLights.size();
+			SceneObject *light = spot ? (SceneObject *)snapshot.spotLights[i - snapshot.pointLights.size()] : (SceneObject *)snapshot.pointLights[i];
+			float intensity = spot ? snapshot.spotLights[i - snapshot.pointLights.size()]->intensity : snapshot.pointLights[i]->intensity;
+			float radius = 1;
+			float lightSource = (intensity / (radius * radius));
+			glm::vec3 l = normalize(light->position - p);
+			if (spot) {
+				SpotLight *spotLight = snapshot.spotLights[i - snapshot.pointLights.size()];
+				glm::vec3 dir = normalize(spotLight->position - spotLight->aim);
+				if (fastAcos(glm::dot(l, dir)) >= snapshot.spotSize)
+					continue;
+			}
+			ofColor color;
+			if (snapshot.phong) {
+				glm::vec3 h = normalize(v + l);
+				color = diffuse * lightSource * max(float(0), dot(n, l)) + object->specularColor * lightSource * pow(max(float(0), dot(n, h)), snapshot.power);
+			}
+			else
+				color = diffuse * lightSource * max(float(0), dot(n, l));
+			LightTerm term = { k, light, color, 1, 0, 0, 0, 0, false, Sampler(snapshot.samplerType, 1, 0), p + (n * 0.1) };
+			if (ctx.shadowMaps)
+				term.visibility = app.lightVisibility(ctx, p, n, light);
+			else if (settings.softShadows) {
+				term.soft = true;
+				term.samples = settings.shadowSamples;
+				term.firstPass = min(4, term.samples);
+				term.sampler = Sampler(snapshot.samplerType, term.samples, hashPoint(p));
+			}
+			else {
+				term.samples = term.firstPass = 1;
+			}
+			terms.push_back(term);
+		}
+	}
+}
+
+//  Shadow rays for terms still to be resolved, sorted by light. The first wave
+//  takes the first pass samples of every term, the second the remaining samples
+//  of terms whose first pass neither all hit nor all missed.
+//
+void WavefrontRenderer::queueShadowRays(bool firstWave) {
+	vector<int> termIndex, sampleIndex;
+	for (int k = 0; k < terms.size(); k++) {
+		LightTerm &term = terms[k];
+		if (term.samples == 0) continue;
+		int begin = firstWave ? 0 : term.firstPass;
+		int end = firstWave ? term.firstPass : term.samples;
+		if (!firstWave && (term.visible == 0 || term.visible == term.firstPass)) continue;
+		for (int s = begin; s < end; s++) {
+			termIndex.push_back(k);
+			sampleIndex.push_back(s);
+		}
+	}
+	int n = termIndex.size();
+	shadows.resize(n);
+	//Stable sort by light
+	vector<SceneObject *> lights;
+	vector<int> lightOf(n);
+	for (int q = 0; q < n; q++) {
+		SceneObject *light = terms[termIndex[q]].light;
+		int l = find(lights.begin(), lights.end(), light) - lights.begin();
+		if (l == lights.size()) lights.push_back(light);
+		lightOf[q] = l;
+	}
+	vector<int> counts(lights.size() + 1, 0);
+	for (int q = 0; q < n; q++)
+		counts[lightOf[q] + 1]++;
+	for (int k = 1; k < counts.size(); k++)
+		counts[k] += counts[k - 1];
+	for (int q = 0; q < n; q++) {
+		int r = counts[lightOf[q]]++;
+		LightTerm &term = terms[termIndex[q]];
+		glm::vec3 origin = term.origin, dir;
+		float maxDist;
+		if (!term.soft) {
+			maxDist = infinity;
+			dir = normalize(term.light->position - hitPoint[term.hit]);
+		}
+		else {
+			//Samples are drawn in order, as estimateVisibility does
+			glm::vec3 toLight = term.light->sampleLight(hitPoint[term.hit], term.sampler.get(sampleIndex[q])) - origin;
+			maxDist = glm::length(toLight);
+			dir = toLight / maxDist;
+		}
+		shadows.ox[r] = origin.x; shadows.oy[r] = origin.y; shadows.oz[r] = origin.z;
+		shadows.dx[r] = dir.x; shadows.dy[r] = dir.y; shadows.dz[r] = dir.z;
+		shadows.t[r] = maxDist;
+		shadows.object[r] = 0;
+		shadows.owner[r] = termIndex[q];
+	}
+}
+
+//  Any hit test of the queued shadow rays, then count them into their terms
+//
+void WavefrontRenderer::traceShadows() {
+	if (shadows.size() == 0) return;
+	if (stats) stats->shadowRays += shadows.size();
+	intersect(shadows, *occluders, true);
+	for (int r = 0; r < shadows.size(); r++) {
+		LightTerm &term = terms[shadows.owner[r]];
+		term.used++;
+		if (!shadows.object[r]) term.visible++;
+	}
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "ofMain.h"
+#include "sampler.h"
+#include <atomic>
+
+class ofApp;
+class RenderTarget;
+class SceneObject;
+struct RenderContext;
+
+//  Rays and stage times of a wavefront pass, summed over all threads
+//
+struct WavefrontStats {
+	std::atomic<uint64_t> rays{ 0 }, shadowRays{ 0 };
+	std::atomic<uint64_t> generateUs{ 0 }, intersectUs{ 0 }, shadeUs{ 0 }, shadowUs{ 0 };
+	string report() const;
+};
+
+//  Scene objects split by the wavefront intersection loop that handles them
+//
+struct WavefrontGeometry {
+	vector<float> sx, sy, sz, sr;         // spheres
+	vector<int> sphereIndex;
+	vector<float> py, pMinX, pMaxX, pMinZ, pMaxZ;   // planes with normal (0, 1, 0)
+	vector<int> planeIndex;
+	vector<int> clouds;                   // SphereCloud, batches through GeometryStore
+	vector<int> other;                    // anything else, through SceneObject::intersect
+	vector<SceneObject *> objects;
+	void build(const vector<SceneObject *> &objects);
+	//  Only objects[subset[k]], indices still into objects
+	//
+	void build(const vector<SceneObject *> &objects, const vector<int> &subset);
+};
+
+//  Breadth first alternative to ofApp::renderRegion. Rays of a region go through
+//  the pipeline in large batches, one stage at a time:
+//
+//  generate   - camera rays for every pixel sample, sorted by direction octant
+//  intersect  - object by object over all rays, spheres and horizontal planes
+//               eight rays at a time with Float8 (simd.h); sphere clouds pass
+//               the whole batch to GeometryStore, which defers rays waiting
+//               for chunks from disk
+//  shade      - hits compacted and sorted by object, one light term per light
+//  shadow     - shadow rays sorted by light and tested object by object for any
+//               hit; soft shadows run the same adaptive two waves as
+//               estimateVisibility
+//
+//  Shading uses the same color arithmetic as the depth first path, so both give
+//  the same image up to floating point differences in the intersection math.
+//  Soft shadow samplers are seeded from the exact hit point, so those
+//  differences change the penumbra noise pattern, not its average.
+//  One renderer per thread, it keeps its buffers between calls. Shadow rays
+//  test the whole scene, built once per pass (RenderTarget::occluders); regions
+//  should be row bands of about batchRays samples so the batches fill up.
+//
+class WavefrontRenderer {
+public:
+	void render(ofApp &app, const RenderContext &ctx, RenderTarget &target, int x0, int x1, int y0, int y1);
+
+	static const int batchRays = 1 << 14;
+	static const int blockRays = 1024;        // rays per pass over the objects in intersect
+
+private:
+	//  Structure of arrays ray batch
+	//
+	struct Rays {
+		vector<float> ox, oy, oz, dx, dy, dz, t;
+		vector<int> object, owner;
+		void resize(int n) {
+			ox.resize(n); oy.resize(n); oz.resize(n);
+			dx.resize(n); dy.resize(n); dz.resize(n);
+			t.resize(n); object.resize(n); owner.resize(n);
+		}
+		int size() const { return dx.size(); }
+	};
+	//  Unshadowed contribution of one light at one hit
+	//
+	struct LightTerm {
+		int hit;
+		SceneObject *light;
+		ofColor color;
+		float visibility;
+		int visible, used, firstPass, samples;   // shadow rays, samples is 0 when visibility is already known
+		bool soft;
+		Sampler sampler;
+		glm::vec3 origin;
+	};
+
+	void generate(const RenderTarget &target, int x0, int x1, int y0, int y1);
+	void sortByTile(Rays &rays, int tileSize);
+	void intersect(Rays &rays, const WavefrontGeometry &geometry, bool anyHit, int begin = 0, int end = -1);
+	void shade(ofApp &app, const RenderContext &ctx, RenderTarget &target, float pixelAngle);
+	void queueShadowRays(bool firstWave);
+	void traceShadows();
+
+	WavefrontGeometry primary;               // objects of the region, hits index into them
+	vector<WavefrontGeometry> tileGeometry;   // per tile of the region
+	vector<int> tileStart;                    // first camera ray of each tile after sortByTile
+	int tileX0 = 0, tileY0 = 0, tilesWide = 0, pixelWidth = 0;
+	Rays rays;                                // camera rays of the batch
+	vector<int> pixel, sample;                // per camera ray
+	vector<ofColor> colors;                   // per camera ray
+	vector<int> hits;                         // camera rays that hit, sorted by object
+	vector<glm::vec3> hitPoint;               // per hit, where its shadow rays start
+	vector<LightTerm> terms;
+	Rays shadows;
+	Rays scratch;
+	vector<int> order;
+	WavefrontStats *stats = NULL;
+	const WavefrontGeometry *occluders = NULL;
+};
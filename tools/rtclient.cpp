@@ -0,0 +1,189 @@
+//  Command line client for the render server (src/server.h).
+//
+//  Build:  g++ -std=c++14 -O2 tools/rtclient.cpp -o rtclient
+//  Usage:  rtclient [-s socket] [-o image.ppm] [-n repeats] [command ...]
+//
+//  Each argument is one protocol command, e.g.
+//      rtclient "move 0 1 0 0" "render 400 300"
+//  With no commands they are read from stdin, one per line. -n runs the list
+//  repeatedly and summarizes edit-to-pixel latency: the time from sending the
+//  first command since the previous render finished to the first streamed
+//  tile and to the finished image.
+//
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+static double nowMs() {
+	return chrono::duration<double, milli>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//  Buffered reads of lines and binary payloads from the socket
+//
+class Connection {
+public:
+	bool open(const string &path) {
+		sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		return fd >= 0 && connect(fd, (sockaddr *)&address, sizeof(address)) == 0;
+	}
+	~Connection() { if (fd >= 0) close(fd); }
+	bool send(const string &line) {
+		string data = line + "\n";
+		size_t sent = 0;
+		while (sent < data.size()) {
+			ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, 0);
+			if (n <= 0) return false;
+			sent += n;
+		}
+		return true;
+	}
+	bool readLine(string &line) {
+		size_t end;
+		while ((end = buffer.find('\n')) == string::npos)
+			if (!fill()) return false;
+		line = buffer.substr(0, end);
+		buffer.erase(0, end + 1);
+		return true;
+	}
+	bool readBytes(size_t count, vector<unsigned char> &bytes) {
+		while (buffer.size() < count)
+			if (!fill()) return false;
+		bytes.assign(buffer.begin(), buffer.begin() + count);
+		buffer.erase(0, count);
+		return true;
+	}
+private:
+	bool fill() {
+		char chunk[65536];
+		ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+		if (n <= 0) return false;
+		buffer.append(chunk, n);
+		return true;
+	}
+	int fd = -1;
+	string buffer;
+};
+
+struct Latency {
+	double firstTile, done, renderMs, reused;
+	int tiles;
+};
+
+static void savePPM(const string &path, int width, int height, const vector<unsigned char> &rgb) {
+	ofstream out(path, ios::binary);
+	out << "P6\n" << width << " " << height << "\n255\n";
+	out.write((const char *)rgb.data(), rgb.size());
+}
+
+//  Send one command and read its replies. Renders are followed to the end.
+//
+static bool runCommand(Connection &connection, const string &command, double editStart, const string &imagePath, vector<Latency> &latencies) {
+	if (!connection.send(command)) return false;
+	bool render = command.compare(0, 6, "render") == 0;
+	Latency latency = { -1, -1, 0, 0, 0 };
+	string line;
+	vector<unsigned char> payload;
+	while (connection.readLine(line)) {
+		istringstream in(line);
+		string kind;
+		in >> kind;
+		if (kind == "tile") {
+			int id, x, y, w, h;
+			in >> id >> x >> y >> w >> h;
+			if (!connection.readBytes(size_t(w) * h * 3, payload)) return false;
+			if (latency.tiles++ == 0)
+				latency.firstTile = nowMs() - editStart;
+		}
+		else if (kind == "image") {
+			int id, w, h;
+			in >> id >> w >> h;
+			if (!connection.readBytes(size_t(w) * h * 3, payload)) return false;
+			if (!imagePath.empty())
+				savePPM(imagePath, w, h, payload);
+		}
+		else if (kind == "job")
+			continue;
+		else if (kind == "done") {
+			int id;
+			in >> id >> latency.renderMs >> latency.reused;
+			latency.done = nowMs() - editStart;
+			latencies.push_back(latency);
+			printf("job %d: first tile %.1f ms, image %.1f ms after the edit (%d tiles, %.1f ms on the server, %.0f%% reprojected)\n",
+				id, latency.firstTile, latency.done, latency.tiles, latency.renderMs, latency.reused * 100);
+			return true;
+		}
+		else if (kind == "cancelled") {
+			cout << line << endl;
+			return true;
+		}
+		else {
+			//ok / error / object lines
+			cout << line << endl;
+			if (kind == "error" || (kind == "ok" && !render))
+				return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char *argv[]) {
+	string socketPath = "/tmp/raytracer.sock", imagePath;
+	int repeats = 1;
+	vector<string> commands;
+	for (int k = 1; k < argc; k++) {
+		string arg = argv[k];
+		if (arg == "-s" && k + 1 < argc) socketPath = argv[++k];
+		else if (arg == "-o" && k + 1 < argc) imagePath = argv[++k];
+		else if (arg == "-n" && k + 1 < argc) repeats = max(1, atoi(argv[++k]));
+		else commands.push_back(arg);
+	}
+	if (commands.empty()) {
+		string line;
+		while (getline(cin, line))
+			if (!line.empty()) commands.push_back(line);
+	}
+	Connection connection;
+	if (!connection.open(socketPath)) {
+		cerr << "Cannot connect to " << socketPath << ", is the app running with --daemon?" << endl;
+		return 1;
+	}
+	vector<Latency> latencies;
+	for (int r = 0; r < repeats; r++) {
+		double editStart = -1;
+		for (int k = 0; k < commands.size(); k++) {
+			if (editStart < 0) editStart = nowMs();
+			if (!runCommand(connection, commands[k], editStart, imagePath, latencies)) {
+				cerr << "Connection closed" << endl;
+				return 1;
+			}
+			if (commands[k].compare(0, 6, "render") == 0) editStart = -1;
+		}
+	}
+	if (latencies.size() > 1) {
+		vector<double> first, done;
+		for (int k = 0; k < latencies.size(); k++) {
+			first.push_back(latencies[k].firstTile);
+			done.push_back(latencies[k].done);
+		}
+		sort(first.begin(), first.end());
+		sort(done.begin(), done.end());
+		printf("%d renders: first tile min %.1f / median %.1f ms, image min %.1f / median %.1f ms\n", (int)latencies.size(),
+			first.front(), first[first.size() / 2], done.front(), done[done.size() / 2]);
+	}
+	return 0;
+}